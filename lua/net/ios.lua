@@ -27,7 +27,8 @@
 -- Usage:	data[,errmsg,err] = _refill(ios)
 -- Desc:	Request data from a source object
 -- Input:	ios (table) Input/Output object
--- Return:	data (string) data to collect, nil on error/EOF
+-- Return:	data (string) data to collect, true if the data was added
+--			| directly to ios._readbuf, nil on error/EOF
 --		errmsg (string/optional) if error, error message
 --		err (integer/optional) system error code
 --
@@ -39,19 +40,43 @@
 --		errmsg (string/optional) error message
 --		err (integer/optional) system error code
 --
+-- and can optionally provide a third:
+--
+-- Usage:	okay[,errmsg,err] = _drainv(ios,queue[,low])
+-- Desc:	Write data from the output queue
+-- Input:	ios (table) Input/Output object
+--		queue (userdata) org.conman.wqueue of pending output
+--		low (integer/optional) wait until no more than this much
+--			| data remains queued; if not given, only write
+--			| what can be written without waiting
+-- Return:	okay (boolean) true if success, false if error
+--		errmsg (string/optional) error message
+--		err (integer/optional) system error code
+--
+-- If not provided, _drain() is called for each piece of the queue.
+--
 -- ===================================================================
 
+local iobuf  = require "org.conman.iobuf"
+local wqueue = require "org.conman.wqueue"
 local string = require "string"
 local table  = require "table"
-local math   = require "math"
 
-local select    = select
-local type      = type
-local error     = error
-local unpack    = table.unpack or unpack
-local tonumber  = tonumber
-local tointeger = math.tointeger or function(s) return tonumber(s) end
+local select = select
+local type   = type
+local error  = error
+local pcall  = pcall
+local unpack = table.unpack or unpack
 
+-- *******************************************************************
+-- The input buffer (ios._readbuf) is an org.conman.iobuf object, so
+-- appending data and removing data from the front does not copy the
+-- unread data each time.  It is set to nil once everything has been read
+-- after EOF.
+--
+-- The output (ios._writebuf) is an org.conman.wqueue object, which keeps
+-- the strings written along with how much of the first one has been
+-- sent, so a partial write doesn't copy the rest of the output.
 -- *******************************************************************
 
 local function refill(ios)
@@ -59,90 +84,21 @@ local function refill(ios)
   if not data then
     if errm then error { errm,err } end
     ios._eof = true
-  else
-    ios._readbuf = ios._readbuf .. data
+  elseif data ~= true then
+    ios._readbuf:append(data)
   end
   return data
 end
 
--- *******************************************************************
--- usage:       number = read_number(ios)
--- desc:        Read a number (in text form) to a number
--- input:       ios (table) Input/Output object
--- return:      number (number) data from source, nil on error
---
--- Note:        This is a direct translation of read_number() from
---              liolib.c
 -- *******************************************************************
 
-local function read_number(ios)
-  local function nextc(rn)
-    if #rn.buff >= 200 then
-      return false
-    else
-      rn.buff = rn.buff .. rn.c
-      rn.c    = ios:read(1)
-      return true
-    end
-  end
-  
-  local function test2(rn,c1,c2)
-    if rn.c == c1 or rn.c == c2 then
-      return nextc(rn)
-    else
-      return false
-    end
-  end
-  
-  local function readdigits(rn,hex)
-    local count = 0
-    while rn.c and rn.c:match(hex) and nextc(rn) do
-      count = count + 1
-    end
-    return count
-  end
-  
-  local rn        = { buff = "" , c = "" }
-  local hex       = "%d"
-  local exp1,exp2 = 'e','E'
-  local count     = 0
-  local integer   = true
-  
-  repeat
-    rn.c = ios:read(1)
-  until not rn.c or not rn.c:match"%s"
-  
-  test2(rn,'-','+')
-  if test2(rn,'0','0') then
-    if test2(rn,'x','X') then
-      hex = "%x"
-      exp1,exp2 = 'p','P'
-    else
-      count = 1
-    end
-  end
-  
-  count = count + readdigits(rn,hex)
-  if test2(rn,'.','.') then
-    count   = count + readdigits(rn,hex)
-    integer = false
-  end
-  
-  if count > 0 and test2(rn,exp1,exp2) then
-    test2(rn,'-','+')
-    readdigits(rn,"%d")
-    integer = false
-  end
-  
-  if rn.c then
-    ios._readbuf = rn.c .. ios._readbuf -- ungetc()
-  end
-  
-  if integer then
-    return tointeger(rn.buff)
-  else
-    return tonumber(rn.buff)
+local function rest(ios)
+  local data
+  if ios._readbuf then
+    data         = ios._readbuf:get()
+    ios._readbuf = nil
   end
+  return data
 end
 
 -- *******************************************************************
@@ -150,152 +106,108 @@ end
 local READER READER =
 {
   ['*n'] = function(ios)
-    return read_number(ios)
+    if not ios._readbuf then
+      return nil
+    end
+    
+    -- ------------------------------------------------------------------
+    -- If the number runs to the end of the buffer, get more data and try
+    -- again.  At EOF, the buffer is done with (as if ios:read(1) had
+    -- returned nil).
+    -- ------------------------------------------------------------------
+    
+    local number,more = ios._readbuf:getnumber(ios._eof)
+    if more then
+      if not ios._eof then
+        refill(ios)
+        return READER['*n'](ios)
+      end
+      ios._readbuf = nil
+    end
+    
+    return number
   end,
   
   -- ====================================================================
   
   ['*l'] = function(ios)
     if ios._eof then
-      local data   = ios._readbuf
-      ios._readbuf = nil
-      return data
-    end
-    
-    local s = ios._readbuf:find("[\r\n]",ios._rpos)
-    if not s then
-      ios._rpos = #ios._readbuf + 1
-      refill(ios)
-      return READER['*l'](ios)
+      return rest(ios)
     end
     
-    local s2,e2 = ios._readbuf:find("\r?\n",s)
-    if not s2 then
+    local line = ios._readbuf:getline()
+    if not line then
       refill(ios)
       return READER['*l'](ios)
     end
     
-    local data   = ios._readbuf:sub(1,s2-1)
-    ios._readbuf = ios._readbuf:sub(e2 + 1,-1)
-    ios._rpos    = 1
-    return data
+    return line
   end,
   
   -- ====================================================================
   
   ['*a'] = function(ios)
-    local data
-    
     if ios._eof then
-      if ios._readbuf then
-        data = ios._readbuf
-        ios._readbuf = nil
-      end
-      return data
+      return rest(ios)
     end
     
     repeat
-      data = refill(ios)
+      local data = refill(ios)
     until not data
     
-    data         = ios._readbuf
-    ios._readbuf = nil
-    ios._eof     = true
-    return data
+    ios._eof = true
+    return rest(ios)
   end,
   
   -- ====================================================================
   
   ['*L'] = function(ios)
     if ios._eof then
-      local data = ios._readbuf
-      ios._readbuf = nil
-      return data
+      return rest(ios)
     end
     
-    local s = ios._readbuf:find("[\r\n]",ios._rpos)
-    if not s then
-      ios._rpos = #ios._readbuf + 1
+    local line = ios._readbuf:getline(true)
+    if not line then
       refill(ios)
       return READER['*L'](ios)
     end
     
-    local s2,e2 = ios._readbuf:find("\r?\n",s)
-    if not s2 then
-      refill(ios)
-      return READER['*L'](ios)
-    end
-    
-    local data   = ios._readbuf:sub(1,e2)
-    ios._readbuf = ios._readbuf:sub(e2 + 1,-1)
-    ios._rpos    = 1
-    return data
+    return line
   end,
   
   -- ====================================================================
   
   ['*h'] = function(ios)
     if ios._eof then
-      local data = ios._readbuf
-      ios._readbuf = nil
-      return data
-    end
-    
-    -- ------------------------
-    -- Scan for first CR or LF
-    -- ------------------------
-    
-    local s = ios._readbuf:find("[\r\n]",ios._rpos)
-    if not s then
-      ios._rpos = #ios._readbuf + 1
-      refill(ios)
-      return READER['*h'](ios)
+      return rest(ios)
     end
     
-    -- ---------------
-    -- Check for CRLF
-    -- ---------------
-    
-    local s2 = ios._readbuf:find("\r?\n",s)
-    if not s2 then
-      refill(ios)
-      return READER['*h'](ios)
-    end
-    
-    -- --------------------------------------------------
-    -- Check for CRLFCRLF.
-    -- --------------------------------------------------
-    
-    local s3,e3 = ios._readbuf:find("\r?\n\r?\n",s2)
+    -- ------------------------------------------------------------------
+    -- Scan for a blank line.  The buffer remembers how far it has
+    -- scanned, so data isn't scanned again after a refill.
+    -- ------------------------------------------------------------------
     
-    if not s3 then
+    local header = ios._readbuf:getheader()
+    if not header then
       refill(ios)
       return READER['*h'](ios)
     end
     
-    local data   = ios._readbuf:sub(1,e3)
-    ios._readbuf = ios._readbuf:sub(e3+1,-1)
-    ios._rpos    = 1
-    return data
+    return header
   end,
   
   -- ====================================================================
   
   ['*b'] = function(ios)
     if ios._eof then
-      local data   = ios._readbuf
-      ios._readbuf = nil
-      return data
+      return rest(ios)
     end
     
-    if ios._readbuf == "" then
+    if #ios._readbuf == 0 then
       refill(ios)
     end
     
-    local data   = ios._readbuf
-    ios._readbuf = ""
-    ios._rpos    = 1
-    return data
+    return ios._readbuf:get()
   end,
 }
 
@@ -308,41 +220,50 @@ READER['b'] = READER['*b'] -- extension
 
 -- *******************************************************************
 
+local function drainv(ios,queue)
+  while #queue > 0 do
+    local data          = queue:peek(ios._wsize > 0 and ios._wsize or nil)
+    local okay,errm,err = ios:_drain(data)
+    if not okay then
+      return okay,errm,err
+    end
+    queue:skip(#data)
+  end
+  return true
+end
+
+-- *******************************************************************
+-- Once the output reaches the buffer size, write what can be written
+-- without waiting.  Only if more than the high water mark remains does
+-- the writer wait, until the output drops to the low water mark.
+-- *******************************************************************
+
 local MODE MODE =
 {
   ['no'] = function(self)
-    local okay,errm,err = self:_drain(self._writebuf)
-    if okay then
-      self._writebuf = ""
-    end
-    return okay,errm,err
+    return self:_drainv(self._writebuf,0)
   end,
   
-  ['line'] = function(self)
-    while true do
-      local nl = self._writebuf:find("\n",1,true)
-      if not nl then
-        return MODE.full(self)
-      else
-        local okay,errm,err = self:_drain(self._writebuf:sub(1,nl))
-        if not okay then
-          return okay,errm,err
-        end
-        self._writebuf = self._writebuf:sub(nl+1,-1)
-      end
+  ['line'] = function(self,newline)
+    if newline then
+      return self:_drainv(self._writebuf,0)
+    else
+      return MODE.full(self)
     end
   end,
   
   ['full'] = function(self)
-    while #self._writebuf >= self._wsize do
-      local okay,errm,err = self:_drain(self._writebuf:sub(1,self._wsize))
-      if not okay then
-        return okay,errm,err
-      end
-      self._writebuf = self._writebuf:sub(self._wsize + 1, -1)
+    local queue = self._writebuf
+    
+    if #queue < self._wsize then
+      return true
+    end
+    
+    if #queue < self._whigh then
+      return self:_drainv(queue)
     end
     
-    return true
+    return self:_drainv(queue,self._wlow)
   end,
 }
 
@@ -378,11 +299,7 @@ end
 
 local function flush(ios)
   if #ios._writebuf > 0 then
-    local okay,errm,err = ios._drain(ios,ios._writebuf)
-    if okay then
-      ios._writebuf = ""
-    end
-    return okay,errm,err
+    return ios:_drainv(ios._writebuf,0)
   end
   return true
 end
@@ -421,15 +338,11 @@ local function read(ios,...)
     end
     
     if #ios._readbuf >= amount then
-      local data   = ios._readbuf:sub(1,amount)
-      ios._readbuf = ios._readbuf:sub(amount + 1,-1)
-      return data
+      return ios._readbuf:get(amount)
     end
     
     if ios._eof then
-      local data = ios._readbuf
-      ios._readbuf = ""
-      return data
+      return ios._readbuf:get()
     end
     
     refill(ios)
@@ -477,6 +390,56 @@ local function read(ios,...)
   end
 end
 
+-- *******************************************************************
+-- Usage:       n[,errmsg,err] = readuint(ios,size,order)
+-- Desc:        Read an unsigned binary integer
+-- Input:       ios (table) Input/Output object
+--              size (integer) size in bytes
+--              order (enum/optional) 'big' (default) or 'little'
+-- Return:      n (integer) value, nil on error or EOF
+--              errmsg (string/optional) system error message
+--              err (integer/optional) system error code
+-- *******************************************************************
+
+local function readuint(ios,size,order)
+  local function implementation()
+    while ios._readbuf and #ios._readbuf < size and not ios._eof do
+      refill(ios)
+    end
+    
+    if ios._readbuf then
+      return ios._readbuf:getuint(size,order)
+    end
+  end
+  
+  local okay,data = pcall(implementation)
+  if okay then
+    return data
+  else
+    return nil,data[1],data[2]
+  end
+end
+
+-- *******************************************************************
+-- Usage:       n[,errmsg,err] = ios:readu16([order])
+--              n[,errmsg,err] = ios:readu32([order])
+--              n[,errmsg,err] = ios:readu64([order])
+-- Desc:        Read an unsigned 16, 32 or 64 bit binary integer
+-- Input:       order (enum/optional)
+--                      * 'big' (default---network byte order)
+--                      * 'little'
+-- Return:      n (integer) value, nil on error or EOF
+--              errmsg (string/optional) system error message
+--              err (integer/optional) system error code
+--
+-- NOTE:        On Lua 5.3 or higher, a 64 bit value of 2^63 or higher is
+--		returned as a negative integer.
+-- *******************************************************************
+
+local function readu16(ios,order) return readuint(ios,2,order) end
+local function readu32(ios,order) return readuint(ios,4,order) end
+local function readu64(ios,order) return readuint(ios,8,order) end
+
 -- *******************************************************************
 -- Usage:       pos[,errmsg,err] = ios:seek([whence][,offset])
 -- Desc:        Seek to an arbitrary position
@@ -526,6 +489,28 @@ local function setvbuf(ios,mode,size)
   return true
 end
 
+-- *******************************************************************
+-- Usage:       okay = ios:setwatermark(low,high)
+-- Desc:        Set how much buffered output a writer can leave queued
+-- Input:       low (integer) amount of output to wait for when over high
+--              high (integer) amount of output allowed before waiting
+-- Return:      okay (boolean) true
+--
+-- NOTE:        This only applies to 'full' buffering, and only to
+--		a _drainv() that can write without waiting.  The default
+--		of 0 for both waits until all the output has been written,
+--		as before.
+-- *******************************************************************
+
+local function setwatermark(ios,low,high)
+  if low > high then
+    error("bad argument #1 to 'setwatermark' (low exceeds high)")
+  end
+  ios._wlow  = low
+  ios._whigh = high
+  return true
+end
+
 -- *******************************************************************
 -- Usage:       self[,errmsg,err] = ios:write([data...])
 -- Desc:        Write data to TCP connection
@@ -544,16 +529,22 @@ local function write(ios,...)
     return false,"stream closed",-2
   end
   
+  local line    = ios._mode == MODE.line
+  local newline = false
+  
   for i = 1 , select('#',...) do
     local data = select(i,...)
     if type(data) ~= 'string' and type(data) ~= 'number' then
       error("string or number expected, got " .. type(data))
     end
     
-    ios._writebuf = ios._writebuf .. data
+    ios._writebuf:push(data)
+    if line and type(data) == 'string' and data:find("\n",1,true) then
+      newline = true
+    end
   end
   
-  local okay,errm,err = ios:_mode()
+  local okay,errm,err = ios:_mode(newline)
   okay = okay and ios or false
   return okay,errm,err
 end
@@ -570,13 +561,20 @@ return function()
     setvbuf = setvbuf,
     write   = write,
     
-    _readbuf  = "",
-    _rpos     = 1,
-    _writebuf = "",
+    readu16      = readu16,      -- extension
+    readu32      = readu32,      -- extension
+    readu64      = readu64,      -- extension
+    setwatermark = setwatermark, -- extension
+    
+    _readbuf  = iobuf(),
+    _writebuf = wqueue(),
     _wsize    = 4096,
+    _wlow     = 0,
+    _whigh    = 0,
     _mode     = MODE.full,
     _eof      = false,
     _refill   = function() error("failed to provide ios._refill()") end,
     _drain    = function() error("failed to provide ios._drain()")  end,
+    _drainv   = drainv,
   }
 end
@@ -0,0 +1,215 @@
+-- *******************************************************************
+--
+-- Copyright 2026 by Sean Conner.  All Rights Reserved.
+--
+-- This library is free software; you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as published by
+-- the Free Software Foundation; either version 3 of the License, or (at your
+-- option) any later version.
+--
+-- This library is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+-- or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+-- License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public License
+-- along with this library; if not, see <http://www.gnu.org/licenses/>.
+--
+-- Comments, questions and criticisms can be sent to: sean@conman.org
+--
+-- *******************************************************************
+-- luacheck: globals secret new
+-- luacheck: ignore 611
+--
+-- ===================================================================
+--
+-- Server side TLS session resumption shared between processes.
+--
+-- libtls resumes sessions with session tickets, which carry the session
+-- state encrypted under a ticket key.  So sharing sessions between worker
+-- processes only requires that they share the ticket keys (and the session
+-- ID context).  Instead of passing keys around, every process derives them
+-- from a shared secret and the current time period:
+--
+--	key(n) = SHA-384(secret .. "ticket" .. n)
+--	n      = floor(time / lifetime)
+--
+-- so all the workers switch to a new key at the same time without talking
+-- to each other.  The secret can be generated before forking, or kept in a
+-- file that all the workers read.
+--
+--	tlssession = require "org.conman.net.tlssession"
+--	store      = tlssession.new(tlssession.secret("/var/run/app.tls"))
+--	store:configure(config) -- before server:configure(config)
+--	store:rotate(config)    -- periodically, or before each accept
+--
+-- ===================================================================
+
+local fsys    = require "org.conman.fsys"
+local hash    = require "org.conman.hash"
+local process = require "org.conman.process"
+local tls     = require "org.conman.tls"
+local io      = require "io"
+local os      = require "os"
+local math    = require "math"
+
+local _VERSION     = _VERSION
+local setmetatable = setmetatable
+local tostring     = tostring
+
+if _VERSION == "Lua 5.1" then
+  module("org.conman.net.tlssession")
+else
+  _ENV = {}
+end
+
+-- *******************************************************************
+
+local SECRETSIZE = tls.TICKET_KEY_SIZE
+
+local function random(size)
+  local f = io.open("/dev/urandom","rb")
+  if not f then return nil end
+  local data = f:read(size)
+  f:close()
+  return data
+end
+
+-- *******************************************************************
+-- Usage:       secret[,err] = tlssession.secret([filename])
+-- Desc:        Return a secret for deriving ticket keys
+-- Input:       filename (string/optional) file to keep the secret in
+-- Return:      secret (string) secret, nil on error
+--              err (string/optional) error message
+--
+-- NOTE:        If the file doesn't exist, it's created (mode 0600) with
+--		a random secret.  Creating it is atomic, so workers
+--		starting at the same time all end up with the same secret.
+-- *******************************************************************
+
+function secret(filename)
+  if not filename then
+    return random(SECRETSIZE)
+  end
+  
+  local f = io.open(filename,"rb")
+  if not f then
+    local data = random(SECRETSIZE)
+    if not data then return nil,"can't read /dev/urandom" end
+    
+    local tmp     = filename .. "." .. tostring(process.PID)
+    local umask   = fsys.umask("rw-------")
+    local out,err = io.open(tmp,"wb")
+    fsys.umask(umask)
+    if not out then return nil,err end
+    out:write(data)
+    out:close()
+    
+    -- ------------------------------------------------------------
+    -- link() fails if filename exists, so only one process gets to
+    -- create it.  Everyone then reads what's there.
+    -- ------------------------------------------------------------
+    
+    fsys.link(tmp,filename)
+    os.remove(tmp)
+    
+    f,err = io.open(filename,"rb")
+    if not f then return nil,err end
+  end
+  
+  local data = f:read("*a")
+  f:close()
+  
+  if #data < SECRETSIZE then
+    return nil,filename .. ": secret too short"
+  end
+  return data
+end
+
+-- *******************************************************************
+
+local function derive(store,label)
+  return hash.sum(store.secret .. label,'sha384')
+end
+
+-- *******************************************************************
+
+local function addkey(store,config,n)
+  local okay = config:add_ticket_key(n % 4294967296,derive(store,"ticket" .. n))
+  if okay then
+    store.keyrev[config] = n
+  end
+  return okay
+end
+
+-- *******************************************************************
+-- Usage:       okay[,err] = store:configure(config)
+-- Desc:        Configure a server config for shared session tickets
+-- Input:       config (userdata) TLS server configuration
+-- Return:      okay (boolean) true if success, false if error
+--              err (string/optional) error message
+-- *******************************************************************
+
+local function configure(store,config)
+  local n = math.floor(os.time() / store.lifetime)
+  
+  if not config:session_lifetime(store.lifetime)
+  or not config:session_id(derive(store,"session-id"):sub(1,tls.MAX_SESSION_ID_LENGTH))
+  or not addkey(store,config,n - 1)
+  or not addkey(store,config,n) then
+    return false,config:error()
+  end
+  return true
+end
+
+-- *******************************************************************
+-- Usage:       rotated = store:rotate(config)
+-- Desc:        Switch to the key for the current time period
+-- Input:       config (userdata) TLS server configuration
+-- Return:      rotated (boolean) true if a new key was added
+--
+-- NOTE:        This is cheap enough to call before every accept.  libtls
+--		keeps the last few keys, so tickets issued under the
+--		previous key are still accepted.  Each config is tracked
+--		separately, so one store can serve many configs.
+-- *******************************************************************
+
+local function rotate(store,config)
+  local n = math.floor(os.time() / store.lifetime)
+  if n > (store.keyrev[config] or -1) then
+    return addkey(store,config,n)
+  end
+  return false
+end
+
+-- *******************************************************************
+-- Usage:       store = tlssession.new(secret[,lifetime])
+-- Desc:        Create a ticket key store
+-- Input:       secret (string) shared secret (see tlssession.secret())
+--              lifetime (integer/optional) session lifetime in seconds,
+--			| also how often the key changes (default 3600)
+-- Return:      store (table) ticket key store
+-- *******************************************************************
+
+function new(secret_,lifetime)
+  return setmetatable(
+    {
+      secret   = secret_,
+      lifetime = lifetime or 3600,
+      keyrev   = setmetatable({},{ __mode = "k" }), -- per config
+    },
+    {
+      __index =
+      {
+        configure = configure,
+        rotate    = rotate,
+      }
+    }
+  )
+end
+
+-- *******************************************************************
+
+if _VERSION >= "Lua 5.2" then
+  return _ENV -- luacheck: ignore
+end
@@ -0,0 +1,282 @@
+-- *******************************************************************
+--
+-- Copyright 2026 by Sean Conner.  All Rights Reserved.
+--
+-- This library is free software; you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as published by
+-- the Free Software Foundation; either version 3 of the License, or (at your
+-- option) any later version.
+--
+-- This library is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+-- or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+-- License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public License
+-- along with this library; if not, see <http://www.gnu.org/licenses/>.
+--
+-- Comments, questions and criticisms can be sent to: sean@conman.org
+--
+-- *******************************************************************
+-- luacheck: globals new
+-- luacheck: ignore 611
+--
+-- ===================================================================
+--
+-- A server context per host name (SNI), loaded the first time the name is
+-- asked for, instead of loading every keypair at startup.  Loaded contexts
+-- are kept in LRU order and the least recently used are dropped once the
+-- certificates and keys take more than the memory limit.  Each context is
+-- rebuilt (and swapped in) when its files change.
+--
+--	tlsstore = require "org.conman.net.tlsstore"
+--	store    = tlsstore.new(function(name)
+--	  return "/etc/certs/" .. name .. ".crt","/etc/certs/" .. name .. ".key"
+--	end)
+--	server = store:get(tls.servername(clienthello))
+--
+-- ===================================================================
+
+local fsys = require "org.conman.fsys"
+local tls  = require "org.conman.tls"
+local os   = require "os"
+
+local _VERSION     = _VERSION
+local setmetatable = setmetatable
+local type         = type
+
+if _VERSION == "Lua 5.1" then
+  module("org.conman.net.tlsstore")
+else
+  _ENV = {}
+end
+
+-- *******************************************************************
+
+local function version(file)
+  local info = fsys.stat(file)
+  if info then
+    return info.inode .. ":" .. info.mtime .. ":" .. info.size
+  end
+end
+
+-- *******************************************************************
+-- Usage:       server,config,size = load(store,certfile,keyfile)
+-- Desc:        Create a server context for a keypair
+-- Return:      server (userdata/TLS) server context, nil on error
+--              config (userdata/TLS_CONF) configuration, or error message
+--              size (integer) size of certificate and key
+-- *******************************************************************
+
+local function load(store,certfile,keyfile)
+  local cert = tls.load_file(certfile)
+  if not cert then return nil,certfile .. ": can't load" end
+  local key = tls.load_file(keyfile)
+  if not key then return nil,keyfile .. ": can't load" end
+  
+  local config = tls.config()
+  
+  if store.conf and not store.conf(config) then
+    return nil,config:error()
+  end
+  
+  if not config:keypair_mem(cert,key) then
+    return nil,config:error()
+  end
+  
+  if store.session then
+    local okay,err = store.session:configure(config)
+    if not okay then return nil,err end
+  end
+  
+  local server = tls.server()
+  if not server:configure(config) then
+    return nil,server:error()
+  end
+  
+  return server,config,#cert + #key
+end
+
+-- *******************************************************************
+
+local function unlink(entry)
+  entry.prev.next = entry.next
+  entry.next.prev = entry.prev
+end
+
+local function push(store,entry)
+  entry.next      = store.lru.next
+  entry.prev      = store.lru
+  entry.next.prev = entry
+  store.lru.next  = entry
+end
+
+-- *******************************************************************
+-- Usage:       okay = hostname(name)
+-- Desc:        Check a host name (in lower case) before it goes anywhere
+--              near lookup(), which likely builds a file name out of it.
+--              An empty name (no SNI) is fine.
+-- Input:       name (string) host name from the client
+-- Return:      okay (boolean) true if LDH labels of 1 to 63 bytes, no
+--                      | more than 253 bytes in all
+-- *******************************************************************
+
+local function hostname(name)
+  if #name > 253 then
+    return false
+  end
+  
+  if name == "" then
+    return true
+  end
+  
+  for label in (name .. "."):gmatch("([^.]*)%.") do
+    if #label == 0 or #label > 63
+    or label:find("[^a-z0-9%-]")
+    or label:find("^%-") or label:find("%-$") then
+      return false
+    end
+  end
+  
+  return true
+end
+
+-- *******************************************************************
+-- Usage:       server[,err] = store:get(servername)
+-- Desc:        Return the server context for a host name
+-- Input:       servername (string) host name
+-- Return:      server (userdata/TLS) server context, nil if unknown, not
+--                      | a valid host name, or on error
+--              err (string/optional) error message
+--
+-- NOTE:        If the files for a loaded context have changed, a new
+--		context is created and replaces the old one; connections
+--		using the old one are unaffected.  If the new files don't
+--		load, the old context is kept.
+-- *******************************************************************
+
+local function get(store,servername)
+  if type(servername) ~= 'string' then
+    return nil
+  end
+  
+  servername = servername:lower()
+  if not hostname(servername) then
+    return nil
+  end
+  
+  local now   = os.time()
+  local entry = store.names[servername]
+  
+  if entry then
+    unlink(entry)
+    push(store,entry)
+    
+    if now - entry.checked >= store.recheck then
+      entry.checked = now
+      local v = (version(entry.certfile) or "") .. (version(entry.keyfile) or "")
+      if v ~= entry.version then
+        local server,config,size = load(store,entry.certfile,entry.keyfile)
+        if server then
+          store.memory  = store.memory - entry.size + size
+          entry.server  = server
+          entry.config  = config
+          entry.size    = size
+          entry.version = v
+        end
+      end
+    end
+    
+    if store.session then
+      store.session:rotate(entry.config)
+    end
+    
+    return entry.server
+  end
+  
+  local certfile,keyfile = store.lookup(servername)
+  if not certfile then
+    return nil
+  end
+  
+  local v                  = (version(certfile) or "") .. (version(keyfile) or "")
+  local server,config,size = load(store,certfile,keyfile)
+  if not server then
+    return nil,config
+  end
+  
+  entry =
+  {
+    name     = servername,
+    certfile = certfile,
+    keyfile  = keyfile,
+    server   = server,
+    config   = config,
+    size     = size,
+    version  = v,
+    checked  = now,
+  }
+  
+  store.names[servername] = entry
+  store.memory            = store.memory + size
+  push(store,entry)
+  
+  -- ----------------------------------------------------------------
+  -- Drop the least recently used, but always keep the one just loaded.
+  -- ----------------------------------------------------------------
+  
+  while store.memory > store.maxmem and store.lru.prev ~= entry do
+    local old = store.lru.prev
+    unlink(old)
+    store.names[old.name] = nil
+    store.memory          = store.memory - old.size
+  end
+  
+  return server
+end
+
+-- *******************************************************************
+-- Usage:       store = tlsstore.new(lookup[,conf[,maxmem[,session[,recheck]]]])
+-- Desc:        Create a store of server contexts indexed by host name
+-- Input:       lookup (function) return certificate and key file names
+--			| for a host name (in lower case), nil if unknown
+--		conf (function/optional) configure settings common to all
+--			| contexts, return true if okay
+--		maxmem (integer/optional) limit on the size of the loaded
+--			| certificates and keys (default 64M)
+--		session (table/optional) org.conman.net.tlssession store
+--		recheck (integer/optional) seconds between checking the
+--			| files for changes (default 60)
+-- Return:      store (table) certificate store
+-- *******************************************************************
+
+function new(lookup,conf,maxmem,session,recheck)
+  local lru = {}
+  lru.next  = lru
+  lru.prev  = lru
+  
+  return setmetatable(
+    {
+      lookup  = lookup,
+      conf    = conf,
+      maxmem  = maxmem  or 64 * 1024 * 1024,
+      session = session,
+      recheck = recheck or 60,
+      names   = {},
+      lru     = lru,
+      memory  = 0,
+    },
+    {
+      __index =
+      {
+        get = get,
+      }
+    }
+  )
+end
+
+-- *******************************************************************
+
+if _VERSION >= "Lua 5.2" then
+  return _ENV -- luacheck: ignore
+end
@@ -18,21 +18,26 @@
 -- Comments, questions and criticisms can be sent to: sean@conman.org
 --
 -- ********************************************************************
--- luacheck: globals listens listena listen connecta connect
+-- luacheck: globals listens listena listen connecta connect handoff inherit
 -- luacheck: ignore 611
 
 local syslog    = require "org.conman.syslog"
 local errno     = require "org.conman.errno"
 local net       = require "org.conman.net"
+local process   = require "org.conman.process"
+local env       = require "org.conman.env"
+local exit      = require "org.conman.const.exit"
 local mkios     = require "org.conman.net.ios"
 local nfl       = require "org.conman.nfl"
 local coroutine = require "coroutine"
 
 local _VERSION     = _VERSION
 local tostring     = tostring
+local tonumber     = tonumber
 local setmetatable = setmetatable
 local assert       = assert
 local ipairs       = ipairs
+local pairs        = pairs
 
 if _VERSION == "Lua 5.1" then
   module(...)
@@ -61,19 +66,25 @@ local function create_handler(conn,remote)
     return coroutine.yield()
   end
   
-  ios._drain = function(self,data)
-    local bytes,err = self.__socket:send(nil,data)
-    if err ~= 0 then
-      syslog('error',"socket:send() = %s",errno[err])
-      return false,errno[err],err
-    end
-    
-    ios.__wbytes = self.__wbytes + bytes;
-    if bytes < #data then
-      nfl.SOCKETS:update(self.__socket,'w')
-      coroutine.yield()
-      data = data:sub(bytes + 1,-1)
-      return self:_drain(data)
+  -- ------------------------------------------------------------------
+  -- Write straight out of the output queue with writev(), so a partial
+  -- write just advances the queue instead of copying what's left.
+  -- ------------------------------------------------------------------
+  
+  ios._drainv = function(self,queue,low)
+    while #queue > (low or 0) do
+      local bytes,err = queue:writev(self.__socket:_tofd())
+      if err == 0 then
+        self.__wbytes = self.__wbytes + bytes
+      elseif err ~= errno.EAGAIN then
+        syslog('error',"queue:writev() = %s",errno[err])
+        return false,errno[err],err
+      elseif not low then
+        return true
+      else
+        nfl.SOCKETS:update(self.__socket,'w')
+        coroutine.yield()
+      end
     end
     return true
   end
@@ -267,6 +278,94 @@ function connect(host,port,to)
   end
 end
 
+-- **********************************************************************
+-- Usage:       pid,errmsg = tcp.handoff(binary,argv,socks)
+-- Desc:        Start a replacement process and pass it listening sockets
+-- Input:       binary (string) path of program to execute
+--              argv (table) array of arguments for the program
+--              socks (table) array of listening sockets to pass along
+-- Return:      pid (integer) process ID of new process, nil on error
+--              errmsg (string) error message
+--
+-- Note:        The sockets are passed over a UNIX socket whose descriptor
+--              is given to the new process in $NFL_HANDOFF; the new
+--              process picks them up with tcp.inherit().  The caller still
+--              owns its copies of the sockets, and should stop listening on
+--              them (and drain existing connections) once the new process
+--              is up and running.
+-- **********************************************************************
+
+function handoff(binary,argv,socks)
+  local parent,child,err = net.socketpair()
+  if not parent then
+    return nil,errno[err]
+  end
+  
+  local pid,err1 = process.fork()
+  
+  if not pid then
+    parent:close()
+    child:close()
+    return nil,errno[err1]
+  end
+  
+  if pid == 0 then
+    local newenv = {}
+    for name,value in pairs(env) do
+      newenv[name] = value
+    end
+    newenv.NFL_HANDOFF = tostring(child:_tofd())
+    child.closeexec    = false
+    parent:close()
+    process.exec(binary,argv,newenv)
+    process.exit(exit.OSERR)
+  end
+  
+  child:close()
+  local _,err2 = parent:sendfds("nfl",socks)
+  parent:close()
+  
+  if err2 ~= 0 then
+    syslog('error',"sock:sendfds() = %s",errno[err2])
+    return nil,errno[err2]
+  end
+  
+  return pid
+end
+
+-- **********************************************************************
+-- Usage:       socks,errmsg = tcp.inherit([to])
+-- Desc:        Collect listening sockets passed by tcp.handoff()
+-- Input:       to (number/optional) timeout the operation after to seconds
+-- Return:      socks (table) array of listening sockets, nil if none
+--              errmsg (string) error message
+--
+-- Note:        The sockets returned are suitable for tcp.listens() (or
+--              tls.listens()).
+-- **********************************************************************
+
+function inherit(to)
+  local fd = tonumber(env.NFL_HANDOFF)
+  if not fd then
+    return nil
+  end
+  
+  local pair        = net._fromfd(fd)
+  local _,socks,err = pair:recvfds(to)
+  pair:close()
+  
+  if err ~= 0 then
+    syslog('error',"sock:recvfds() = %s",errno[err])
+    return nil,errno[err]
+  end
+  
+  for _,sock in ipairs(socks) do
+    sock.nonblock = true
+  end
+  
+  return socks
+end
+
 -- **********************************************************************
 
 if _VERSION >= "Lua 5.2" then
@@ -18,7 +18,7 @@
 -- Comments, questions and criticisms can be sent to: sean@conman.org
 --
 -- ********************************************************************
--- luacheck: globals listens listena listen connecta connect
+-- luacheck: globals listens listena listen connecta connect offload SESSIONS
 -- luacheck: ignore 611
 --
 -- We require org.conman.tls.LIBRESSL_VERSION >= 0x2050000f
@@ -29,12 +29,19 @@ local mkios     = require "org.conman.net.ios"
 local net       = require "org.conman.net"
 local tls       = require "org.conman.tls"
 local nfl       = require "org.conman.nfl"
+local _         = require "org.conman.fsys" -- _tofd() for files
 local coroutine = require "coroutine"
+local io        = require "io"
 
 local _VERSION     = _VERSION
 local assert       = assert
 local setmetatable = setmetatable
 local ipairs       = ipairs
+local pairs        = pairs
+local type         = type
+
+local RECORDSIZE = 16384 -- largest TLS record payload
+local REFILLSIZE = 4 * RECORDSIZE
 
 if _VERSION == "Lua 5.1" then
   module(...)
@@ -42,6 +49,68 @@ else
   _ENV = {} -- luacheck: ignore
 end
 
+-- **********************************************************************
+-- Session resumption counts for server side handshakes, and the client
+-- side session files, indexed by "hostname:port".  Only so many session
+-- files are kept; see client_session().
+-- **********************************************************************
+
+SESSIONS = { full = 0 , resumed = 0 }
+
+local MAXCLIENTSESSIONS = 64
+
+local client_sessions = {}
+local client_count    = 0
+local client_tick     = 0
+
+-- **********************************************************************
+-- Usage:       file = client_session(key)
+-- Desc:        Return the session file for a host and port
+-- Input:       key (string) "hostname:port"
+-- Return:      file (userdata/FILE) private, unlinked temporary file, nil
+--                      | on error
+--
+-- NOTE:        When full, the least recently used file is dropped from
+--              the cache.  A connection using it holds a reference, so
+--              it's closed once the last such connection is collected.
+-- **********************************************************************
+
+local function client_session(key)
+  local entry = client_sessions[key]
+  client_tick = client_tick + 1
+  
+  if not entry then
+    if client_count >= MAXCLIENTSESSIONS then
+      local oldkey,old
+      for k,e in pairs(client_sessions) do
+        if not old or e.used < old.used then
+          oldkey,old = k,e
+        end
+      end
+      client_sessions[oldkey] = nil
+      client_count            = client_count - 1
+    end
+    
+    local file = io.tmpfile()
+    if not file then return nil end
+    entry                = { file = file }
+    client_sessions[key] = entry
+    client_count         = client_count + 1
+  end
+  
+  entry.used = client_tick
+  return entry.file
+end
+
+-- **********************************************************************
+-- The handshake thread pool (see offload()), the coroutines waiting on
+-- it, and the results it reports, indexed by TLS context.
+-- **********************************************************************
+
+local pool
+local pending = {}
+local results = {}
+
 -- **********************************************************************
 
 local function create_handler(conn,remote)
@@ -70,8 +139,13 @@ local function create_handler(conn,remote)
     end
   end
   
+  -- ------------------------------------------------------------------
+  -- Decrypt straight into the input buffer, taking all the data that's
+  -- available (up to REFILLSIZE) instead of a piece of a TLS record.
+  -- ------------------------------------------------------------------
+  
   ios._refill = function(self)
-    local str,len = self.__ctx:read(tls.BUFFERSIZE)
+    local len = self.__ctx:read_into(self._readbuf,REFILLSIZE)
     
     if len == tls.ERROR then
       return nil,self.__ctx:error(),-1
@@ -83,67 +157,83 @@ local function create_handler(conn,remote)
       coroutine.yield()
       return self:_refill()
     else
-      if #str == 0 then
+      if len == 0 then
         return nil
       else
-        ios.__rbytes = ios.__rbytes + #str
-        return str
+        ios.__rbytes = ios.__rbytes + len
+        return true
       end
     end
   end
   
-  ios._drain = function(self,data)
-    local bytes = self.__ctx:write(data)
-    
-    if bytes == tls.ERROR then
-    
-      -- --------------------------------------------------------------------
-      -- I was receiving "Resource temporarily unavailable" and trying again,
-      -- but that strategy fails upon failure to read a certificate.  So now
-      -- I'm back to returning an error.  Let's hope this works this time.
-      -- --------------------------------------------------------------------
-      
-      return false,self.__ctx:error(),-1
+  -- ------------------------------------------------------------------
+  -- Hand the output queue to TLS a record at a time; a partial write just
+  -- advances the queue instead of copying what's left.  TLS needs a write
+  -- that wants input or output retried, so this waits even when low is
+  -- not given.
+  -- ------------------------------------------------------------------
+  
+  ios._drainv = function(self,queue,low)
+    while #queue > (low or 0) do
+      local bytes = self.__ctx:write(queue:peek(RECORDSIZE))
       
-    elseif bytes == tls.WANT_INPUT then
-      coroutine.yield()
-      return self:_drain(data)
+      if bytes == tls.ERROR then
       
-    elseif bytes == tls.WANT_OUTPUT then
-      nfl.SOCKETS:update(self.__socket,"w")
-      coroutine.yield()
-      return self:_drain(data)
-      
-    elseif bytes < #data then
-      ios.__wbytes = ios.__wbytes + bytes
-      nfl.SOCKETS:update(self.__socket,"w")
-      coroutine.yield()
-      return self:_drain(data:sub(bytes+1,-1))
-    else
-      ios.__wbytes = ios.__wbytes + bytes
+        -- --------------------------------------------------------------------
+        -- I was receiving "Resource temporarily unavailable" and trying again,
+        -- but that strategy fails upon failure to read a certificate.  So now
+        -- I'm back to returning an error.  Let's hope this works this time.
+        -- --------------------------------------------------------------------
+        
+        return false,self.__ctx:error(),-1
+        
+      elseif bytes == tls.WANT_INPUT then
+        coroutine.yield()
+        
+      elseif bytes == tls.WANT_OUTPUT then
+        nfl.SOCKETS:update(self.__socket,"w")
+        coroutine.yield()
+        
+      else
+        ios.__wbytes = ios.__wbytes + bytes
+        queue:skip(bytes)
+      end
     end
     
     return true
   end
   
+  -- ------------------------------------------------------------------
+  -- There's no TLS context to close if servesni() dropped the connection
+  -- before picking one.
+  -- ------------------------------------------------------------------
+  
   ios.close = function(self)
+    if self.__closed then return true end
+    
     -- -----------------------------------------------------------------
     -- XXX - this call to assert() seems to remove a bunch of calls to
     --       epoll_ctl() that error out under Linux.  Okay.
     -- -----------------------------------------------------------------
     assert(self.__socket:_tofd() >= 0)
-    local rc = ios.__ctx:close()
-    if rc == tls.WANT_INPUT then
-      coroutine.yield()
-      return self:close()
-    elseif rc == tls.WANT_OUTPUT then
-      nfl.SOCKETS:update(self.__socket,"w")
-      coroutine.yield()
-      return self:close()
+    if ios.__ctx then
+      local rc = ios.__ctx:close()
+      if rc == tls.WANT_INPUT then
+        coroutine.yield()
+        return self:close()
+      elseif rc == tls.WANT_OUTPUT then
+        nfl.SOCKETS:update(self.__socket,"w")
+        coroutine.yield()
+        return self:close()
+      end
     end
     
-    nfl.SOCKETS:remove(self.__socket)
-    local err = self.__socket:close()
+    if not self.__gone then
+      nfl.SOCKETS:remove(self.__socket)
+    end
+    
+    self.__closed = true
+    local err     = self.__socket:close()
     return err == 0,errno[err],err
   end
   
@@ -195,6 +285,258 @@ local function create_handler(conn,remote)
   end
 end
 
+-- **********************************************************************
+-- usage:       abort(ios)
+-- desc:        Drop a connection run by a TLS driver without a TLS close
+--              (which may need to wait on the socket)
+-- input:       ios (table) I/O object from create_driver()
+-- **********************************************************************
+
+local function abort(ios)
+  if not ios.__closed then
+    ios.__closed = true
+    ios.__drv:cancel()
+    if not ios.__gone then
+      nfl.SOCKETS:remove(ios.__socket)
+    end
+    ios.__socket:close()
+  end
+end
+
+-- **********************************************************************
+-- usage:       ios,handler = create_driver(conn,remote,ctx)
+-- desc:        Create the I/O object and event handler for a TLS context
+--              on the socket itself, run by a TLS driver (ctx:driver())
+-- input:       conn (userdata/socket) connected socket
+--              remote (userdata/address) remote connection
+--              ctx (userdata/TLS) context from accept_socket() or
+--                      | connect_socket()
+-- return:      ios (table) I/O object (similar to what io.open() returns)
+--              handler (function) event handler
+--
+-- Note:        The driver keeps a TLS operation going as the socket
+--              becomes ready, so the coroutine is only resumed once the
+--              operation is done, and not each time TLS wants more I/O.
+-- **********************************************************************
+
+local function create_driver(conn,remote,ctx)
+  local ios    = mkios()
+  ios.__socket = conn
+  ios.__remote = remote
+  ios.__ctx    = ctx
+  ios.__drv    = ctx:driver()
+  ios.__want   = 'r'
+  ios.__rbytes = 0
+  ios.__wbytes = 0
+  
+  local packet_handler
+  
+  -- ------------------------------------------------------------------
+  -- Only ask the pollset for the events needed, so an idle connection
+  -- doesn't keep waking up the event loop.
+  -- ------------------------------------------------------------------
+  
+  local function want(self,events)
+    if self.__want ~= events then
+      self.__want = events
+      nfl.SOCKETS:update(self.__socket,events)
+    end
+  end
+  
+  -- ------------------------------------------------------------------
+  -- Wait for the driver to finish an operation.  If something else (like
+  -- a timeout) resumes us first, the operation is dropped.
+  -- ------------------------------------------------------------------
+  
+  local function finish(self,rc,events)
+    if rc then return rc end
+    if self.__gone then
+      self.__drv:cancel()
+      return tls.ERROR
+    end
+    
+    want(self,events)
+    local rc1,err,code = coroutine.yield()
+    if type(rc1) ~= 'number' then
+      self.__drv:cancel()
+      if type(err) == 'number' then -- nfl.timeout() hands us just the errno
+        return nil,errno[err],err
+      end
+      return nil,err or "interrupted",code
+    end
+    return rc1
+  end
+  
+  -- ------------------------------------------------------------------
+  -- Wait for the socket itself, with no driver operation.
+  -- ------------------------------------------------------------------
+  
+  local function waitfor(self,events)
+    if self.__gone then return false end
+    want(self,events)
+    self.__wait = true
+    coroutine.yield()
+    return true
+  end
+  
+  -- ------------------------------------------------------------------
+  -- With offload(), the handshake runs on the thread pool.  The socket is
+  -- taken out of the pollset meanwhile.  Something else (like a timeout)
+  -- can still wake up the coroutine, but a worker thread is using the
+  -- context until the pool reports back, so keep waiting until there's a
+  -- result.  The result isn't passed by resuming, as nfl.schedule() drops
+  -- a wakeup for a coroutine already scheduled.
+  -- ------------------------------------------------------------------
+  
+  ios._handshake = function(self)
+    if pool and not self.__gone and pool:handshake(self.__ctx) then
+      nfl.SOCKETS:remove(self.__socket)
+      pending[self.__ctx] = coroutine.running()
+      
+      repeat
+        coroutine.yield()
+      until results[self.__ctx]
+      
+      local rc            = results[self.__ctx]
+      results[self.__ctx] = nil
+      nfl.SOCKETS:insert(self.__socket,self.__want,packet_handler)
+      
+      if rc == tls.WANT_INPUT or rc == tls.WANT_OUTPUT then
+        if not waitfor(self,rc == tls.WANT_INPUT and 'r' or 'w') then
+          return false
+        end
+        return self:_handshake()
+      end
+      return rc == 0
+    end
+    
+    return finish(self,self.__drv:handshake()) == 0
+  end
+  
+  -- ------------------------------------------------------------------
+  -- Decrypt straight into the input buffer.
+  -- ------------------------------------------------------------------
+  
+  ios._refill = function(self)
+    local len,err,code = finish(self,self.__drv:read_into(self._readbuf,REFILLSIZE))
+    
+    if not len then
+      return nil,err,code or -1
+    elseif len == tls.ERROR then
+      return nil,self.__ctx:error(),-1
+    elseif len == 0 then
+      return nil
+    else
+      self.__rbytes = self.__rbytes + len
+      return true
+    end
+  end
+  
+  -- ------------------------------------------------------------------
+  -- Hand the output queue to TLS a record at a time.  With kernel TLS,
+  -- the kernel encrypts what's written to the socket, so the queue goes
+  -- straight out with writev().
+  -- ------------------------------------------------------------------
+  
+  ios._drainv = function(self,queue,low)
+    while #queue > (low or 0) do
+      if self.__ktls then
+        local bytes,err = queue:writev(self.__socket:_tofd())
+        if err == 0 then
+          self.__wbytes = self.__wbytes + bytes
+        elseif err ~= errno.EAGAIN then
+          syslog('error',"queue:writev() = %s",errno[err])
+          return false,errno[err],err
+        elseif not low then
+          return true
+        elseif not waitfor(self,'w') then
+          return false,errno[errno.EPIPE],errno.EPIPE
+        end
+        
+      else
+        local bytes,err,code = finish(self,self.__drv:write(queue:peek(RECORDSIZE)))
+        if not bytes then
+          return false,err,code or -1
+        elseif bytes == tls.ERROR then
+          return false,self.__ctx:error(),-1
+        else
+          self.__wbytes = self.__wbytes + bytes
+          queue:skip(bytes)
+        end
+      end
+    end
+    
+    return true
+  end
+  
+  ios.close = function(self)
+    if self.__closed then return true end
+    
+    -- -----------------------------------------------------------------
+    -- XXX - this call to assert() seems to remove a bunch of calls to
+    --       epoll_ctl() that error out under Linux.  Okay.
+    -- -----------------------------------------------------------------
+    assert(self.__socket:_tofd() >= 0)
+    if not self.__gone then
+      finish(self,self.__drv:close())
+      nfl.SOCKETS:remove(self.__socket)
+    end
+    
+    self.__closed = true
+    local err     = self.__socket:close()
+    return err == 0,errno[err],err
+  end
+  
+  if _VERSION >= "Lua 5.2" then
+    local mt = {}
+    mt.__gc = abort
+    if _VERSION >= "Lua 5.4" then
+      mt.__close = ios.close
+    end
+    setmetatable(ios,mt)
+  end
+  
+  ios:setvbuf('no')
+  
+  packet_handler = function(event)
+    if coroutine.status(ios.__co) == 'dead' then
+      abort(ios)
+      return
+    end
+    
+    local rc,events = ios.__drv:pump()
+    
+    if rc then
+      nfl.schedule(ios.__co,rc)
+      
+    elseif events and event.hangup then
+      ios.__drv:cancel()
+      ios.__gone = true
+      nfl.SOCKETS:remove(ios.__socket)
+      nfl.schedule(ios.__co,tls.ERROR)
+      
+    elseif events then
+      want(ios,events)
+      
+    elseif ios.__wait then
+      ios.__wait = false
+      if event.hangup then ios._eof = true end
+      want(ios,'')
+      nfl.schedule(ios.__co,true)
+      
+    elseif event.hangup then
+      ios._eof   = true
+      ios.__gone = true
+      nfl.SOCKETS:remove(ios.__socket)
+      
+    else
+      want(ios,'')
+    end
+  end
+  
+  return ios,packet_handler
+end
+
 -- **********************************************************************
 --
 -- Callbacks for accept_cbs() and connect_cbs().
@@ -230,22 +572,129 @@ local function tlscb_write(_,str,ios)
 end
 
 -- **********************************************************************
--- Usage:       sock,errmsg = listens(sock,mainf,conf)
+-- Usage:       mainf(ios)
+-- Desc:        Do the handshake, count resumed sessions, check for kernel
+--              TLS (only possible with a TLS driver), then call the
+--              main handler (which is called even if the handshake fails,
+--              as before; the failure shows up on the first read or write)
+-- **********************************************************************
+
+local function serve(mainf,ios)
+  if ios:_handshake() then
+    if ios.__drv then
+      ios.__ktls = ios.__ctx:ktls()
+    end
+    if ios.__ctx:conn_session_resumed() then
+      SESSIONS.resumed = SESSIONS.resumed + 1
+    else
+      SESSIONS.full = SESSIONS.full + 1
+    end
+  end
+  return mainf(ios)
+end
+
+-- **********************************************************************
+-- Usage:       okay,errmsg = offload([threads])
+-- Desc:        Do server handshakes on a pool of threads, so a burst of
+--              new connections doesn't stall the established ones
+-- Input:       threads (integer/optional) number of threads (default is
+--                      | the number of CPUs)
+-- Return:      okay (boolean) true if okay, false on error
+--              errmsg (string) error message
+--
+-- Note:        This affects connections accepted afterwards.
+-- **********************************************************************
+
+function offload(threads)
+  if pool then return true end
+  
+  local err
+  pool,err = tls.pool(threads)
+  if not pool then
+    return false,errno[err]
+  end
+  
+  nfl.SOCKETS:insert(pool,'r',function()
+    for ctx,rc in pairs(pool:done()) do
+      local co     = pending[ctx]
+      pending[ctx] = nil
+      results[ctx] = rc
+      nfl.schedule(co)
+    end
+  end)
+  
+  return true
+end
+
+-- **********************************************************************
+-- Usage:       servesni(store,mainf,ios)
+-- Desc:        Wait for the ClientHello, pick the server context for the
+--              name the client asks for, then carry on as serve()
+-- Input:       store (table) org.conman.net.tlsstore store
+--              mainf (function) main handler for service
+--              ios (table) I/O object without a TLS context
+--
+-- Note:        Clients not sending a name are looked up as "".  If there
+--              is no context for the name, the connection is dropped.
+-- **********************************************************************
+
+local function servesni(store,mainf,ios)
+  local name = tls.servername(ios.__input)
+  while name == nil and not ios._eof do
+    coroutine.yield()
+    name = tls.servername(ios.__input)
+  end
+  
+  local server,err = store:get(name or "")
+  if not server then
+    if err then
+      syslog('error',"tlsstore:get(%q) = %s",name or "",err)
+    end
+    ios.__closed = true
+    ios.__gone   = true
+    nfl.SOCKETS:remove(ios.__socket)
+    ios.__socket:close()
+    return
+  end
+  
+  ios.__ctx = server:accept_cbs(ios,tlscb_read,tlscb_write)
+  return serve(mainf,ios)
+end
+
+-- **********************************************************************
+-- Usage:       sock,errmsg = listens(sock,mainf,conf[,session])
 -- Desc:        Initialize a listening TCP socket
 -- Input:       sock (userdata/socket) bound socket
 --              mainf (function) main handler for service
---              conf (function) function for TLS configuration
+--              conf (function/table) function for TLS configuration, or
+--                      | an org.conman.net.tlsstore store to pick the
+--                      | certificate by the name the client asks for
+--              session (table/optional) org.conman.net.tlssession store,
+--                      | for session resumption shared between processes
+--                      | (a tlsstore store is given its own)
 -- Return:      sock (userdata) socket used for listening, false on error
 --              errmsg (string) error message
+--
+-- Note:        Connections using a tlsstore store aren't handed to the
+--              offload() pool.
 -- **********************************************************************
 
-function listens(sock,mainf,conf)
-  local config = tls.config()
-  local server = tls.server()
+function listens(sock,mainf,conf,session)
+  local config
+  local server
   
-  if not conf(config) then return false,config:error() end
-  if not server:configure(config) then
-    return false,server:error()
+  if type(conf) ~= 'table' then
+    config = tls.config()
+    server = tls.server()
+    
+    if not conf(config) then return false,config:error() end
+    if session then
+      local okay,err = session:configure(config)
+      if not okay then return false,err end
+    end
+    if not server:configure(config) then
+      return false,server:error()
+    end
   end
   
   nfl.SOCKETS:insert(sock,'r',function()
@@ -256,28 +705,46 @@ function listens(sock,mainf,conf)
       return
     end
     
-    conn.nonblock            = true
-    conn.nodelay             = true
-    local ios,packet_handler = create_handler(conn,remote)
-    ios.__ctx                = server:accept_cbs(ios,tlscb_read,tlscb_write)
-    ios.__co                 = nfl.spawn(mainf,ios)
-    nfl.SOCKETS:insert(conn,'r',packet_handler)
+    if session and config then
+      session:rotate(config)
+    end
+    
+    conn.nonblock = true
+    conn.nodelay  = true
+    
+    if server then
+      local ctx = server:accept_socket(conn:_tofd())
+      if not ctx then
+        syslog('error',"server:accept_socket() = %s",server:error())
+        conn:close()
+        return
+      end
+      
+      local ios,packet_handler = create_driver(conn,remote,ctx)
+      ios.__co = nfl.spawn(serve,mainf,ios)
+      nfl.SOCKETS:insert(conn,'r',packet_handler)
+    else
+      local ios,packet_handler = create_handler(conn,remote)
+      ios.__co = nfl.spawn(servesni,conf,mainf,ios)
+      nfl.SOCKETS:insert(conn,'r',packet_handler)
+    end
   end)
   
   return sock
 end
 
 -- **********************************************************************
--- Usage:       sock,errmsg = listena(addr,mainf,conf)
+-- Usage:       sock,errmsg = listena(addr,mainf,conf[,session])
 -- Desc:        Initialize a listening TCP socket
 -- Input:       addr (userdata/address) IP address
 --              mainf (function) main handler for service
 --              conf (function) function for TLS configuration
+--              session (table/optional) see listens()
 -- Return:      sock (userdata) socket used for listening, false on error
 --              errmsg (string) error message
 -- **********************************************************************
 
-function listena(addr,mainf,conf)
+function listena(addr,mainf,conf,session)
   local sock,err = net.socket(addr.family,'tcp')
   
   if not sock then
@@ -288,35 +755,38 @@ function listena(addr,mainf,conf)
   sock.nonblock  = true
   sock:bind(addr)
   sock:listen()
-  return listens(sock,mainf,conf)
+  return listens(sock,mainf,conf,session)
 end
 
 -- **********************************************************************
--- Usage:       sock,errmsg = listen(host,port,mainf,config)
+-- Usage:       sock,errmsg = listen(host,port,mainf,config[,session])
 -- Desc:        Initalize a listening TCP socket
 -- Input:       host (string) address to bind to
 --              port (string integer) port
 --              mainf (function) main handler for service
 --              config (function) configuration options
+--              session (table/optional) see listens()
 -- Return:      sock (userdata) socket used for listening, false on error
 --              errmsg (string) error message
 -- **********************************************************************
 
-function listen(host,port,mainf,config)
-  return listena(net.address2(host,'any','tcp',port)[1],mainf,config)
+function listen(host,port,mainf,config,session)
+  return listena(net.address2(host,'any','tcp',port)[1],mainf,config,session)
 end
 
 -- **********************************************************************
--- Usage:       ios = tcp.connecta(addr,hostname[,to[,config]])
+-- Usage:       ios = tcp.connecta(addr,hostname[,to[,config[,resume]]])
 -- Desc:        Connect to a remote address
 -- Input:       addr (userdata/address) IP address
 --              hostname (string) hostname (required for TLS)
 --              to (number/optinal) timout the operation after to seconds
 --              config (function) configuration options
+--              resume (boolean/optional) resume sessions with this host
+--                      | and port (default false)
 -- Return:      ios (table) Input/Output object (nil on error)
 -- **********************************************************************
 
-function connecta(addr,hostname,to,conf)
+function connecta(addr,hostname,to,conf,resume)
   if not addr then return nil end
   
   local config = tls.config()
@@ -328,6 +798,17 @@ function connecta(addr,hostname,to,conf)
     config:protocols("all")
   end
   
+  -- ------------------------------------------------------------
+  -- libtls keeps a client session in a file, so if asked, keep a
+  -- (private, unlinked) temporary file per host and port to resume
+  -- sessions with.
+  -- ------------------------------------------------------------
+  
+  local session = resume and client_session(hostname .. ":" .. addr.port)
+  if session then
+    config:session_fd(session)
+  end
+  
   ctx:configure(config)
   
   local sock,err = net.socket(addr.family,'tcp')
@@ -337,61 +818,68 @@ function connecta(addr,hostname,to,conf)
     return false,errno[err]
   end
   
-  sock.nonblock            = true
-  local ios,packet_handler = create_handler(sock,addr)
-  ios.__ctx                = ctx
-  ios.__co                 = coroutine.running()
-  
-  if not ctx:connect_cbs(hostname,ios,tlscb_read,tlscb_write) then
-    syslog('error',"connect_cbs() = %s",ctx:error())
-    return false,ctx:error()
-  end
+  sock.nonblock = true
   
   -- ------------------------------------------------------------
   -- In POSIXland, a non-blocking socket doing a connect become available
   -- when it's ready for writing.  So we install a 'write' trigger, then
   -- call connect() and yield.  When we return, it's connected (unless we're
-  -- optionally timing out the operation).
+  -- optionally timing out the operation).  The TLS context can only be
+  -- attached to a connected socket.
   -- ------------------------------------------------------------
   
+  local ios,packet_handler = create_driver(sock,addr,ctx)
+  ios.__co                 = coroutine.running()
+  ios.__want               = 'w'
+  ios.__wait               = true
+  ios.__session            = session -- keep it open while connected
+  
   nfl.SOCKETS:insert(sock,'w',packet_handler)
   if to then nfl.timeout(to,false,errno.ETIMEDOUT) end
   
   sock:connect(addr)
   
   local okay,err1 = coroutine.yield()
+  ios.__wait      = false
   
   if to then nfl.timeout(0) end
   
   if not okay then
     syslog('error',"tls:connect(%s) = %s",hostname,err1 or "(nil)")
-    nfl.SOCKETS:remove(sock)
+    abort(ios)
     return false,err1
   end
   
   if ios._eof then
-    ios:close()
+    abort(ios)
     return nil
-  else
-    return ios
   end
+  
+  if not ctx:connect_socket(sock:_tofd(),hostname) then
+    syslog('error',"connect_socket() = %s",ctx:error())
+    abort(ios)
+    return false,ctx:error()
+  end
+  
+  return ios
 end
 
 -- **********************************************************************
--- Usage:       ios = tcp.connect(host,port[,to[,conf]])
+-- Usage:       ios = tcp.connect(host,port[,to[,conf[,resume]]])
 -- Desc:        Connect to a remote host
 -- Input:       host (string) IP address
 --              port (string number) port to connect to
 --              to (number/optioal) timeout the operation after to seconds
 --              conf (function) configuration options
+--              resume (boolean/optional) see connecta()
 -- Return:      ios (table) Input/Output object (nil on error)
 -- **********************************************************************
 
-function connect(host,port,to,conf)
+function connect(host,port,to,conf,resume)
   local addr = net.address2(host,'any','tcp',port)
   if addr then
     for _,a in ipairs(addr) do
-      local conn = connecta(a,host,to,conf)
+      local conn = connecta(a,host,to,conf,resume)
       if conn then
         return conn
       end
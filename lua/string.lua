@@ -20,7 +20,7 @@
 -- ********************************************************************
 -- luacheck: globals wrapt metaphone compare comparen mksplit split
 -- luacheck: globals template filetemplate wrap safeascii safeutf8
--- luacheck: globals comparei
+-- luacheck: globals comparei isutf8
 -- luacheck: ignore 611
 
 local strcore  = require "org.conman.strcore"
@@ -46,6 +46,7 @@ comparei  = strcore.comparei
 wrapt     = strcore.wrapt
 safeascii = strcore.safeascii
 safeutf8  = strcore.safeutf8
+isutf8    = strcore.isutf8
 
 -- ********************************************************************
 
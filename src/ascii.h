@@ -0,0 +1,73 @@
+/***************************************************************************
+*
+* Copyright 2026 by Sean Conner.
+*
+* This library is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This library is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+* License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library; if not, see <http://www.gnu.org/licenses/>.
+*
+* Comments, questions and criticisms can be sent to: sean@conman.org
+*
+* ==================================================================
+*
+* Scanning for runs of plain ASCII, shared by org.conman.iconv and
+* org.conman.strcore.  Runs are found 16 bytes at a time with SSE2 (always
+* there on x86-64), otherwise 8 bytes at a time.  ASCII_SSE2 is defined
+* when SSE2 is used, for modules with scans of their own.
+*
+*********************************************************************/
+
+#ifndef I_ascii_h
+#define I_ascii_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#  include <emmintrin.h>
+#  define ASCII_SSE2
+#endif
+
+/**************************************************************************
+*
+* Return the length of the run of ASCII at the start of p.
+*
+***************************************************************************/
+
+static inline size_t ascii_span(unsigned char const *p,size_t n)
+{
+  size_t i = 0;
+  
+#ifdef ASCII_SSE2
+  for ( ; i + 16 <= n ; i += 16)
+  {
+    int mask = _mm_movemask_epi8(_mm_loadu_si128((__m128i const *)(p + i)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#else
+  for ( ; i + 8 <= n ; i += 8)
+  {
+    uint64_t word;
+    memcpy(&word,p + i,sizeof(word));
+    if ((word & 0x8080808080808080uLL) != 0)
+      break;
+  }
+#endif
+
+  while((i < n) && (p[i] < 0x80))
+    i++;
+  return i;
+}
+
+#endif
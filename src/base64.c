@@ -31,6 +31,10 @@
 *       x = base64:encode("blahblahblah")     -- == "YmxhaGJsYWhibGFo"
 *       y = base64:decode("YmxhaGJsYWhibGFo") -- == "blahblahblah"
 *
+*       enc = base64:encoder() -- for data that comes in pieces
+*       for block in file:lines(8192) do ios:write(enc:update(block)) end
+*       ios:write(enc:finish())
+*
 * The default encoder/decoder (if base64() is called with no parameters) is
 * what people normally expect of base64.  The parameters are there to handle
 * the other dozen variants of base64 that are defined.  The parameters given
@@ -78,215 +82,676 @@
 #  error You need to compile against Lua 5.1 or higher
 #endif
 
+/*------------------------------------------------------------------------
+; On x86, blocks of 16 characters can be done with SSSE3 if the CPU has it
+; (checked at runtime), as long as the alphabet is the usual one (except
+; for the last two characters).  Everything else, and whatever is left
+; over, goes through the table driven code.
+;-------------------------------------------------------------------------*/
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#  include <tmmintrin.h>
+#  define B64_SSSE3
+#endif
+
 #define TYPE_BASE64     "org.conman.base64:base64"
+#define TYPE_ENCODER    "org.conman.base64:encoder"
+#define TYPE_DECODER    "org.conman.base64:decoder"
+#define B64_INVALID     0xFF
 
 typedef struct
 {
-  size_t len;
-  char   pad;
-  bool   ignore;
-  bool   strict;
-  char   transtable[64];
+  size_t  len;
+  char    pad;
+  bool    ignore;
+  bool    strict;
+  bool    simdenc;
+  bool    simddec;
+  char    transtable[64];
+  uint8_t decode[256];
 } base64__s;
 
+static char const mbase[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                            "abcdefghijklmnopqrstuvwxyz"
+                            "0123456789+/";
+                            
+#ifdef B64_SSSE3
+  static bool m_ssse3;
+#endif
+
+/**********************************************************************/
+
+#ifdef B64_SSSE3
+  __attribute__((target("ssse3")))
+  static void b64_encode12(base64__s const *b64,char *out,uint8_t const *data)
+  {
+    __m128i in   = _mm_loadu_si128((__m128i const *)data);
+    __m128i t0;
+    __m128i t1;
+    __m128i idx;
+    __m128i res;
+    __m128i less;
+    __m128i lut;
+    
+    /*------------------------------------------------------------------
+    ; Spread each three bytes over four, then pull out the 6-bit values
+    ; with two multiplies (see Wojciech Mula's work on base64).
+    ;-------------------------------------------------------------------*/
+    
+    in   = _mm_shuffle_epi8(in,_mm_setr_epi8(1,0,2,1,4,3,5,4,7,6,8,7,10,9,11,10));
+    t0   = _mm_mulhi_epu16(_mm_and_si128(in,_mm_set1_epi32(0x0FC0FC00)),_mm_set1_epi32(0x04000040));
+    t1   = _mm_mullo_epi16(_mm_and_si128(in,_mm_set1_epi32(0x003F03F0)),_mm_set1_epi32(0x01000010));
+    idx  = _mm_or_si128(t0,t1);
+    
+    /*------------------------------------------------------------------
+    ; Map each value to the range it's in, and add that range's offset.
+    ;-------------------------------------------------------------------*/
+    
+    res  = _mm_subs_epu8(idx,_mm_set1_epi8(51));
+    less = _mm_cmpgt_epi8(_mm_set1_epi8(26),idx);
+    res  = _mm_or_si128(res,_mm_and_si128(less,_mm_set1_epi8(13)));
+    lut  = _mm_setr_epi8(
+                'a' - 26 , '0' - 52 , '0' - 52 , '0' - 52 ,
+                '0' - 52 , '0' - 52 , '0' - 52 , '0' - 52 ,
+                '0' - 52 , '0' - 52 , '0' - 52 ,
+                (char)(b64->transtable[62] - 62) ,
+                (char)(b64->transtable[63] - 63) ,
+                'A' , 0 , 0
+           );
+    res  = _mm_add_epi8(_mm_shuffle_epi8(lut,res),idx);
+    _mm_storeu_si128((__m128i *)out,res);
+  }
+  
+  /*********************************************************************/
+  
+  __attribute__((target("ssse3")))
+  static bool b64_decode16(base64__s const *b64,uint8_t *out,char const *data)
+  {
+    __m128i in    = _mm_loadu_si128((__m128i const *)data);
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in,_mm_set1_epi8('A' - 1)),_mm_cmplt_epi8(in,_mm_set1_epi8('Z' + 1)));
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in,_mm_set1_epi8('a' - 1)),_mm_cmplt_epi8(in,_mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in,_mm_set1_epi8('0' - 1)),_mm_cmplt_epi8(in,_mm_set1_epi8('9' + 1)));
+    __m128i e62   = _mm_cmpeq_epi8(in,_mm_set1_epi8(b64->transtable[62]));
+    __m128i e63   = _mm_cmpeq_epi8(in,_mm_set1_epi8(b64->transtable[63]));
+    __m128i valid = _mm_or_si128(_mm_or_si128(upper,lower),_mm_or_si128(digit,_mm_or_si128(e62,e63)));
+    __m128i shift;
+    __m128i v;
+    
+    if (_mm_movemask_epi8(valid) != 0xFFFF)
+      return false;
+      
+    shift = _mm_or_si128(
+              _mm_or_si128(
+                _mm_and_si128(upper,_mm_set1_epi8(-'A')),
+                _mm_and_si128(lower,_mm_set1_epi8(26 - 'a'))
+              ),
+              _mm_or_si128(
+                _mm_and_si128(digit,_mm_set1_epi8(52 - '0')),
+                _mm_or_si128(
+                  _mm_and_si128(e62,_mm_set1_epi8((char)(62 - b64->transtable[62]))),
+                  _mm_and_si128(e63,_mm_set1_epi8((char)(63 - b64->transtable[63])))
+                )
+              )
+            );
+    v     = _mm_add_epi8(in,shift);
+    
+    /*------------------------------------------------------------------
+    ; Pack four 6-bit values into three bytes, twice over, then put the
+    ; bytes in order.
+    ;-------------------------------------------------------------------*/
+    
+    v = _mm_maddubs_epi16(v,_mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v,_mm_set1_epi32(0x00011000));
+    v = _mm_shuffle_epi8(v,_mm_setr_epi8(2,1,0,6,5,4,10,9,8,14,13,12,-1,-1,-1,-1));
+    _mm_storeu_si128((__m128i *)out,v);
+    return true;
+  }
+#endif
+
+/**********************************************************************
+*
+* The encoding and decoding are done in runs that can be picked up again
+* with more data, so the same code serves both a whole string and a stream
+* of them.  For encoding, what carries over is up to two bytes not yet
+* making up a group, and how far along the current line is.  For decoding,
+* it's the characters of an incomplete group, and the number of pad
+* characters seen.
+*
+***********************************************************************/
+
+typedef struct
+{
+  uint8_t part[2];
+  size_t  npart;
+  size_t  count;        /* groups on the current line */
+} b64enc__s;
+
+typedef struct
+{
+  uint8_t quad[4];
+  size_t  nquad;
+  size_t  skip;
+  bool    done;         /* seen a NUL, which ends the data */
+} b64dec__s;
+
+typedef struct
+{
+  base64__s b64;
+  b64enc__s state;
+} b64encoder__s;
+
+typedef struct
+{
+  base64__s b64;
+  b64dec__s state;
+} b64decoder__s;
+
+/**********************************************************************/
+
+static size_t b64_perline(base64__s const *b64)
+{
+  /*----------------------------------------------------------------------
+  ; A newline follows every complete group that takes the line to len
+  ; characters or more, which works out to a newline every perline groups.
+  ;-----------------------------------------------------------------------*/
+  
+  if (b64->len == SIZE_MAX)
+    return SIZE_MAX;
+  else if (b64->len < 4)
+    return 1;
+  else
+    return (b64->len + 3) / 4;
+}
+
+/**********************************************************************/
+
+static char *b64_encode_groups(
+        base64__s const *b64,
+        size_t           perline,
+        b64enc__s       *state,
+        char            *out,
+        uint8_t const   *data,
+        size_t           size
+)
+{
+  uint8_t A,B,C,D;
+  
+  while(size >= 3)
+  {
+#ifdef B64_SSSE3
+    if (b64->simdenc && (size >= 16) && (perline - state->count >= 4))
+    {
+      b64_encode12(b64,out,data);
+      out          += 16;
+      data         += 12;
+      size         -= 12;
+      state->count += 4;
+    }
+    else
+#endif
+    {
+      A =  (data[0] >> 2) ;
+      B = ((data[0] << 4) & 0x30) | ((data[1] >> 4) );
+      C = ((data[1] << 2) & 0x3C) | ((data[2] >> 6) );
+      D =   data[2]       & 0x3F;
+      
+      *out++ = b64->transtable[A];
+      *out++ = b64->transtable[B];
+      *out++ = b64->transtable[C];
+      *out++ = b64->transtable[D];
+      data  += 3;
+      size  -= 3;
+      state->count++;
+    }
+    
+    if (state->count >= perline)
+    {
+      *out++       = '\n';
+      state->count = 0;
+    }
+  }
+  
+  return out;
+}
+
+/**********************************************************************/
+
+static char *b64_encode_tail(
+        base64__s const *b64,
+        char            *out,
+        uint8_t const   *data,
+        size_t           size
+)
+{
+  uint8_t A,B,C;
+  
+  if (size == 1)
+  {
+    A = (data[0] >> 2);
+    B = (data[0] << 4) & 0x30;
+    
+    *out++ = b64->transtable[A];
+    *out++ = b64->transtable[B];
+    if (b64->pad)
+    {
+      *out++ = b64->pad;
+      *out++ = b64->pad;
+    }
+  }
+  else if (size == 2)
+  {
+    A =  (data[0] >> 2);
+    B = ((data[0] << 4) & 0x30) | ((data[1] >> 4) );
+    C =  (data[1] << 2) & 0x3C;
+    
+    *out++ = b64->transtable[A];
+    *out++ = b64->transtable[B];
+    *out++ = b64->transtable[C];
+    if (b64->pad)
+      *out++ = b64->pad;
+  }
+  
+  return out;
+}
+
+/**********************************************************************
+* Usage:        b64_encode(L,b64,state,data,size,final)
+* Desc:         Encode data, pushing the result.  Unless final, up to two
+*               bytes are held back in state for the next call.
+***********************************************************************/
+
+static void b64_encode(
+        lua_State       *L,
+        base64__s const *b64,
+        b64enc__s       *state,
+        uint8_t const   *data,
+        size_t           size,
+        bool             final
+)
+{
+  size_t  perline = b64_perline(b64);
+  size_t  groups  = (state->npart + size) / 3;
+  size_t  left    = (state->npart + size) % 3;
+  size_t  outsize = groups * 4;
+  char   *buf;
+  char   *out;
+  
+  if (perline < SIZE_MAX)
+    outsize += (state->count + groups) / perline;
+  if (final && left)
+    outsize += b64->pad ? 4 : left + 1;
+    
+  buf = lua_newuserdata(L,outsize + 16); /* the SIMD code writes 16 */
+  out = buf;
+  
+  if ((state->npart > 0) && (state->npart + size >= 3))
+  {
+    uint8_t group[3];
+    size_t  need = 3 - state->npart;
+    
+    memcpy(group,state->part,state->npart);
+    memcpy(group + state->npart,data,need);
+    out           = b64_encode_groups(b64,perline,state,out,group,3);
+    data         += need;
+    size         -= need;
+    state->npart  = 0;
+  }
+  
+  out   = b64_encode_groups(b64,perline,state,out,data,size - size % 3);
+  data += size - size % 3;
+  size %= 3;
+  
+  memcpy(state->part + state->npart,data,size);
+  state->npart += size;
+  
+  if (final)
+  {
+    out          = b64_encode_tail(b64,out,state->part,state->npart);
+    state->npart = 0;
+    state->count = 0;
+  }
+  
+  assert((size_t)(out - buf) == outsize);
+  lua_pushlstring(L,buf,outsize);
+  lua_remove(L,-2);
+}
+
 /**********************************************************************/
 
 static int b64meta_encode(lua_State *L)
 {
-  base64__s const *b64;
-  uint8_t   const *data;
+  base64__s const *b64   = luaL_checkudata(L,1,TYPE_BASE64);
+  b64enc__s        state = { { 0 , 0 } , 0 , 0 };
   size_t           size;
-  size_t           len;
-  luaL_Buffer      b;
-  uint8_t          A,B,C,D;
+  uint8_t   const *data  = (uint8_t const *)luaL_checklstring(L,2,&size);
   
-  b64  = luaL_checkudata(L,1,TYPE_BASE64);
-  data = (uint8_t const *)luaL_checklstring(L,2,&size);
-  len  = 0;
-  luaL_buffinit(L,&b);
+  b64_encode(L,b64,&state,data,size,true);
+  return 1;
+}
+
+/**********************************************************************/
+
+enum
+{
+  B64_OKAY,
+  B64_BADCHAR,
+  B64_BADPAD,
+  B64_NOTSTRICT,
+};
+
+/**********************************************************************/
+
+static int b64_decode_quad(
+        base64__s const  *b64,
+        b64dec__s        *state,
+        uint8_t         **pout
+)
+{
+  uint8_t *out = *pout;
+  uint8_t  ac  = (state->quad[0] << 2) | (state->quad[1] >> 4);
+  uint8_t  bc  = (state->quad[1] << 4) | (state->quad[2] >> 2);
+  uint8_t  cc  = (state->quad[2] << 6) | (state->quad[3]     );
   
-  while(true)
+  state->nquad = 0;
+  if (state->skip > 2)
+    return B64_BADPAD;
+    
+  *out++ = ac;
+  
+  if (b64->strict)
   {
-    switch(size)
+    if (
+           ((state->skip == 2) && ((bc != 0) || (cc != 0)))
+        || ((state->skip == 1) &&  (cc != 0))
+       )
     {
-      case 0:
-           luaL_pushresult(&b);
-           return 1;
-           
-      case 1:
-           A = (data[0] >> 2);
-           B = (data[0] << 4) & 0x30;
-           assert(A < 64);
-           assert(B < 64);
-           
-           luaL_addchar(&b,b64->transtable[A]);
-           luaL_addchar(&b,b64->transtable[B]);
-           if (b64->pad)
-           {
-             luaL_addchar(&b,b64->pad);
-             luaL_addchar(&b,b64->pad);
-           }
-           luaL_pushresult(&b);
-           return 1;
-           
-      case 2:
-           A =  (data[0] >> 2);
-           B = ((data[0] << 4) & 0x30) | ((data[1] >> 4) );
-           C =  (data[1] << 2) & 0x3C;
-           
-           assert(A < 64);
-           assert(B < 64);
-           assert(C < 64);
-           
-           luaL_addchar(&b,b64->transtable[A]);
-           luaL_addchar(&b,b64->transtable[B]);
-           luaL_addchar(&b,b64->transtable[C]);
-           if (b64->pad)
-             luaL_addchar(&b,b64->pad);
-           luaL_pushresult(&b);
-           return 1;
-           
-      default:
-           A =  (data[0] >> 2) ;
-           B = ((data[0] << 4) & 0x30) | ((data[1] >> 4) );
-           C = ((data[1] << 2) & 0x3C) | ((data[2] >> 6) );
-           D =   data[2]       & 0x3F;
-           
-           assert(A < 64);
-           assert(B < 64);
-           assert(C < 64);
-           assert(D < 64);
-           
-           luaL_addchar(&b,b64->transtable[A]);
-           luaL_addchar(&b,b64->transtable[B]);
-           luaL_addchar(&b,b64->transtable[C]);
-           luaL_addchar(&b,b64->transtable[D]);
-           len  += 4;
-           size -= 3;
-           data += 3;
-           
-           if (len >= b64->len)
-           {
-             luaL_addchar(&b,'\n');
-             len = 0;
-           }
-           break;
+      return B64_NOTSTRICT;
     }
   }
+  
+  if (state->skip < 2) *out++ = bc;
+  if (state->skip < 1) *out++ = cc;
+  *pout = out;
+  return B64_OKAY;
 }
 
 /**********************************************************************/
 
-static bool Ib64_readout(
+static int b64_decode_run(
         base64__s const  *b64,
-        uint8_t          *pr,
-        size_t           *skip,
-        const char      **pdata
+        b64dec__s        *state,
+        uint8_t         **pout,
+        char const      **pdata,
+        size_t            size
 )
 {
   char const *data = *pdata;
-  char       *p;
+  char const *end  = data + size;
+  int         rc   = B64_OKAY;
   
-  while(true)
+  while((data < end) && !state->done)
   {
-    if (*data == '\0')
+#ifdef B64_SSSE3
+    if (
+            b64->simddec
+         && (state->nquad == 0)
+         && (state->skip  == 0)
+         && (end - data   >= 16)
+         && b64_decode16(b64,*pout,data)
+       )
     {
-      (*skip)++;
-      *pr = 0;
-      return true;
+      *pout += 12;
+      data  += 16;
+      continue;
     }
+#endif
+
+    uint8_t c = *data;
     
-    if (*data == b64->pad)
+    if (c == '\0')
     {
-      (*skip)++;
-      *pdata = data + 1;
-      *pr    = '\0';
-      return true;
+      state->done = true;
+      break;
     }
-    
-    p = strchr(b64->transtable,*data);
-    if (p)
+    else if (c == (uint8_t)b64->pad)
     {
-      *pr    = (p - b64->transtable);
-      *pdata = data + 1;
-      return true;
+      state->quad[state->nquad++] = 0;
+      state->skip++;
     }
-    
-    if ((b64->len < SIZE_MAX) && ((*data == '\r') || (*data == '\n')))
+    else if (b64->decode[c] != B64_INVALID)
+      state->quad[state->nquad++] = b64->decode[c];
+    else if ((b64->len < SIZE_MAX) && ((c == '\r') || (c == '\n')))
+      ;
+    else if (!b64->ignore)
     {
-      data++;
-      continue;
+      rc = B64_BADCHAR;
+      break;
     }
     
-    if (!b64->ignore)
-      return false;
     data++;
+    
+    if (state->nquad == 4)
+    {
+      rc = b64_decode_quad(b64,state,pout);
+      if (rc != B64_OKAY)
+        break;
+    }
   }
+  
+  *pdata = data;
+  return rc;
 }
 
 /**********************************************************************/
 
-static bool Ib64_readout4(
+static int b64_decode_finish(
+        base64__s const  *b64,
+        b64dec__s        *state,
+        uint8_t         **pout
+)
+{
+  if (state->nquad == 0)
+    return B64_OKAY;
+    
+  while(state->nquad < 4)
+  {
+    state->quad[state->nquad++] = 0;
+    state->skip++;
+  }
+  
+  return b64_decode_quad(b64,state,pout);
+}
+
+/**********************************************************************
+* Usage:        rc = b64_decode(L,b64,state,data,size,final)
+* Desc:         Decode data, pushing the result (if any)
+* Return:       rc (integer) number of results pushed
+***********************************************************************/
+
+static int b64_decode(
+        lua_State       *L,
         base64__s const *b64,
-        uint8_t          *pr,
-        size_t           *skip,
-        char const     **pdata
+        b64dec__s       *state,
+        char const      *data,
+        size_t           size,
+        bool             final
 )
 {
-  size_t i;
+  uint8_t *dest;
+  uint8_t *out;
+  int      rc;
   
-  for (i = 0 ; i < 4 ; i++)
-    if (!Ib64_readout(b64,&pr[i],skip,pdata))
-      return false;
-  return true;
+  /*----------------------------------------------------------------------
+  ; Every four characters (including those carried over) make at most
+  ; three bytes, plus what's left over when padded out.
+  ;-----------------------------------------------------------------------*/
+  
+  dest = lua_newuserdata(L,(size + state->nquad) / 4 * 3 + 3 + 16);
+  out  = dest;
+  rc   = b64_decode_run(b64,state,&out,&data,size);
+  
+  if ((rc == B64_OKAY) && final)
+  {
+    rc = b64_decode_finish(b64,state,&out);
+    state->nquad = 0;
+    state->skip  = 0;
+    state->done  = false;
+  }
+  
+  switch(rc)
+  {
+    case B64_OKAY:
+         lua_pushlstring(L,(char *)dest,out - dest);
+         return 1;
+         
+    case B64_BADCHAR:
+         return luaL_error(L,"invalid character '%c'",*data);
+         
+    case B64_BADPAD:
+         return luaL_error(L,"invalid padding");
+         
+    case B64_NOTSTRICT:
+         return 0;
+         
+    default:
+         assert(0);
+         return 0;
+  }
 }
 
 /**********************************************************************/
 
 static int b64meta_decode(lua_State *L)
 {
-  base64__s const *b64;
-  char const      *data;
-  uint8_t          buf[4];
-  luaL_Buffer      b;
-  size_t           skip;
+  base64__s const *b64   = luaL_checkudata(L,1,TYPE_BASE64);
+  b64dec__s        state = { { 0 , 0 , 0 , 0 } , 0 , 0 , false };
+  size_t           size;
+  char const      *data  = luaL_checklstring(L,2,&size);
   
-  b64  = luaL_checkudata(L,1,TYPE_BASE64);
-  data = luaL_checkstring(L,2);
-  skip = 0;
+  return b64_decode(L,b64,&state,data,size,true);
+}
+
+/**********************************************************************
+* Usage:        encoder = b64:encoder()
+* Desc:         Return an object to encode data a piece at a time, with
+*               the same settings as b64
+* Return:       encoder (userdata) encoder
+*
+* Usage:        decoder = b64:decoder()
+* Desc:         Return an object to decode data a piece at a time
+* Return:       decoder (userdata) decoder
+*
+* NOTE:         The encoded (or decoded) pieces, concatenated, are the same
+*               as encoding (or decoding) all the data at once.
+***********************************************************************/
+
+static int b64meta_encoder(lua_State *L)
+{
+  base64__s const *b64 = luaL_checkudata(L,1,TYPE_BASE64);
+  b64encoder__s   *enc = lua_newuserdata(L,sizeof(b64encoder__s));
   
-  luaL_buffinit(L,&b);
+  enc->b64         = *b64;
+  enc->state.npart = 0;
+  enc->state.count = 0;
+  luaL_getmetatable(L,TYPE_ENCODER);
+  lua_setmetatable(L,-2);
+  return 1;
+}
+
+/**********************************************************************/
+
+static int b64meta_decoder(lua_State *L)
+{
+  base64__s const *b64 = luaL_checkudata(L,1,TYPE_BASE64);
+  b64decoder__s   *dec = lua_newuserdata(L,sizeof(b64decoder__s));
   
-  while(*data)
-  {
-    if (!Ib64_readout4(b64,buf,&skip,&data))
-      return luaL_error(L,"invalid character '%c'",*data);
-      
-    assert(skip <= 2);
-    
-    uint8_t ac = (buf[0] << 2) | (buf[1] >> 4);
-    uint8_t bc = (buf[1] << 4) | (buf[2] >> 2);
-    uint8_t cc = (buf[2] << 6) | (buf[3]     );
-    
-    luaL_addchar(&b,ac);
-    
-    if (b64->strict)
-    {
-      if (
-             ((skip == 2) && ((bc != 0) || (cc != 0)))
-          || ((skip == 1) &&  (cc != 0))
-         )
-      {
-        luaL_pushresult(&b);
-        return 0;
-      }
-    }
-    
-    if (skip < 2) luaL_addchar(&b,bc);
-    if (skip < 1) luaL_addchar(&b,cc);
-  }
+  dec->b64         = *b64;
+  dec->state.nquad = 0;
+  dec->state.skip  = 0;
+  dec->state.done  = false;
+  luaL_getmetatable(L,TYPE_DECODER);
+  lua_setmetatable(L,-2);
+  return 1;
+}
+
+/**********************************************************************
+* Usage:        text = encoder:update(data)
+* Desc:         Encode data, holding back up to two bytes for the next
+*               call (or finish())
+* Input:        data (binary) data
+* Return:       text (string) encoded data
+*
+* Usage:        text = encoder:finish()
+* Desc:         Encode what's left, with padding.  The encoder can then
+*               be used again.
+* Return:       text (string) encoded data
+***********************************************************************/
+
+static int b64enc_update(lua_State *L)
+{
+  b64encoder__s *enc = luaL_checkudata(L,1,TYPE_ENCODER);
+  size_t         size;
+  uint8_t const *data = (uint8_t const *)luaL_checklstring(L,2,&size);
   
-  luaL_pushresult(&b);
+  b64_encode(L,&enc->b64,&enc->state,data,size,false);
+  return 1;
+}
+
+/**********************************************************************/
+
+static int b64enc_finish(lua_State *L)
+{
+  b64encoder__s *enc = luaL_checkudata(L,1,TYPE_ENCODER);
+  
+  b64_encode(L,&enc->b64,&enc->state,(uint8_t const *)"",0,true);
+  return 1;
+}
+
+/**********************************************************************
+* Usage:        data = decoder:update(text)
+* Desc:         Decode text, holding back an incomplete group for the
+*               next call (or finish())
+* Input:        text (string) encoded data
+* Return:       data (binary) decoded data, nothing if strict checking
+*                       | fails
+*
+* Usage:        data = decoder:finish()
+* Desc:         Decode an incomplete group left over.  The decoder can
+*               then be used again.
+* Return:       data (binary) decoded data
+***********************************************************************/
+
+static int b64dec_update(lua_State *L)
+{
+  b64decoder__s *dec = luaL_checkudata(L,1,TYPE_DECODER);
+  size_t         size;
+  char const    *data = luaL_checklstring(L,2,&size);
+  
+  return b64_decode(L,&dec->b64,&dec->state,data,size,false);
+}
+
+/**********************************************************************/
+
+static int b64dec_finish(lua_State *L)
+{
+  b64decoder__s *dec = luaL_checkudata(L,1,TYPE_DECODER);
+  
+  return b64_decode(L,&dec->b64,&dec->state,"",0,true);
+}
+
+/**********************************************************************/
+
+static int b64enc___tostring(lua_State *L)
+{
+  lua_pushfstring(L,"base64:encoder (%p)",lua_touserdata(L,1));
+  return 1;
+}
+
+/**********************************************************************/
+
+static int b64dec___tostring(lua_State *L)
+{
+  lua_pushfstring(L,"base64:decoder (%p)",lua_touserdata(L,1));
   return 1;
 }
 
@@ -302,9 +767,6 @@ static int b64meta___tostring(lua_State *L)
 
 static int b64lua(lua_State *L)
 {
-  static char const mbase[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                              "abcdefghijklmnopqrstuvwxyz"
-                              "0123456789+/";
   base64__s *b64;
   
   lua_settop(L,1);
@@ -360,6 +822,31 @@ static int b64lua(lua_State *L)
     lua_pop(L,6);
   }
   
+  /*----------------------------------------------------------------------
+  ; If a character appears twice, the first one wins, as it always has.
+  ;-----------------------------------------------------------------------*/
+  
+  memset(b64->decode,B64_INVALID,sizeof(b64->decode));
+  for (size_t i = 64 ; i-- > 0 ; )
+    b64->decode[(uint8_t)b64->transtable[i]] = i;
+  b64->decode[0] = B64_INVALID;
+  
+  b64->simdenc = false;
+  b64->simddec = false;
+  
+#ifdef B64_SSSE3
+  if (m_ssse3 && (memcmp(b64->transtable,mbase,62) == 0))
+  {
+    char c62 = b64->transtable[62];
+    char c63 = b64->transtable[63];
+    
+    b64->simdenc = true;
+    b64->simddec = (b64->decode[(uint8_t)c62]      == 62)
+                && (b64->decode[(uint8_t)c63]      == 63)
+                && (b64->decode[(uint8_t)b64->pad] == B64_INVALID);
+  }
+#endif
+
   luaL_getmetatable(L,TYPE_BASE64);
   lua_setmetatable(L,-2);
   return 1;
@@ -373,10 +860,47 @@ int luaopen_org_conman_base64(lua_State *L)
   {
     { "encode"     , b64meta_encode     } ,
     { "decode"     , b64meta_decode     } ,
+    { "encoder"    , b64meta_encoder    } ,
+    { "decoder"    , b64meta_decoder    } ,
     { "__tostring" , b64meta___tostring } ,
     { NULL         , NULL               }
   };
   
+  static struct luaL_Reg const menc_meta[] =
+  {
+    { "update"     , b64enc_update     } ,
+    { "finish"     , b64enc_finish     } ,
+    { "__tostring" , b64enc___tostring } ,
+    { NULL         , NULL              }
+  };
+  
+  static struct luaL_Reg const mdec_meta[] =
+  {
+    { "update"     , b64dec_update     } ,
+    { "finish"     , b64dec_finish     } ,
+    { "__tostring" , b64dec___tostring } ,
+    { NULL         , NULL              }
+  };
+  
+  luaL_newmetatable(L,TYPE_ENCODER);
+#if LUA_VERSION_NUM == 501
+  luaL_register(L,NULL,menc_meta);
+#else
+  luaL_setfuncs(L,menc_meta,0);
+#endif
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  
+  luaL_newmetatable(L,TYPE_DECODER);
+#if LUA_VERSION_NUM == 501
+  luaL_register(L,NULL,mdec_meta);
+#else
+  luaL_setfuncs(L,mdec_meta,0);
+#endif
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  lua_pop(L,2);
+  
   luaL_newmetatable(L,TYPE_BASE64);
 #if LUA_VERSION_NUM == 501
   luaL_register(L,NULL,mb64_meta);
@@ -386,6 +910,11 @@ int luaopen_org_conman_base64(lua_State *L)
   lua_pushvalue(L,-1);
   lua_setfield(L,-2,"__index");
   
+#ifdef B64_SSSE3
+  __builtin_cpu_init();
+  m_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+
   lua_pushcfunction(L,b64lua);
   return 1;
 }
@@ -19,9 +19,14 @@
 *
 *************************************************************************/
 
+#include <stddef.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
+#include <pthread.h>
+
 #include <lua.h>
 #include <lauxlib.h>
 
@@ -29,94 +34,579 @@
 #  error You need to compile against Lua 5.1 or higher
 #endif
 
-/******************************************************************/
+/*-------------------------------------------------------------------------
+; CRC32C has an instruction of its own on x86 (SSE4.2) and ARMv8.  The x86
+; version is picked at runtime; the ARM one only if the compiler was told
+; the CPU has it.
+;--------------------------------------------------------------------------*/
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#  include <nmmintrin.h>
+#  define CRC32C_HW_RUNTIME
+#elif defined(__ARM_FEATURE_CRC32) && defined(__aarch64__)
+#  include <arm_acle.h>
+#  define CRC32C_HW_ALWAYS
+#endif
+
+#define TYPE_CRC        "org.conman.crc:crc"
 
-static int crc32(lua_State *L)
+/**************************************************************************
+*
+* All three CRCs are the reflected kind (least significant bit first), with
+* the register starting as all ones and inverted at the end, so they share
+* the code to build tables, update and combine.  Each is updated eight bytes
+* at a time with eight tables (slicing-by-8), which breaks the dependency of
+* each byte on the previous one.
+*
+***************************************************************************/
+
+struct crcalg
 {
-  static uint32_t const m_crc32_table[] =
+  char const *name;
+  int         width;
+  uint64_t    poly;
+  uint64_t    mask;
+  uint64_t  (*update)(struct crcalg const *,uint64_t,uint8_t const *,size_t);
+  uint64_t    x2n[64];  /* x^(2^n) mod poly, for crc_combine() */
+  uint64_t    table[8][256];
+};
+
+/*************************************************************************/
+
+static uint32_t crc_load32(uint8_t const *p)
+{
+  return (uint32_t)p[0]
+       | (uint32_t)p[1] <<  8
+       | (uint32_t)p[2] << 16
+       | (uint32_t)p[3] << 24
+       ;
+}
+
+/*************************************************************************/
+
+static uint64_t crc_update32(
+        struct crcalg const *alg,
+        uint64_t             c,
+        uint8_t const       *p,
+        size_t               size
+)
+{
+  uint64_t const (*t)[256] = alg->table;
+  uint32_t         crc     = (uint32_t)c;
+  
+  while((size > 0) && (((uintptr_t)p & 7) != 0))
   {
-    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA,
-    0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
-    0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
-    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
-    0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE,
-    0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
-    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC,
-    0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
-    0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
-    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
-    0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940,
-    0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
-    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116,
-    0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
-    0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
-    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
-    0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A,
-    0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818,
-    0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
-    0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
-    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
-    0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C,
-    0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
-    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2,
-    0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
-    0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
-    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
-    0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086,
-    0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
-    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4,
-    0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
-    0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
-    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
-    0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8,
-    0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
-    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE,
-    0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
-    0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
-    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
-    0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252,
-    0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
-    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60,
-    0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
-    0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
-    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
-    0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04,
-    0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
-    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A,
-    0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
-    0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
-    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
-    0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E,
-    0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
-    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C,
-    0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
-    0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
-    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
-    0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0,
-    0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
-    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6,
-    0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
-    0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
-    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
-  };
+    crc = (crc >> 8) ^ (uint32_t)t[0][(crc ^ *p++) & 0xFF];
+    size--;
+  }
   
-  size_t         size;
-  uint8_t const *p   = (uint8_t const *)luaL_checklstring(L,1,&size);
-  uint32_t       crc = ~luaL_optinteger(L,2,0);
+  while(size >= 8)
+  {
+    crc ^= crc_load32(p);
+    crc  = (uint32_t)(t[7][ crc        & 0xFF]
+                    ^ t[6][(crc >>  8) & 0xFF]
+                    ^ t[5][(crc >> 16) & 0xFF]
+                    ^ t[4][ crc >> 24        ]
+                    ^ t[3][p[4]]
+                    ^ t[2][p[5]]
+                    ^ t[1][p[6]]
+                    ^ t[0][p[7]]);
+    p    += 8;
+    size -= 8;
+  }
+  
+  while(size--)
+    crc = (crc >> 8) ^ (uint32_t)t[0][(crc ^ *p++) & 0xFF];
+    
+  return crc;
+}
+
+/*************************************************************************/
+
+static uint64_t crc_update64(
+        struct crcalg const *alg,
+        uint64_t             crc,
+        uint8_t const       *p,
+        size_t               size
+)
+{
+  uint64_t const (*t)[256] = alg->table;
+  
+  while((size > 0) && (((uintptr_t)p & 7) != 0))
+  {
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    size--;
+  }
+  
+  while(size >= 8)
+  {
+    crc ^= (uint64_t)crc_load32(p) | (uint64_t)crc_load32(p + 4) << 32;
+    crc  = t[7][ crc        & 0xFF]
+         ^ t[6][(crc >>  8) & 0xFF]
+         ^ t[5][(crc >> 16) & 0xFF]
+         ^ t[4][(crc >> 24) & 0xFF]
+         ^ t[3][(crc >> 32) & 0xFF]
+         ^ t[2][(crc >> 40) & 0xFF]
+         ^ t[1][(crc >> 48) & 0xFF]
+         ^ t[0][ crc >> 56        ];
+    p    += 8;
+    size -= 8;
+  }
   
   while(size--)
-    crc = (crc >> 8) ^ m_crc32_table[ (crc ^ *p++) & 0xFF ];
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
     
-  lua_pushinteger(L,~crc);
+  return crc;
+}
+
+/*************************************************************************/
+
+#if defined(CRC32C_HW_RUNTIME)
+  __attribute__((target("sse4.2")))
+  static uint64_t crc_update32c_hw(
+          struct crcalg const *alg,
+          uint64_t             crc,
+          uint8_t const       *p,
+          size_t               size
+  )
+  {
+    uint64_t x;
+    
+    (void)alg;
+    while((size > 0) && (((uintptr_t)p & 7) != 0))
+    {
+      crc = _mm_crc32_u8((uint32_t)crc,*p++);
+      size--;
+    }
+    
+    while(size >= 8)
+    {
+      memcpy(&x,p,sizeof(x));
+      crc   = _mm_crc32_u64(crc,x);
+      p    += 8;
+      size -= 8;
+    }
+    
+    while(size--)
+      crc = _mm_crc32_u8((uint32_t)crc,*p++);
+      
+    return crc;
+  }
+#elif defined(CRC32C_HW_ALWAYS)
+  static uint64_t crc_update32c_hw(
+          struct crcalg const *alg,
+          uint64_t             c,
+          uint8_t const       *p,
+          size_t               size
+  )
+  {
+    uint32_t crc = (uint32_t)c;
+    uint64_t x;
+    
+    (void)alg;
+    while((size > 0) && (((uintptr_t)p & 7) != 0))
+    {
+      crc = __crc32cb(crc,*p++);
+      size--;
+    }
+    
+    while(size >= 8)
+    {
+      memcpy(&x,p,sizeof(x));
+      crc   = __crc32cd(crc,x);
+      p    += 8;
+      size -= 8;
+    }
+    
+    while(size--)
+      crc = __crc32cb(crc,*p++);
+      
+    return crc;
+  }
+#endif
+
+/*************************************************************************/
+
+static struct crcalg m_crc32 =
+{
+  "crc32"  , 32 , 0xEDB88320uL            , 0xFFFFFFFFuL            , crc_update32 , { 0 } , { { 0 } }
+};
+
+static struct crcalg m_crc32c =
+{
+  "crc32c" , 32 , 0x82F63B78uL            , 0xFFFFFFFFuL            , crc_update32 , { 0 } , { { 0 } }
+};
+
+static struct crcalg m_crc64 =
+{
+  "crc64"  , 64 , 0xC96C5795D7870F42uLL   , 0xFFFFFFFFFFFFFFFFuLL   , crc_update64 , { 0 } , { { 0 } }
+};
+
+static pthread_once_t m_once     = PTHREAD_ONCE_INIT;
+static bool           m_hardware = false;
+
+/**************************************************************************
+* Usage:        p = crc_multmodp(alg,a,b)
+* Desc:         Multiply two polynomials modulo the CRC polynomial
+* Input:        alg (struct crcalg const *) CRC
+*               a (uint64_t) polynomial (reflected)
+*               b (uint64_t) polynomial (reflected)
+* Return:       p (uint64_t) a * b mod poly
+***************************************************************************/
+
+static uint64_t crc_multmodp(struct crcalg const *alg,uint64_t a,uint64_t b)
+{
+  uint64_t m = (uint64_t)1 << (alg->width - 1);
+  uint64_t p = 0;
+  
+  while(true)
+  {
+    if (a & m)
+    {
+      p ^= b;
+      if ((a & (m - 1)) == 0)
+        break;
+    }
+    m >>= 1;
+    b   = (b & 1) ? (b >> 1) ^ alg->poly : b >> 1;
+  }
+  
+  return p;
+}
+
+/**************************************************************************
+* Usage:        p = crc_x8nmodp(alg,len)
+* Desc:         Return x^(8*len) mod poly, which is what a CRC gets
+*               multiplied by when len bytes are appended to the data.
+***************************************************************************/
+
+static uint64_t crc_x8nmodp(struct crcalg const *alg,uint64_t len)
+{
+  uint64_t p = (uint64_t)1 << (alg->width - 1);
+  int      k = 3;
+  
+  while(len)
+  {
+    if (len & 1)
+      p = crc_multmodp(alg,alg->x2n[k & 63],p);
+    len >>= 1;
+    k++;
+  }
+  
+  return p;
+}
+
+/*************************************************************************/
+
+static uint64_t crc_combine(
+        struct crcalg const *alg,
+        uint64_t             crc1,
+        uint64_t             crc2,
+        uint64_t             len2
+)
+{
+  return crc_multmodp(alg,crc_x8nmodp(alg,len2),crc1) ^ crc2;
+}
+
+/*************************************************************************/
+
+static void crc_init(struct crcalg *alg)
+{
+  uint64_t p;
+  
+  for (size_t n = 0 ; n < 256 ; n++)
+  {
+    uint64_t c = n;
+    for (size_t k = 0 ; k < 8 ; k++)
+      c = (c & 1) ? (c >> 1) ^ alg->poly : c >> 1;
+    alg->table[0][n] = c;
+  }
+  
+  for (size_t n = 0 ; n < 256 ; n++)
+    for (size_t k = 1 ; k < 8 ; k++)
+      alg->table[k][n] = (alg->table[k-1][n] >> 8)
+                       ^ alg->table[0][alg->table[k-1][n] & 0xFF];
+                       
+  p = (uint64_t)1 << (alg->width - 2); /* x^1 */
+  alg->x2n[0] = p;
+  for (size_t n = 1 ; n < 64 ; n++)
+    alg->x2n[n] = p = crc_multmodp(alg,p,p);
+}
+
+/*************************************************************************/
+
+static struct crcalg const *crc_checkalg(lua_State *L,int idx)
+{
+  char const *name = luaL_optstring(L,idx,"crc32");
+  
+  if (strcmp(name,"crc32") == 0)
+    return &m_crc32;
+  else if (strcmp(name,"crc32c") == 0)
+    return &m_crc32c;
+#if LUA_VERSION_NUM >= 503
+  else if (strcmp(name,"crc64") == 0)
+    return &m_crc64;
+#endif
+
+  luaL_argerror(L,idx,lua_pushfstring(L,"unknown CRC '%s'",name));
+  return NULL;
+}
+
+/*************************************************************************/
+
+static int crc_sum(lua_State *L,struct crcalg const *alg)
+{
+  size_t         size;
+  uint8_t const *p   = (uint8_t const *)luaL_checklstring(L,1,&size);
+  uint64_t       crc = (uint64_t)luaL_optinteger(L,2,0) & alg->mask;
+  
+  crc = alg->update(alg,~crc & alg->mask,p,size);
+  lua_pushinteger(L,(lua_Integer)(~crc & alg->mask));
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        crc = crc.crc32(data[,crc])
+* Desc:         Return the CRC-32 (as used by zlib, PNG, Ethernet) of data
+* Input:        data (string) data
+*               crc (integer/optional) CRC of the data before this
+* Return:       crc (integer) CRC
+***************************************************************************/
+
+static int crclua_crc32(lua_State *L)
+{
+  return crc_sum(L,&m_crc32);
+}
+
+/**************************************************************************
+* Usage:        crc = crc.crc32c(data[,crc])
+* Desc:         Return the CRC-32C (Castagnoli, as used by iSCSI, ext4,
+*               SCTP) of data
+* Input:        data (string) data
+*               crc (integer/optional) CRC of the data before this
+* Return:       crc (integer) CRC
+***************************************************************************/
+
+static int crclua_crc32c(lua_State *L)
+{
+  return crc_sum(L,&m_crc32c);
+}
+
+/**************************************************************************
+* Usage:        crc = crc.crc64(data[,crc])
+* Desc:         Return the CRC-64 (ECMA-182, as used by xz) of data
+* Input:        data (string) data
+*               crc (integer/optional) CRC of the data before this
+* Return:       crc (integer) CRC
+*
+* Note:         Only available with Lua 5.3 or higher.
+***************************************************************************/
+
+#if LUA_VERSION_NUM >= 503
+  static int crclua_crc64(lua_State *L)
+  {
+    return crc_sum(L,&m_crc64);
+  }
+#endif
+
+/**************************************************************************
+* Usage:        crc = crc.combine(crc1,crc2,len2[,type])
+* Desc:         Return the CRC of two blocks of data, given the CRC of each
+* Input:        crc1 (integer) CRC of the first block
+*               crc2 (integer) CRC of the second block
+*               len2 (integer) length of the second block
+*               type (enum/optional)
+*                       * 'crc32' (default)
+*                       * 'crc32c'
+*                       * 'crc64'
+* Return:       crc (integer) CRC of both blocks together
+***************************************************************************/
+
+static int crclua_combine(lua_State *L)
+{
+  uint64_t             crc1 = (uint64_t)luaL_checkinteger(L,1);
+  uint64_t             crc2 = (uint64_t)luaL_checkinteger(L,2);
+  lua_Integer          len2 = luaL_checkinteger(L,3);
+  struct crcalg const *alg  = crc_checkalg(L,4);
+  
+  luaL_argcheck(L,len2 >= 0,3,"negative length");
+  lua_pushinteger(L,(lua_Integer)crc_combine(alg,crc1 & alg->mask,crc2 & alg->mask,(uint64_t)len2));
+  return 1;
+}
+
+/**************************************************************************
+*
+*                           STREAMING INTERFACE
+*
+***************************************************************************/
+
+struct crcobj
+{
+  struct crcalg const *alg;
+  uint64_t             crc;
+};
+
+/**************************************************************************
+* Usage:        obj = crc.new([type])
+* Desc:         Create an object to checksum data in pieces
+* Input:        type (enum/optional) see crc.combine()
+* Return:       obj (userdata) CRC object
+***************************************************************************/
+
+static int crclua_new(lua_State *L)
+{
+  struct crcalg const *alg = crc_checkalg(L,1);
+  struct crcobj       *obj = lua_newuserdata(L,sizeof(struct crcobj));
+  
+  obj->alg = alg;
+  obj->crc = alg->mask;
+  luaL_getmetatable(L,TYPE_CRC);
+  lua_setmetatable(L,-2);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        obj:update(data)
+* Desc:         Add data to the checksum
+* Input:        data (string) data
+* Return:       obj (userdata) CRC object
+***************************************************************************/
+
+static int crcobj_update(lua_State *L)
+{
+  struct crcobj *obj = luaL_checkudata(L,1,TYPE_CRC);
+  size_t         size;
+  uint8_t const *p   = (uint8_t const *)luaL_checklstring(L,2,&size);
+  
+  obj->crc = obj->alg->update(obj->alg,obj->crc,p,size);
+  lua_settop(L,1);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        crc = obj:value()
+* Desc:         Return the checksum of the data so far
+* Return:       crc (integer) CRC
+***************************************************************************/
+
+static int crcobj_value(lua_State *L)
+{
+  struct crcobj *obj = luaL_checkudata(L,1,TYPE_CRC);
+  lua_pushinteger(L,(lua_Integer)(~obj->crc & obj->alg->mask));
   return 1;
 }
 
+/**************************************************************************
+* Usage:        obj:reset()
+* Desc:         Start the checksum over
+***************************************************************************/
+
+static int crcobj_reset(lua_State *L)
+{
+  struct crcobj *obj = luaL_checkudata(L,1,TYPE_CRC);
+  obj->crc = obj->alg->mask;
+  return 0;
+}
+
+/*************************************************************************/
+
+static int crcobj___tostring(lua_State *L)
+{
+  struct crcobj *obj = luaL_checkudata(L,1,TYPE_CRC);
+  lua_pushfstring(L,"%s (%p)",obj->alg->name,(void *)obj);
+  return 1;
+}
+
+/**************************************************************************
+* Calling the module directly, as in crc(data[,crc]), is crc.crc32().
+***************************************************************************/
+
+static int crclua___call(lua_State *L)
+{
+  lua_remove(L,1);
+  return crclua_crc32(L);
+}
+
+/*************************************************************************
+* Usage:        pthread_once(&m_once,crc_setup);
+* Desc:         Build the tables, and pick the CRC32C hardware instruction
+*               if the CPU has it.
+**************************************************************************/
+
+static void crc_setup(void)
+{
+  crc_init(&m_crc32);
+  crc_init(&m_crc32c);
+  crc_init(&m_crc64);
+  
+#if defined(CRC32C_HW_RUNTIME)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2"))
+  {
+    m_crc32c.update = crc_update32c_hw;
+    m_hardware      = true;
+  }
+#elif defined(CRC32C_HW_ALWAYS)
+  m_crc32c.update = crc_update32c_hw;
+  m_hardware      = true;
+#endif
+}
+
 /****************************************************************/
 
 int luaopen_org_conman_crc(lua_State *L)
 {
-  lua_pushcfunction(L,crc32);
+  static struct luaL_Reg const crclua[] =
+  {
+    { "crc32"   , crclua_crc32   } ,
+    { "crc32c"  , crclua_crc32c  } ,
+#if LUA_VERSION_NUM >= 503
+    { "crc64"   , crclua_crc64   } ,
+#endif
+    { "combine" , crclua_combine } ,
+    { "new"     , crclua_new     } ,
+    { NULL      , NULL           }
+  };
+  
+  static struct luaL_Reg const crcobj_meta[] =
+  {
+    { "update"     , crcobj_update     } ,
+    { "value"      , crcobj_value      } ,
+    { "reset"      , crcobj_reset      } ,
+    { "__tostring" , crcobj___tostring } ,
+    { NULL         , NULL              }
+  };
+  
+  /*----------------------------------------------------------------------
+  ; The tables are shared by every Lua state in the process, so they're
+  ; built once, and no state (in another thread) sees them half done.
+  ;-----------------------------------------------------------------------*/
+  
+  pthread_once(&m_once,crc_setup);
+  
+  luaL_newmetatable(L,TYPE_CRC);
+#if LUA_VERSION_NUM == 501
+  luaL_register(L,NULL,crcobj_meta);
+#else
+  luaL_setfuncs(L,crcobj_meta,0);
+#endif
+
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  
+#if LUA_VERSION_NUM == 501
+  luaL_register(L,"org.conman.crc",crclua);
+#else
+  luaL_newlib(L,crclua);
+#endif
+
+  lua_pushboolean(L,m_hardware);
+  lua_setfield(L,-2,"HARDWARE");
+  
+  lua_createtable(L,0,1);
+  lua_pushcfunction(L,crclua___call);
+  lua_setfield(L,-2,"__call");
+  lua_setmetatable(L,-2);
   return 1;
 }
 
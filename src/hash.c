@@ -19,16 +19,31 @@
 *
 *************************************************************************/
 
+#ifdef __GNUC__
+#  define _GNU_SOURCE
+#endif
+
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <errno.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <openssl/opensslv.h>
 #include <openssl/evp.h>
+#include <openssl/crypto.h>
 
 #include <lua.h>
+#include <lualib.h>
 #include <lauxlib.h>
 
 #ifndef OPENSSL_VERSION_NUMBER
@@ -40,210 +55,1920 @@
 #endif
 
 #define TYPE_HASH       "org.conman.hash:hash"
+#define TYPE_MULTI      "org.conman.hash:multi"
+#define TYPE_HMAC       "org.conman.hash:hmac"
+
+#define HASH_MAPSIZE    (64uL * 1024uL * 1024uL)
+#define HASH_READSIZE   (1024uL * 1024uL)
+#define HASH_BLOCKSIZE  (64uL * 1024uL)
+#define HASH_MAXMULTI   16
+#define HMAC_MAXBLOCK   144     /* SHA3-224 has the largest block */
+
+#define XXH_PRIME32_1   0x9E3779B1uL
+#define XXH_PRIME32_2   0x85EBCA77uL
+#define XXH_PRIME32_3   0xC2B2AE3DuL
+#define XXH_PRIME64_1   0x9E3779B185EBCA87uLL
+#define XXH_PRIME64_2   0xC2B2AE3D27D4EB4FuLL
+#define XXH_PRIME64_3   0x165667B19E3779F9uLL
+#define XXH_PRIME64_4   0x85EBCA77C2B2AE63uLL
+#define XXH_PRIME64_5   0x27D4EB2F165667C5uLL
+#define XXH_PRIME_MX1   0x165667919E3779F9uLL
+#define XXH_PRIME_MX2   0x9FB21C651E98DF25uLL
+
+#define XXH3_SECRETSIZE 192
+#define XXH3_STRIPE     64
+#define XXH3_STRIPES    ((XXH3_SECRETSIZE - XXH3_STRIPE) / 8)
+#define XXH3_BUFSIZE    (4 * XXH3_STRIPE)
+#define XXH3_MIDSIZE    240
+
+enum
+{
+  HASH_EVP,
+  HASH_XXH3,
+  HASH_XXH128,
+  HASH_SIPHASH,
+  HASH_HMAC
+};
+
+typedef struct
+{
+  uint64_t lo;
+  uint64_t hi;
+} u128__s;
+
+struct xxh3
+{
+  uint64_t acc[8];
+  uint64_t seed;
+  uint64_t total;
+  size_t   stripes;
+  size_t   buffered;
+  uint8_t  buffer[XXH3_BUFSIZE];
+  uint8_t  prev  [XXH3_STRIPE];
+  uint8_t  secret[XXH3_SECRETSIZE];
+};
+
+struct siphash
+{
+  uint64_t v[4];
+  uint64_t total;
+  size_t   buffered;
+  uint8_t  buffer[8];
+};
+
+struct hashctx
+{
+  int         type;
+  EVP_MD_CTX *evp;
+  EVP_MD_CTX *outer;
+  union
+  {
+    struct xxh3    xxh3;
+    struct siphash sip;
+  } u;
+};
+
+struct hmackey
+{
+  size_t      size;
+  EVP_MD_CTX *inner;
+  EVP_MD_CTX *outer;
+  EVP_MD_CTX *work;
+};
+
+struct hashmulti
+{
+  size_t         n;
+  struct hashctx ctx [HASH_MAXMULTI];
+  char           name[HASH_MAXMULTI][32];
+};
+
+/*------------------------------------------------------------------------
+; The default secret for XXH3, from the reference implementation.
+;------------------------------------------------------------------------*/
+
+static uint8_t const m_xxh3_secret[XXH3_SECRETSIZE] =
+{
+  0xB8 , 0xFE , 0x6C , 0x39 , 0x23 , 0xA4 , 0x4B , 0xBE , 0x7C , 0x01 , 0x81 , 0x2C ,
+  0xF7 , 0x21 , 0xAD , 0x1C , 0xDE , 0xD4 , 0x6D , 0xE9 , 0x83 , 0x90 , 0x97 , 0xDB ,
+  0x72 , 0x40 , 0xA4 , 0xA4 , 0xB7 , 0xB3 , 0x67 , 0x1F , 0xCB , 0x79 , 0xE6 , 0x4E ,
+  0xCC , 0xC0 , 0xE5 , 0x78 , 0x82 , 0x5A , 0xD0 , 0x7D , 0xCC , 0xFF , 0x72 , 0x21 ,
+  0xB8 , 0x08 , 0x46 , 0x74 , 0xF7 , 0x43 , 0x24 , 0x8E , 0xE0 , 0x35 , 0x90 , 0xE6 ,
+  0x81 , 0x3A , 0x26 , 0x4C , 0x3C , 0x28 , 0x52 , 0xBB , 0x91 , 0xC3 , 0x00 , 0xCB ,
+  0x88 , 0xD0 , 0x65 , 0x8B , 0x1B , 0x53 , 0x2E , 0xA3 , 0x71 , 0x64 , 0x48 , 0x97 ,
+  0xA2 , 0x0D , 0xF9 , 0x4E , 0x38 , 0x19 , 0xEF , 0x46 , 0xA9 , 0xDE , 0xAC , 0xD8 ,
+  0xA8 , 0xFA , 0x76 , 0x3F , 0xE3 , 0x9C , 0x34 , 0x3F , 0xF9 , 0xDC , 0xBB , 0xC7 ,
+  0xC7 , 0x0B , 0x4F , 0x1D , 0x8A , 0x51 , 0xE0 , 0x4B , 0xCD , 0xB4 , 0x59 , 0x31 ,
+  0xC8 , 0x9F , 0x7E , 0xC9 , 0xD9 , 0x78 , 0x73 , 0x64 , 0xEA , 0xC5 , 0xAC , 0x83 ,
+  0x34 , 0xD3 , 0xEB , 0xC3 , 0xC5 , 0x81 , 0xA0 , 0xFF , 0xFA , 0x13 , 0x63 , 0xEB ,
+  0x17 , 0x0D , 0xDD , 0x51 , 0xB7 , 0xF0 , 0xDA , 0x49 , 0xD3 , 0x16 , 0x55 , 0x26 ,
+  0x29 , 0xD4 , 0x68 , 0x9E , 0x2B , 0x16 , 0xBE , 0x58 , 0x7D , 0x47 , 0xA1 , 0xFC ,
+  0x8F , 0xF8 , 0xB8 , 0xD1 , 0x7A , 0xD0 , 0x31 , 0xCE , 0x45 , 0xCB , 0x3A , 0x8F ,
+  0x95 , 0x16 , 0x04 , 0x28 , 0xAF , 0xD7 , 0xFB , 0xCA , 0xBB , 0x4B , 0x40 , 0x7E
+};
+
+/**************************************************************************
+*
+*                    NON-CRYPTOGRAPHIC HASHES
+*
+* XXH3 (64 and 128 bit) and SipHash-2-4 are done here, as OpenSSL doesn't
+* provide them as digests.  XXH3 is for when speed matters (cache keys,
+* sharding); SipHash, with a secret key, is for hash tables that face
+* untrusted input.
+*
+***************************************************************************/
+
+static inline uint32_t hash_read32(uint8_t const *p)
+{
+  return (uint32_t)p[0]
+       | (uint32_t)p[1] <<  8
+       | (uint32_t)p[2] << 16
+       | (uint32_t)p[3] << 24
+       ;
+}
+
+/************************************************************************/
+
+static inline uint64_t hash_read64(uint8_t const *p)
+{
+  return (uint64_t)hash_read32(p) | (uint64_t)hash_read32(p + 4) << 32;
+}
+
+/************************************************************************/
+
+static inline void hash_write64le(uint8_t *p,uint64_t v)
+{
+  for (size_t i = 0 ; i < 8 ; i++ , v >>= 8)
+    p[i] = v & 0xFF;
+}
+
+/************************************************************************/
+
+static inline void hash_write64be(uint8_t *p,uint64_t v)
+{
+  for (size_t i = 8 ; i > 0 ; i-- , v >>= 8)
+    p[i - 1] = v & 0xFF;
+}
+
+/************************************************************************/
+
+static inline uint64_t hash_rotl64(uint64_t v,unsigned int n)
+{
+  return (v << n) | (v >> (64 - n));
+}
+
+/************************************************************************/
+
+static inline uint32_t hash_swap32(uint32_t v)
+{
+  return (v << 24)
+       | ((v <<  8) & 0x00FF0000uL)
+       | ((v >>  8) & 0x0000FF00uL)
+       | (v >> 24)
+       ;
+}
+
+/************************************************************************/
+
+static inline uint64_t hash_swap64(uint64_t v)
+{
+  return (uint64_t)hash_swap32(v & 0xFFFFFFFFuL) << 32 | hash_swap32(v >> 32);
+}
+
+/*************************************************************************
+* Usage:        r = xxh_mul128(a,b)
+* Desc:         Full 64x64 to 128 bit multiply.  The compiler turns this
+*               into a single instruction where there is one.
+**************************************************************************/
+
+static inline u128__s xxh_mul128(uint64_t a,uint64_t b)
+{
+  uint64_t lolo  = (a & 0xFFFFFFFFuL) * (b & 0xFFFFFFFFuL);
+  uint64_t hilo  = (a >> 32)          * (b & 0xFFFFFFFFuL);
+  uint64_t lohi  = (a & 0xFFFFFFFFuL) * (b >> 32);
+  uint64_t hihi  = (a >> 32)          * (b >> 32);
+  uint64_t cross = (lolo >> 32) + (hilo & 0xFFFFFFFFuL) + lohi;
+  u128__s  r;
+  
+  r.hi = (hilo >> 32) + (cross >> 32) + hihi;
+  r.lo = (cross << 32) | (lolo & 0xFFFFFFFFuL);
+  return r;
+}
+
+/************************************************************************/
+
+static inline uint64_t xxh_fold64(uint64_t a,uint64_t b)
+{
+  u128__s r = xxh_mul128(a,b);
+  return r.lo ^ r.hi;
+}
+
+/************************************************************************/
+
+static inline uint64_t xxh64_avalanche(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+/************************************************************************/
+
+static inline uint64_t xxh3_avalanche(uint64_t h)
+{
+  h ^= h >> 37;
+  h *= XXH_PRIME_MX1;
+  h ^= h >> 32;
+  return h;
+}
+
+/************************************************************************/
+
+static inline uint64_t xxh3_mix16(
+        uint8_t const *p,
+        uint8_t const *secret,
+        uint64_t       seed
+)
+{
+  return xxh_fold64(
+        hash_read64(p)     ^ (hash_read64(secret)     + seed),
+        hash_read64(p + 8) ^ (hash_read64(secret + 8) - seed)
+  );
+}
+
+/************************************************************************/
+
+static inline void xxh3_mix32(
+        u128__s       *acc,
+        uint8_t const *p1,
+        uint8_t const *p2,
+        uint8_t const *secret,
+        uint64_t       seed
+)
+{
+  acc->lo += xxh3_mix16(p1,secret,seed);
+  acc->lo ^= hash_read64(p2) + hash_read64(p2 + 8);
+  acc->hi += xxh3_mix16(p2,secret + 16,seed);
+  acc->hi ^= hash_read64(p1) + hash_read64(p1 + 8);
+}
+
+/*************************************************************************
+* Usage:        h = xxh3_short64(p,len,seed)
+* Desc:         XXH3-64 of data up to XXH3_MIDSIZE bytes.  Each size range
+*               has its own path, all using the default secret.
+**************************************************************************/
+
+static uint64_t xxh3_short64(uint8_t const *p,size_t len,uint64_t seed)
+{
+  uint8_t const *secret = m_xxh3_secret;
+  uint64_t       acc;
+  
+  if (len == 0)
+    return xxh64_avalanche(seed ^ hash_read64(secret + 56) ^ hash_read64(secret + 64));
+    
+  if (len <= 3)
+  {
+    uint32_t combined = (uint32_t)p[0] << 16
+                      | (uint32_t)p[len >> 1] << 24
+                      | (uint32_t)p[len - 1]
+                      | (uint32_t)len << 8
+                      ;
+    uint64_t bitflip  = (hash_read32(secret) ^ hash_read32(secret + 4)) + seed;
+    
+    return xxh64_avalanche(combined ^ bitflip);
+  }
+  
+  if (len <= 8)
+  {
+    uint64_t bitflip;
+    uint64_t h;
+    
+    seed   ^= (uint64_t)hash_swap32(seed & 0xFFFFFFFFuL) << 32;
+    bitflip = (hash_read64(secret + 8) ^ hash_read64(secret + 16)) - seed;
+    h       = (hash_read32(p + len - 4) + ((uint64_t)hash_read32(p) << 32)) ^ bitflip;
+    h      ^= hash_rotl64(h,49) ^ hash_rotl64(h,24);
+    h      *= XXH_PRIME_MX2;
+    h      ^= (h >> 35) + len;
+    h      *= XXH_PRIME_MX2;
+    return h ^ (h >> 28);
+  }
+  
+  if (len <= 16)
+  {
+    uint64_t lo = hash_read64(p)           ^ ((hash_read64(secret + 24) ^ hash_read64(secret + 32)) + seed);
+    uint64_t hi = hash_read64(p + len - 8) ^ ((hash_read64(secret + 40) ^ hash_read64(secret + 48)) - seed);
+    
+    return xxh3_avalanche(len + hash_swap64(lo) + hi + xxh_fold64(lo,hi));
+  }
+  
+  acc = len * XXH_PRIME64_1;
+  
+  if (len <= 128)
+  {
+    if (len > 32)
+    {
+      if (len > 64)
+      {
+        if (len > 96)
+        {
+          acc += xxh3_mix16(p + 48,      secret + 96, seed);
+          acc += xxh3_mix16(p + len - 64,secret + 112,seed);
+        }
+        acc += xxh3_mix16(p + 32,      secret + 64,seed);
+        acc += xxh3_mix16(p + len - 48,secret + 80,seed);
+      }
+      acc += xxh3_mix16(p + 16,      secret + 32,seed);
+      acc += xxh3_mix16(p + len - 32,secret + 48,seed);
+    }
+    acc += xxh3_mix16(p,           secret,     seed);
+    acc += xxh3_mix16(p + len - 16,secret + 16,seed);
+    return xxh3_avalanche(acc);
+  }
+  
+  for (size_t i = 0 ; i < 8 ; i++)
+    acc += xxh3_mix16(p + 16 * i,secret + 16 * i,seed);
+  acc = xxh3_avalanche(acc);
+  for (size_t i = 8 ; i < len / 16 ; i++)
+    acc += xxh3_mix16(p + 16 * i,secret + 16 * (i - 8) + 3,seed);
+  acc += xxh3_mix16(p + len - 16,secret + 136 - 17,seed);
+  return xxh3_avalanche(acc);
+}
+
+/*************************************************************************
+* Usage:        xxh3_short128(h,p,len,seed)
+* Desc:         XXH3-128 of data up to XXH3_MIDSIZE bytes.
+**************************************************************************/
+
+static void xxh3_short128(u128__s *h,uint8_t const *p,size_t len,uint64_t seed)
+{
+  uint8_t const *secret = m_xxh3_secret;
+  u128__s        acc;
+  
+  if (len == 0)
+  {
+    h->lo = xxh64_avalanche(seed ^ hash_read64(secret + 64) ^ hash_read64(secret + 72));
+    h->hi = xxh64_avalanche(seed ^ hash_read64(secret + 80) ^ hash_read64(secret + 88));
+    return;
+  }
+  
+  if (len <= 3)
+  {
+    uint32_t combinedl = (uint32_t)p[0] << 16
+                       | (uint32_t)p[len >> 1] << 24
+                       | (uint32_t)p[len - 1]
+                       | (uint32_t)len << 8
+                       ;
+    uint32_t swapped   = hash_swap32(combinedl);
+    uint32_t combinedh = (swapped << 13) | (swapped >> 19);
+    uint64_t bitflipl  = (hash_read32(secret)     ^ hash_read32(secret + 4))  + seed;
+    uint64_t bitfliph  = (hash_read32(secret + 8) ^ hash_read32(secret + 12)) - seed;
+    
+    h->lo = xxh64_avalanche(combinedl ^ bitflipl);
+    h->hi = xxh64_avalanche(combinedh ^ bitfliph);
+    return;
+  }
+  
+  if (len <= 8)
+  {
+    uint64_t bitflip;
+    uint64_t keyed;
+    
+    seed   ^= (uint64_t)hash_swap32(seed & 0xFFFFFFFFuL) << 32;
+    bitflip = (hash_read64(secret + 16) ^ hash_read64(secret + 24)) + seed;
+    keyed   = (hash_read32(p) + ((uint64_t)hash_read32(p + len - 4) << 32)) ^ bitflip;
+    *h      = xxh_mul128(keyed,XXH_PRIME64_1 + (len << 2));
+    h->hi  += h->lo << 1;
+    h->lo  ^= h->hi >> 3;
+    h->lo  ^= h->lo >> 35;
+    h->lo  *= XXH_PRIME_MX2;
+    h->lo  ^= h->lo >> 28;
+    h->hi   = xxh3_avalanche(h->hi);
+    return;
+  }
+  
+  if (len <= 16)
+  {
+    uint64_t bitflipl = (hash_read64(secret + 32) ^ hash_read64(secret + 40)) - seed;
+    uint64_t bitfliph = (hash_read64(secret + 48) ^ hash_read64(secret + 56)) + seed;
+    uint64_t inlo     = hash_read64(p);
+    uint64_t inhi     = hash_read64(p + len - 8);
+    u128__s  m        = xxh_mul128(inlo ^ inhi ^ bitflipl,XXH_PRIME64_1);
+    uint64_t mhi;
+    
+    m.lo += (uint64_t)(len - 1) << 54;
+    inhi ^= bitfliph;
+    m.hi += inhi + (inhi & 0xFFFFFFFFuL) * (XXH_PRIME32_2 - 1);
+    m.lo ^= hash_swap64(m.hi);
+    mhi   = m.hi;
+    m     = xxh_mul128(m.lo,XXH_PRIME64_2);
+    m.hi += mhi * XXH_PRIME64_2;
+    h->lo = xxh3_avalanche(m.lo);
+    h->hi = xxh3_avalanche(m.hi);
+    return;
+  }
+  
+  acc.lo = len * XXH_PRIME64_1;
+  acc.hi = 0;
+  
+  if (len <= 128)
+  {
+    if (len > 32)
+    {
+      if (len > 64)
+      {
+        if (len > 96)
+          xxh3_mix32(&acc,p + 48,p + len - 64,secret + 96,seed);
+        xxh3_mix32(&acc,p + 32,p + len - 48,secret + 64,seed);
+      }
+      xxh3_mix32(&acc,p + 16,p + len - 32,secret + 32,seed);
+    }
+    xxh3_mix32(&acc,p,p + len - 16,secret,seed);
+  }
+  else
+  {
+    for (size_t i = 0 ; i < 4 ; i++)
+      xxh3_mix32(&acc,p + 32 * i,p + 32 * i + 16,secret + 32 * i,seed);
+    acc.lo = xxh3_avalanche(acc.lo);
+    acc.hi = xxh3_avalanche(acc.hi);
+    for (size_t i = 4 ; i < len / 32 ; i++)
+      xxh3_mix32(&acc,p + 32 * i,p + 32 * i + 16,secret + 32 * (i - 4) + 3,seed);
+    xxh3_mix32(&acc,p + len - 16,p + len - 32,secret + 136 - 17 - 16,0 - seed);
+  }
+  
+  h->lo = xxh3_avalanche(acc.lo + acc.hi);
+  h->hi = 0 - xxh3_avalanche(
+                  acc.lo * XXH_PRIME64_1
+                + acc.hi * XXH_PRIME64_4
+                + (len - seed) * XXH_PRIME64_2
+              );
+}
+
+/************************************************************************/
+
+static inline void xxh3_accumulate(
+        uint64_t      *acc,
+        uint8_t const *p,
+        uint8_t const *secret
+)
+{
+  for (size_t i = 0 ; i < 8 ; i++)
+  {
+    uint64_t data = hash_read64(p + 8 * i);
+    uint64_t key  = data ^ hash_read64(secret + 8 * i);
+    
+    acc[i ^ 1] += data;
+    acc[i]     += (key & 0xFFFFFFFFuL) * (key >> 32);
+  }
+}
+
+/*************************************************************************
+* Usage:        xxh3_stripes(acc,stripes,secret,p,n)
+* Desc:         Accumulate stripes of input for long XXH3, scrambling the
+*               accumulators after each block of XXH3_STRIPES stripes.
+* Input:        acc (uint64_t[8]) accumulators
+*               stripes (size_t *) stripes done in the current block
+*               secret (uint8_t const *) secret
+*               p (uint8_t const *) input
+*               n (size_t) number of stripes
+**************************************************************************/
+
+static void xxh3_stripes(
+        uint64_t      *acc,
+        size_t        *stripes,
+        uint8_t const *secret,
+        uint8_t const *p,
+        size_t         n
+)
+{
+  for ( ; n > 0 ; n-- , p += XXH3_STRIPE)
+  {
+    xxh3_accumulate(acc,p,secret + *stripes * 8);
+    if (++*stripes == XXH3_STRIPES)
+    {
+      for (size_t i = 0 ; i < 8 ; i++)
+      {
+        acc[i] ^= acc[i] >> 47;
+        acc[i] ^= hash_read64(secret + XXH3_SECRETSIZE - XXH3_STRIPE + 8 * i);
+        acc[i] *= XXH_PRIME32_1;
+      }
+      *stripes = 0;
+    }
+  }
+}
+
+/************************************************************************/
+
+static uint64_t xxh3_merge(
+        uint64_t const *acc,
+        uint8_t const  *secret,
+        uint64_t        h
+)
+{
+  for (size_t i = 0 ; i < 4 ; i++)
+    h += xxh_fold64(
+           acc[2 * i]     ^ hash_read64(secret + 16 * i),
+           acc[2 * i + 1] ^ hash_read64(secret + 16 * i + 8)
+         );
+  return xxh3_avalanche(h);
+}
+
+/************************************************************************/
+
+static void xxh3_init(struct xxh3 *state,uint64_t seed)
+{
+  static uint64_t const init[8] =
+  {
+    XXH_PRIME32_3 , XXH_PRIME64_1 , XXH_PRIME64_2 , XXH_PRIME64_3 ,
+    XXH_PRIME64_4 , XXH_PRIME32_2 , XXH_PRIME64_5 , XXH_PRIME32_1
+  };
+  
+  memcpy(state->acc,init,sizeof(init));
+  state->seed     = seed;
+  state->total    = 0;
+  state->stripes  = 0;
+  state->buffered = 0;
+  
+  for (size_t i = 0 ; i < XXH3_SECRETSIZE ; i += 16)
+  {
+    hash_write64le(state->secret + i,    hash_read64(m_xxh3_secret + i)     + seed);
+    hash_write64le(state->secret + i + 8,hash_read64(m_xxh3_secret + i + 8) - seed);
+  }
+}
+
+/*************************************************************************
+* Usage:        xxh3_update(state,p,len)
+* Desc:         Add data to an XXH3 hash.
+*
+* Note:         Input is only consumed a buffer's worth at a time, and only
+*               when more input follows it, since the last stripe is
+*               treated differently.  The last stripe consumed is kept in
+*               case the final stripe overlaps it.
+**************************************************************************/
+
+static void xxh3_update(struct xxh3 *state,uint8_t const *p,size_t len)
+{
+  state->total += len;
+  
+  if (len <= XXH3_BUFSIZE - state->buffered)
+  {
+    memcpy(state->buffer + state->buffered,p,len);
+    state->buffered += len;
+    return;
+  }
+  
+  if (state->buffered > 0)
+  {
+    size_t fill = XXH3_BUFSIZE - state->buffered;
+    
+    memcpy(state->buffer + state->buffered,p,fill);
+    p   += fill;
+    len -= fill;
+    xxh3_stripes(state->acc,&state->stripes,state->secret,state->buffer,XXH3_BUFSIZE / XXH3_STRIPE);
+    memcpy(state->prev,state->buffer + XXH3_BUFSIZE - XXH3_STRIPE,XXH3_STRIPE);
+    state->buffered = 0;
+  }
+  
+  if (len > XXH3_BUFSIZE)
+  {
+    while(len > XXH3_BUFSIZE)
+    {
+      xxh3_stripes(state->acc,&state->stripes,state->secret,p,XXH3_BUFSIZE / XXH3_STRIPE);
+      p   += XXH3_BUFSIZE;
+      len -= XXH3_BUFSIZE;
+    }
+    memcpy(state->prev,p - XXH3_STRIPE,XXH3_STRIPE);
+  }
+  
+  memcpy(state->buffer,p,len);
+  state->buffered = len;
+}
+
+/*************************************************************************
+* Usage:        xxh3_digest(state,h,wide)
+* Desc:         Return the hash so far, without disturbing the state
+* Input:        state (struct xxh3 const *) state
+*               h (u128__s *) hash (lo is the 64-bit hash)
+*               wide (bool) true for the 128-bit hash
+**************************************************************************/
+
+static void xxh3_digest(struct xxh3 const *state,u128__s *h,bool wide)
+{
+  uint64_t acc[8];
+  uint8_t  last[XXH3_STRIPE];
+  size_t   stripes = state->stripes;
+  
+  if (state->total <= XXH3_MIDSIZE)
+  {
+    if (wide)
+      xxh3_short128(h,state->buffer,state->total,state->seed);
+    else
+      h->lo = xxh3_short64(state->buffer,state->total,state->seed);
+    return;
+  }
+  
+  memcpy(acc,state->acc,sizeof(acc));
+  xxh3_stripes(acc,&stripes,state->secret,state->buffer,(state->buffered - 1) / XXH3_STRIPE);
+  
+  if (state->buffered >= XXH3_STRIPE)
+    memcpy(last,state->buffer + state->buffered - XXH3_STRIPE,XXH3_STRIPE);
+  else
+  {
+    size_t keep = XXH3_STRIPE - state->buffered;
+    memcpy(last,state->prev + state->buffered,keep);
+    memcpy(last + keep,state->buffer,state->buffered);
+  }
+  
+  xxh3_accumulate(acc,last,state->secret + XXH3_SECRETSIZE - XXH3_STRIPE - 7);
+  h->lo = xxh3_merge(acc,state->secret + 11,state->total * XXH_PRIME64_1);
+  if (wide)
+    h->hi = xxh3_merge(
+                acc,
+                state->secret + XXH3_SECRETSIZE - XXH3_STRIPE - 11,
+                ~(state->total * XXH_PRIME64_2)
+            );
+}
+
+/************************************************************************/
+
+#define SIPROUND(v)                                                     \
+  do                                                                    \
+  {                                                                     \
+    v[0] += v[1]; v[1] = hash_rotl64(v[1],13); v[1] ^= v[0];            \
+    v[0]  = hash_rotl64(v[0],32);                                       \
+    v[2] += v[3]; v[3] = hash_rotl64(v[3],16); v[3] ^= v[2];            \
+    v[0] += v[3]; v[3] = hash_rotl64(v[3],21); v[3] ^= v[0];            \
+    v[2] += v[1]; v[1] = hash_rotl64(v[1],17); v[1] ^= v[2];            \
+    v[2]  = hash_rotl64(v[2],32);                                       \
+  } while(0)
+  
+static void siphash_init(struct siphash *state,uint8_t const *key)
+{
+  uint64_t k0 = hash_read64(key);
+  uint64_t k1 = hash_read64(key + 8);
+  
+  state->v[0]     = k0 ^ 0x736F6D6570736575uLL;
+  state->v[1]     = k1 ^ 0x646F72616E646F6DuLL;
+  state->v[2]     = k0 ^ 0x6C7967656E657261uLL;
+  state->v[3]     = k1 ^ 0x7465646279746573uLL;
+  state->total    = 0;
+  state->buffered = 0;
+}
+
+/************************************************************************/
+
+static inline void siphash_block(uint64_t *v,uint64_t m)
+{
+  v[3] ^= m;
+  SIPROUND(v);
+  SIPROUND(v);
+  v[0] ^= m;
+}
+
+/************************************************************************/
+
+static void siphash_update(struct siphash *state,uint8_t const *p,size_t len)
+{
+  state->total += len;
+  
+  if (state->buffered > 0)
+  {
+    while((len > 0) && (state->buffered < 8))
+    {
+      state->buffer[state->buffered++] = *p++;
+      len--;
+    }
+    if (state->buffered < 8)
+      return;
+    siphash_block(state->v,hash_read64(state->buffer));
+    state->buffered = 0;
+  }
+  
+  for ( ; len >= 8 ; p += 8 , len -= 8)
+    siphash_block(state->v,hash_read64(p));
+    
+  memcpy(state->buffer,p,len);
+  state->buffered = len;
+}
+
+/************************************************************************/
+
+static uint64_t siphash_digest(struct siphash const *state)
+{
+  uint64_t v[4];
+  uint64_t b = state->total << 56;
+  
+  memcpy(v,state->v,sizeof(v));
+  for (size_t i = 0 ; i < state->buffered ; i++)
+    b |= (uint64_t)state->buffer[i] << (8 * i);
+    
+  siphash_block(v,b);
+  v[2] ^= 0xFF;
+  SIPROUND(v);
+  SIPROUND(v);
+  SIPROUND(v);
+  SIPROUND(v);
+  return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+/**************************************************************************
+*
+*                       HASH CONTEXTS
+*
+***************************************************************************/
+
+static EVP_MD_CTX *hash_evpnew(void)
+{
+#if OPENSSL_VERSION_NUMBER < 0x1010000fL
+  EVP_MD_CTX *ctx = malloc(sizeof(EVP_MD_CTX));
+  if (ctx != NULL)
+    EVP_MD_CTX_init(ctx);
+  return ctx;
+#else
+  return EVP_MD_CTX_new();
+#endif
+}
+
+/************************************************************************/
+
+static void hash_evpfree(EVP_MD_CTX *ctx)
+{
+  if (ctx != NULL)
+  {
+#if OPENSSL_VERSION_NUMBER < 0x1010000fL
+    EVP_MD_CTX_cleanup(ctx);
+    free(ctx);
+#else
+    EVP_MD_CTX_free(ctx);
+#endif
+  }
+}
+
+/*************************************************************************
+* Usage:        okay = hash_init(L,ctx,alg,key)
+* Desc:         Initialize a hash context
+* Input:        L (lua_State *) Lua state
+*               ctx (struct hashctx *) context
+*               alg (char const *) algorithm name
+*               key (int) stack index of the key (seed for XXH3), 0 if
+*                       | no key is allowed
+* Return:       okay (bool) true if okay, false if the algorithm is unknown
+*
+* Note:         Raises an error if a key is required but missing or the
+*               wrong size.
+**************************************************************************/
+
+static bool hash_init(lua_State *L,struct hashctx *ctx,char const *alg,int key)
+{
+  EVP_MD const *m;
+  
+  ctx->evp   = NULL;
+  ctx->outer = NULL;
+  
+  if ((strcmp(alg,"xxh3") == 0) || (strcmp(alg,"xxh3-64") == 0))
+  {
+    ctx->type = HASH_XXH3;
+    xxh3_init(&ctx->u.xxh3,key > 0 ? (uint64_t)luaL_optinteger(L,key,0) : 0);
+    return true;
+  }
+  
+  if (strcmp(alg,"xxh3-128") == 0)
+  {
+    ctx->type = HASH_XXH128;
+    xxh3_init(&ctx->u.xxh3,key > 0 ? (uint64_t)luaL_optinteger(L,key,0) : 0);
+    return true;
+  }
+  
+  if ((strcmp(alg,"siphash") == 0) || (strcmp(alg,"siphash-2-4") == 0))
+  {
+    char const *k;
+    size_t      ksize;
+    
+    if (key == 0)
+      return false;
+      
+    k = luaL_checklstring(L,key,&ksize);
+    luaL_argcheck(L,ksize == 16,key,"SipHash key must be 16 bytes");
+    ctx->type = HASH_SIPHASH;
+    siphash_init(&ctx->u.sip,(uint8_t const *)k);
+    return true;
+  }
+  
+  m = EVP_get_digestbyname(alg);
+  if (m == NULL)
+    return false;
+    
+  ctx->type = HASH_EVP;
+  ctx->evp  = hash_evpnew();
+  EVP_DigestInit(ctx->evp,m);
+  return true;
+}
+
+/************************************************************************/
+
+static void hash_feed(struct hashctx *ctx,void const *data,size_t size)
+{
+  switch(ctx->type)
+  {
+    case HASH_EVP:
+    case HASH_HMAC:
+         EVP_DigestUpdate(ctx->evp,data,size);
+         break;
+         
+    case HASH_XXH3:
+    case HASH_XXH128:
+         xxh3_update(&ctx->u.xxh3,data,size);
+         break;
+         
+    case HASH_SIPHASH:
+         siphash_update(&ctx->u.sip,data,size);
+         break;
+  }
+}
+
+/*************************************************************************
+* Usage:        size = hash_final(ctx,hash)
+* Desc:         Return the hash.  The native hashes are returned in their
+*               canonical byte order (big-endian for XXH3, high half first
+*               for XXH3-128, little-endian for SipHash).  For an HMAC, the
+*               inner hash is fed to the outer one.
+* Input:        ctx (struct hashctx *) context
+*               hash (unsigned char *) hash, EVP_MAX_MD_SIZE bytes
+* Return:       size (size_t) size of hash
+**************************************************************************/
+
+static size_t hash_final(struct hashctx *ctx,unsigned char *hash)
+{
+  unsigned int hashsize = EVP_MAX_MD_SIZE;
+  u128__s      h;
+  
+  switch(ctx->type)
+  {
+    case HASH_XXH3:
+         xxh3_digest(&ctx->u.xxh3,&h,false);
+         hash_write64be(hash,h.lo);
+         return 8;
+         
+    case HASH_XXH128:
+         xxh3_digest(&ctx->u.xxh3,&h,true);
+         hash_write64be(hash,h.hi);
+         hash_write64be(hash + 8,h.lo);
+         return 16;
+         
+    case HASH_SIPHASH:
+         hash_write64le(hash,siphash_digest(&ctx->u.sip));
+         return 8;
+         
+    case HASH_HMAC:
+         EVP_DigestFinal(ctx->evp,hash,&hashsize);
+         EVP_DigestUpdate(ctx->outer,hash,hashsize);
+         EVP_DigestFinal(ctx->outer,hash,&hashsize);
+         return hashsize;
+         
+    default:
+         EVP_DigestFinal(ctx->evp,hash,&hashsize);
+         return hashsize;
+  }
+}
+
+/************************************************************************/
+
+static void hash_free(struct hashctx *ctx)
+{
+  hash_evpfree(ctx->evp);
+  hash_evpfree(ctx->outer);
+  ctx->evp   = NULL;
+  ctx->outer = NULL;
+}
+
+/************************************************************************/
+
+static int hash_hexa(
+        lua_State  *L,
+        char const *data,
+        size_t      size
+)
+{
+  luaL_Buffer buf;
+  char        hex[3];
+  
+  luaL_buffinit(L,&buf);
+  while(size--)
+  {
+    snprintf(hex,3,"%02X",(unsigned char)*data++);
+    luaL_addlstring(&buf,hex,2);
+  }
+  luaL_pushresult(&buf);
+  return 1;
+}
+
+/*************************************************************************
+* Usage:        ctx = hash.new([alg[,key]])
+* Desc:         Create a hash context
+* Input:        alg (string/optional) hash algorithm (default "md5"), any
+*                       | OpenSSL digest, or one of:
+*                       | * 'xxh3'     XXH3, 64 bits
+*                       | * 'xxh3-128' XXH3, 128 bits
+*                       | * 'siphash'  SipHash-2-4, 64 bits
+*               key (integer/string/optional) seed for XXH3 (default 0),
+*                       | 16 byte key for SipHash (required)
+* Return:       ctx (userdata) hash context, nil if unknown algorithm
+**************************************************************************/
+
+static int hashlua_new(lua_State *L)
+{
+  struct hashctx *ctx;
+  
+  lua_settop(L,2); /* so the context doesn't end up as the key */
+  ctx = lua_newuserdata(L,sizeof(struct hashctx));
+  
+  if (!hash_init(L,ctx,luaL_optstring(L,1,"md5"),2))
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  
+  luaL_getmetatable(L,TYPE_HASH);
+  lua_setmetatable(L,-2);
+  return 1;
+}
+
+/************************************************************************/
+
+static int hashlua_update(lua_State *L)
+{
+  struct hashctx *ctx;
+  char const     *data;
+  size_t          size;
+  
+  ctx  = luaL_checkudata(L,1,TYPE_HASH);
+  data = luaL_checklstring(L,2,&size);
+  
+  hash_feed(ctx,data,size);
+  lua_pushboolean(L,true);
+  return 1;
+}
+
+/*************************************************************************
+* Usage:        hash_update(ctx,n,data,size)
+* Desc:         Add data to several hashes.  The data is fed to them in
+*               blocks, so each block is still in the cache for every hash
+*               after the first.
+* Input:        ctx (struct hashctx []) hash contexts
+*               n (size_t) number of contexts
+*               data (void const *) data
+*               size (size_t) size of data
+**************************************************************************/
+
+static void hash_update(
+        struct hashctx *ctx,
+        size_t          n,
+        void const     *data,
+        size_t          size
+)
+{
+  char const *p = data;
+  
+  if (n == 1)
+  {
+    hash_feed(ctx,data,size);
+    return;
+  }
+  
+  while(size > 0)
+  {
+    size_t len = size < HASH_BLOCKSIZE ? size : HASH_BLOCKSIZE;
+    
+    for (size_t i = 0 ; i < n ; i++)
+      hash_feed(&ctx[i],p,len);
+    p    += len;
+    size -= len;
+  }
+}
+
+/*************************************************************************
+* Usage:        err = hash_fd(ctx,n,fd)
+* Desc:         Hash a file from the current position to the end
+* Input:        ctx (struct hashctx []) hash contexts
+*               n (size_t) number of contexts
+*               fd (int) file descriptor
+* Return:       err (int) 0 on success, otherwise system error number
+*
+* Note:         A regular file is mapped into memory a piece at a time,
+*               anything else (or a file that can't be mapped) is read.
+*               Either way, the data never passes through Lua.
+*
+*               If a mapped file is truncated while it's being hashed, the
+*               kernel raises SIGBUS for the missing pages, which kills the
+*               process unless it's caught.  The callers document this.
+**************************************************************************/
+
+static int hash_fd(struct hashctx *ctx,size_t n,int fd)
+{
+  struct stat  info;
+  off_t        pos;
+  char        *buf;
+  
+  if (fstat(fd,&info) < 0)
+    return errno;
+    
+  pos = lseek(fd,0,SEEK_CUR);
+  
+  if (S_ISREG(info.st_mode) && (pos >= 0) && (pos < info.st_size))
+  {
+    off_t page  = sysconf(_SC_PAGESIZE);
+    off_t start = pos - pos % page;
+    bool  first = true;
+    
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd,pos,0,POSIX_FADV_SEQUENTIAL);
+#endif
+
+    while(start < info.st_size)
+    {
+      size_t  len = info.st_size - start < (off_t)HASH_MAPSIZE
+                  ? (size_t)(info.st_size - start)
+                  : HASH_MAPSIZE;
+      char   *map = mmap(NULL,len,PROT_READ,MAP_PRIVATE,fd,start);
+      
+      if (map == MAP_FAILED)
+      {
+        if (first)
+          goto readit; /* can't map it at all, so read it */
+        return errno;
+      }
+      
+#ifdef MADV_SEQUENTIAL
+      madvise(map,len,MADV_SEQUENTIAL);
+#endif
+      hash_update(ctx,n,map + (pos - start),len - (size_t)(pos - start));
+      munmap(map,len);
+      start += len;
+      pos    = start;
+      first  = false;
+    }
+    
+    lseek(fd,pos,SEEK_SET);
+    return 0;
+  }
+  
+readit:
+  buf = malloc(HASH_READSIZE);
+  if (buf == NULL)
+    return ENOMEM;
+    
+  while(true)
+  {
+    ssize_t bytes = read(fd,buf,HASH_READSIZE);
+    
+    if (bytes == 0)
+      break;
+    else if (bytes > 0)
+      hash_update(ctx,n,buf,bytes);
+    else if (errno != EINTR)
+    {
+      int err = errno;
+      free(buf);
+      return err;
+    }
+  }
+  
+  free(buf);
+  return 0;
+}
+
+/************************************************************************/
+
+static int hash_checkfd(lua_State *L,int idx)
+{
+  /*----------------------------------------------------------------------
+  ; For a Lua file, the kernel's file position is past whatever is sitting
+  ; in the stdio buffer.  Seeking to where we are syncs the two and drops
+  ; the buffer, so we start where the next f:read() would have.
+  ;-----------------------------------------------------------------------*/
+  
+  if (lua_touserdata(L,idx) && lua_getmetatable(L,idx))
+  {
+    luaL_getmetatable(L,LUA_FILEHANDLE);
+    if (lua_rawequal(L,-1,-2))
+    {
+#if LUA_VERSION_NUM == 501
+      FILE *fp = *(FILE **)lua_touserdata(L,idx);
+#else
+      luaL_Stream *stream = lua_touserdata(L,idx);
+      FILE        *fp     = stream->closef != NULL ? stream->f : NULL;
+#endif
+      if (fp != NULL)
+        fseek(fp,0,SEEK_CUR);
+    }
+    lua_pop(L,2);
+  }
+  
+  if (lua_isnumber(L,idx))
+    return lua_tointeger(L,idx);
+  else if (luaL_callmeta(L,idx,"_tofd"))
+    return luaL_checkinteger(L,-1);
+  else
+    return luaL_argerror(L,idx,"integer or file expected");
+}
+
+/*************************************************************************
+* Usage:        okay,err = ctx:update_fd(fd)
+* Desc:         Add the contents of a file, from the current position to
+*               the end, to the hash
+* Input:        fd (integer/userdata) file descriptor, or object with a
+*                       | _tofd() method (like a file)
+* Return:       okay (boolean) true if success, false if error
+*               err (integer) system error number
+*
+* Note:         A regular file is mapped into memory.  Don't use this on
+*               a file that might be truncated while it's hashed (say, a
+*               log file being rotated)---the process gets SIGBUS.  Read
+*               the data and use ctx:update() instead.
+**************************************************************************/
+
+static int hashlua_update_fd(lua_State *L)
+{
+  struct hashctx *ctx = luaL_checkudata(L,1,TYPE_HASH);
+  int             err = hash_fd(ctx,1,hash_checkfd(L,2));
+  
+  lua_pushboolean(L,err == 0);
+  lua_pushinteger(L,err);
+  return 2;
+}
+
+/************************************************************************/
+
+static int hashlua_final(lua_State *L)
+{
+  unsigned char hash[EVP_MAX_MD_SIZE];
+  size_t        hashsize;
+  
+  hashsize = hash_final(luaL_checkudata(L,1,TYPE_HASH),hash);
+  lua_pushlstring(L,(char *)hash,hashsize);
+  return 1;
+}
+
+/************************************************************************/
+
+static int hashlua_finalhexa(lua_State *L)
+{
+  char const *data;
+  size_t      size;
+  
+  hashlua_final(L);
+  data = lua_tolstring(L,-1,&size);
+  return hash_hexa(L,data,size);
+}
+
+/*************************************************************************
+* Usage:        hash,err = hash.sum(data[,alg[,key]])
+* Desc:         Return the hash of some data
+* Input:        data (binary) data
+*               alg (string/optional) hash algorithm (default "md5")
+*               key (integer/string/optional) see hash.new()
+* Return:       hash (binary) hash, nil if unknown algorithm
+*               err (integer/optional) system error number
+**************************************************************************/
+
+static int hashlua_sum(lua_State *L)
+{
+  struct hashctx  ctx;
+  char const     *data;
+  size_t          size;
+  unsigned char   hash[EVP_MAX_MD_SIZE];
+  size_t          hashsize;
+  
+  data = luaL_checklstring(L,1,&size);
+  if (!hash_init(L,&ctx,luaL_optstring(L,2,"md5"),3))
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,EINVAL);
+    return 2;
+  }
+  
+  hash_feed(&ctx,data,size);
+  hashsize = hash_final(&ctx,hash);
+  hash_free(&ctx);
+  lua_pushlstring(L,(char *)hash,hashsize);
+  return 1;
+}
+
+/*****************************************************************/
+
+static int hashlua_hexa(lua_State *L)
+{
+  char const *data;
+  size_t      size;
+  
+  data = luaL_checklstring(L,1,&size);
+  return hash_hexa(L,data,size);
+}
+
+/************************************************************************/
+
+static int hashlua_sumhexa(lua_State *L)
+{
+  char const *data;
+  size_t      size;
+  int         rc;
+  
+  rc = hashlua_sum(L);
+  if (!lua_isstring(L,-1))
+    return rc;
+    
+  data = lua_tolstring(L,-1,&size);
+  return hash_hexa(L,data,size);
+}
+
+/*************************************************************************
+* Usage:        hash,err = hash.file(filename[,alg[,key]])
+* Desc:         Return the hash of a file
+* Input:        filename (string) name of file
+*               alg (string/optional) hash algorithm (default "md5")
+*               key (integer/string/optional) see hash.new()
+* Return:       hash (binary) hash of the file, nil on error
+*               err (integer) system error number
+*
+* Note:         The file is mapped into memory; see ctx:update_fd() about
+*               files truncated while being hashed.
+**************************************************************************/
+
+static int hashlua_file(lua_State *L)
+{
+  char const     *filename = luaL_checkstring(L,1);
+  struct hashctx  ctx;
+  unsigned char   hash[EVP_MAX_MD_SIZE];
+  size_t          hashsize;
+  int             fd;
+  int             err;
+  
+  if (!hash_init(L,&ctx,luaL_optstring(L,2,"md5"),3))
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,EINVAL);
+    return 2;
+  }
+  
+  fd = open(filename,O_RDONLY);
+  if (fd < 0)
+  {
+    err = errno;
+    hash_free(&ctx);
+    lua_pushnil(L);
+    lua_pushinteger(L,err);
+    return 2;
+  }
+  
+  err = hash_fd(&ctx,1,fd);
+  close(fd);
+  hashsize = hash_final(&ctx,hash);
+  hash_free(&ctx);
+  
+  if (err != 0)
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,err);
+    return 2;
+  }
+  
+  lua_pushlstring(L,(char *)hash,hashsize);
+  lua_pushinteger(L,0);
+  return 2;
+}
 
-/************************************************************************/
+/*************************************************************************
+* Usage:        h = hash.xxh3(data[,seed])
+* Desc:         Return the XXH3 hash of some data as an integer
+* Input:        data (binary) data
+*               seed (integer/optional) seed (default 0)
+* Return:       h (integer) hash
+*
+* Note:         Only available for Lua 5.3 or higher.
+**************************************************************************/
 
-static int hash_hexa(
-        lua_State  *L,
-        char const *data,
-        size_t      size
-)
+#if LUA_VERSION_NUM >= 503
+static int hashlua_xxh3(lua_State *L)
 {
-  luaL_Buffer buf;
-  char        hex[3];
+  size_t       size;
+  char const  *data = luaL_checklstring(L,1,&size);
+  uint64_t     seed = (uint64_t)luaL_optinteger(L,2,0);
+  struct xxh3  state;
+  u128__s      h;
   
-  luaL_buffinit(L,&buf);
-  while(size--)
+  if (size <= XXH3_MIDSIZE)
+    h.lo = xxh3_short64((uint8_t const *)data,size,seed);
+  else
   {
-    snprintf(hex,3,"%02X",(unsigned char)*data++);
-    luaL_addlstring(&buf,hex,2);
+    xxh3_init(&state,seed);
+    xxh3_update(&state,(uint8_t const *)data,size);
+    xxh3_digest(&state,&h,false);
   }
-  luaL_pushresult(&buf);
+  
+  lua_pushinteger(L,(lua_Integer)h.lo);
   return 1;
 }
 
+/*************************************************************************
+* Usage:        h = hash.siphash(data,key)
+* Desc:         Return the SipHash-2-4 of some data as an integer
+* Input:        data (binary) data
+*               key (binary) 16 byte key
+* Return:       h (integer) hash
+*
+* Note:         Only available for Lua 5.3 or higher.
+**************************************************************************/
+
+static int hashlua_siphash(lua_State *L)
+{
+  size_t          size;
+  size_t          ksize;
+  char const     *data = luaL_checklstring(L,1,&size);
+  char const     *key  = luaL_checklstring(L,2,&ksize);
+  struct siphash  state;
+  
+  luaL_argcheck(L,ksize == 16,2,"SipHash key must be 16 bytes");
+  siphash_init(&state,(uint8_t const *)key);
+  siphash_update(&state,(uint8_t const *)data,size);
+  lua_pushinteger(L,(lua_Integer)siphash_digest(&state));
+  return 1;
+}
+#endif
+
 /************************************************************************/
 
-static int hashlua_new(lua_State *L)
+static int hashlua___tostring(lua_State *L)
+{
+  lua_pushfstring(L,"hash (%p)",lua_touserdata(L,1));
+  return 1;
+}
+
+/***********************************************************************/
+
+static int hashlua___gc(lua_State *L)
+{
+  hash_free(luaL_checkudata(L,1,TYPE_HASH));
+  return 0;
+}
+
+/**************************************************************************
+*
+*                       SEVERAL HASHES IN ONE PASS
+*
+***************************************************************************/
+
+static void multi_free(struct hashmulti *multi)
+{
+  for (size_t i = 0 ; i < multi->n ; i++)
+    hash_free(&multi->ctx[i]);
+  multi->n = 0;
+}
+
+/*************************************************************************
+* Usage:        multi = hash.multi(algs)
+* Desc:         Create a context that computes several hashes of the same
+*               data at once
+* Input:        algs (table) array of hash algorithms, like
+*                       | { "md5" , "sha1" , "sha256" }
+* Return:       multi (userdata) context, nil if an algorithm is unknown
+*                       | or needs a key
+**************************************************************************/
+
+static int hashlua_multi(lua_State *L)
 {
-  char const    *alg;
-  EVP_MD const  *m;
-  EVP_MD_CTX   **ctx;
+  struct hashmulti *multi;
+  size_t            n;
   
-  alg = luaL_optstring(L,1,"md5");
-  m   = EVP_get_digestbyname(alg);
-  if (m == NULL)
+  luaL_checktype(L,1,LUA_TTABLE);
+#if LUA_VERSION_NUM == 501
+  n = lua_objlen(L,1);
+#else
+  n = lua_rawlen(L,1);
+#endif
+  luaL_argcheck(L,(n > 0) && (n <= HASH_MAXMULTI),1,"wrong number of algorithms");
+  
+  multi    = lua_newuserdata(L,sizeof(struct hashmulti));
+  multi->n = 0;
+  luaL_getmetatable(L,TYPE_MULTI);
+  lua_setmetatable(L,-2);
+  
+  for (size_t i = 0 ; i < n ; i++)
   {
-    lua_pushnil(L);
-    return 1;
+    char const *alg;
+    
+    lua_rawgeti(L,1,i + 1);
+    alg = luaL_checkstring(L,-1);
+    if (
+            (strlen(alg) >= sizeof(multi->name[i]))
+         || !hash_init(L,&multi->ctx[i],alg,0)
+       )
+    {
+      multi_free(multi);
+      lua_pushnil(L);
+      return 1;
+    }
+    
+    multi->n++;
+    strcpy(multi->name[i],alg);
+    lua_pop(L,1);
   }
   
-  ctx  = lua_newuserdata(L,sizeof(*ctx));
-#if OPENSSL_VERSION_NUMBER < 0x1010000fL
-  *ctx = malloc(sizeof(EVP_MD_CTX));
-#else
-  *ctx = EVP_MD_CTX_new();
-#endif
+  return 1;
+}
 
-  EVP_DigestInit(*ctx,m);
-  luaL_getmetatable(L,TYPE_HASH);
-  lua_setmetatable(L,-2);
+/*************************************************************************
+* Usage:        okay = multi:update(data)
+* Desc:         Add data to all the hashes
+* Input:        data (binary) data
+* Return:       okay (boolean) true
+**************************************************************************/
+
+static int multilua_update(lua_State *L)
+{
+  struct hashmulti *multi = luaL_checkudata(L,1,TYPE_MULTI);
+  size_t            size;
+  char const       *data  = luaL_checklstring(L,2,&size);
+  
+  hash_update(multi->ctx,multi->n,data,size);
+  lua_pushboolean(L,true);
   return 1;
 }
 
-/************************************************************************/
+/*************************************************************************
+* Usage:        okay,err = multi:update_fd(fd)
+* Desc:         Add the contents of a file to all the hashes
+* Input:        fd (integer/userdata) see ctx:update_fd()
+* Return:       okay (boolean) true if success, false if error
+*               err (integer) system error number
+*
+* Note:         See ctx:update_fd() about files truncated while being
+*               hashed.
+**************************************************************************/
 
-static int hashlua_update(lua_State *L)
+static int multilua_update_fd(lua_State *L)
 {
-  EVP_MD_CTX **ctx;
-  char const  *data;
-  size_t       size;
+  struct hashmulti *multi = luaL_checkudata(L,1,TYPE_MULTI);
+  int               err   = hash_fd(multi->ctx,multi->n,hash_checkfd(L,2));
   
-  ctx  = luaL_checkudata(L,1,TYPE_HASH);
-  data = luaL_checklstring(L,2,&size);
+  lua_pushboolean(L,err == 0);
+  lua_pushinteger(L,err);
+  return 2;
+}
+
+/*************************************************************************
+* Usage:        hashes = multi:final()
+* Desc:         Return the hashes
+* Return:       hashes (table) hashes, indexed by algorithm name
+**************************************************************************/
+
+static int multilua_final(lua_State *L)
+{
+  struct hashmulti *multi = luaL_checkudata(L,1,TYPE_MULTI);
   
-  if (size > INT_MAX)
+  lua_createtable(L,0,multi->n);
+  for (size_t i = 0 ; i < multi->n ; i++)
   {
-    lua_pushboolean(L,false);
-    lua_pushinteger(L,EFBIG);
-    return 2;
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    size_t        hashsize = hash_final(&multi->ctx[i],hash);
+    
+    lua_pushlstring(L,(char *)hash,hashsize);
+    lua_setfield(L,-2,multi->name[i]);
   }
+  return 1;
+}
+
+/*************************************************************************
+* Usage:        hashes = multi:finalhexa()
+* Desc:         Return the hashes as hex strings
+* Return:       hashes (table) hashes, indexed by algorithm name
+**************************************************************************/
+
+static int multilua_finalhexa(lua_State *L)
+{
+  struct hashmulti *multi = luaL_checkudata(L,1,TYPE_MULTI);
   
-  EVP_DigestUpdate(*ctx,data,size);
-  lua_pushboolean(L,true);
+  multilua_final(L);
+  for (size_t i = 0 ; i < multi->n ; i++)
+  {
+    char const *data;
+    size_t      size;
+    
+    lua_getfield(L,-1,multi->name[i]);
+    data = lua_tolstring(L,-1,&size);
+    hash_hexa(L,data,size);
+    lua_setfield(L,-3,multi->name[i]);
+    lua_pop(L,1);
+  }
   return 1;
 }
 
 /************************************************************************/
 
-static int hashlua_final(lua_State *L)
+static int multilua___tostring(lua_State *L)
 {
-  EVP_MD_CTX    **ctx;
-  unsigned char   hash[EVP_MAX_MD_SIZE];
-  unsigned int    hashsize;
-  
-  ctx      = luaL_checkudata(L,1,TYPE_HASH);
-  hashsize = sizeof(hash);
-  
-  EVP_DigestFinal(*ctx,hash,&hashsize);
-  lua_pushlstring(L,(char *)hash,hashsize);
+  lua_pushfstring(L,"hash:multi (%p)",lua_touserdata(L,1));
   return 1;
 }
 
 /************************************************************************/
 
-static int hashlua_finalhexa(lua_State *L)
+static int multilua___gc(lua_State *L)
 {
-  char const *data;
-  size_t      size;
+  multi_free(luaL_checkudata(L,1,TYPE_MULTI));
+  return 0;
+}
+
+/**************************************************************************
+*
+*                     KEYED HASHES AND KEY DERIVATION
+*
+***************************************************************************/
+
+static void hmac_free(struct hmackey *hk)
+{
+  hash_evpfree(hk->inner);
+  hash_evpfree(hk->outer);
+  hash_evpfree(hk->work);
+  hk->inner = NULL;
+  hk->outer = NULL;
+  hk->work  = NULL;
+}
+
+/*************************************************************************
+* Usage:        err = hmac_init(hk,m,key,keysize)
+* Desc:         Set up the inner and outer hashes for HMAC (RFC-2104) with
+*               the padded key already hashed, so each message only costs
+*               copying the two contexts.
+* Input:        hk (struct hmackey *) HMAC key
+*               m (EVP_MD const *) hash algorithm
+*               key (void const *) key
+*               keysize (size_t) size of key
+* Return:       err (int) 0 if okay, ENOMEM if out of memory, EINVAL if
+*                       the algorithm's block size isn't supported
+**************************************************************************/
+
+static int hmac_init(
+        struct hmackey *hk,
+        EVP_MD const   *m,
+        void const     *key,
+        size_t          keysize
+)
+{
+  unsigned char pad[HMAC_MAXBLOCK];
+  unsigned char hkey[EVP_MAX_MD_SIZE];
+  int           block = EVP_MD_block_size(m);
   
-  hashlua_final(L);
-  data = lua_tolstring(L,-1,&size);
-  return hash_hexa(L,data,size);
+  hk->inner = NULL;
+  hk->outer = NULL;
+  hk->work  = NULL;
+  
+  if ((block <= 0) || ((size_t)block > sizeof(pad)) || (EVP_MD_size(m) <= 0))
+    return EINVAL;
+    
+  hk->size  = EVP_MD_size(m);
+  hk->inner = hash_evpnew();
+  hk->outer = hash_evpnew();
+  hk->work  = hash_evpnew();
+  
+  if ((hk->inner == NULL) || (hk->outer == NULL) || (hk->work == NULL))
+  {
+    hmac_free(hk);
+    return ENOMEM;
+  }
+  
+  if (keysize > (size_t)block)
+  {
+    unsigned int hsize = sizeof(hkey);
+    
+    EVP_DigestInit(hk->work,m);
+    EVP_DigestUpdate(hk->work,key,keysize);
+    EVP_DigestFinal(hk->work,hkey,&hsize);
+    key     = hkey;
+    keysize = hsize;
+  }
+  
+  memset(pad,0,block);
+  memcpy(pad,key,keysize);
+  for (int i = 0 ; i < block ; i++)
+    pad[i] ^= 0x36;
+  EVP_DigestInit(hk->inner,m);
+  EVP_DigestUpdate(hk->inner,pad,block);
+  
+  for (int i = 0 ; i < block ; i++)
+    pad[i] ^= 0x36 ^ 0x5C;
+  EVP_DigestInit(hk->outer,m);
+  EVP_DigestUpdate(hk->outer,pad,block);
+  
+  OPENSSL_cleanse(pad,sizeof(pad));
+  OPENSSL_cleanse(hkey,sizeof(hkey));
+  return 0;
 }
 
-/************************************************************************/
+/*************************************************************************
+* Usage:        hmac_start(hk);
+*               EVP_DigestUpdate(hk->work,data,size); ...
+*               size = hmac_finish(hk,mac);
+* Desc:         Compute an HMAC using the work context of the key
+**************************************************************************/
 
-static int hashlua_sum(lua_State *L)
+static inline void hmac_start(struct hmackey *hk)
+{
+  EVP_MD_CTX_copy_ex(hk->work,hk->inner);
+}
+
+static size_t hmac_finish(struct hmackey *hk,unsigned char *mac)
 {
-  EVP_MD const  *m;
-  EVP_MD_CTX    *ctx;
-  char const    *data;
-  size_t         size;
-  char const    *alg;
-  unsigned char  hash[EVP_MAX_MD_SIZE];
-  unsigned int   hashsize;
+  unsigned int size = EVP_MAX_MD_SIZE;
   
-  data = luaL_checklstring(L,1,&size);
+  EVP_DigestFinal_ex(hk->work,mac,&size);
+  EVP_MD_CTX_copy_ex(hk->work,hk->outer);
+  EVP_DigestUpdate(hk->work,mac,size);
+  EVP_DigestFinal_ex(hk->work,mac,&size);
+  return size;
+}
+
+/*************************************************************************
+* Usage:        key,err = hash.hmac(alg,secret)
+* Desc:         Create a key for computing HMACs
+* Input:        alg (string) hash algorithm (OpenSSL digests only)
+*               secret (binary) key
+* Return:       key (userdata) HMAC key, nil if unknown or unsupported
+*                       | algorithm
+*               err (integer/optional) system error number
+*
+* Note:         The key can be used for any number of messages, either all
+*               at once with key:sum() or key:verify(), or a piece at a time
+*               with a hash context from key:new().
+**************************************************************************/
+
+static int hashlua_hmac(lua_State *L)
+{
+  EVP_MD const   *m = EVP_get_digestbyname(luaL_checkstring(L,1));
+  size_t          keysize;
+  char const     *key = luaL_checklstring(L,2,&keysize);
+  struct hmackey *hk;
+  int             err;
   
-  if (size > INT_MAX)
+  if (m == NULL)
   {
     lua_pushnil(L);
-    lua_pushinteger(L,EFBIG);
+    lua_pushinteger(L,EINVAL);
     return 2;
   }
   
-  alg  = luaL_optstring(L,2,"md5");
-  m    = EVP_get_digestbyname(alg);
-  if (m == NULL)
+  hk  = lua_newuserdata(L,sizeof(struct hmackey));
+  err = hmac_init(hk,m,key,keysize);
+  if (err == ENOMEM)
+    return luaL_error(L,"out of memory");
+  else if (err != 0)
   {
     lua_pushnil(L);
-    lua_pushinteger(L,EINVAL);
+    lua_pushinteger(L,err);
     return 2;
   }
   
-#if OPENSSL_VERSION_NUMBER < 0x1010000fL
-  ctx = malloc(sizeof(EVP_MD_CTX));
-#else
-  ctx = EVP_MD_CTX_new();
-#endif
+  luaL_getmetatable(L,TYPE_HMAC);
+  lua_setmetatable(L,-2);
+  return 1;
+}
 
-  hashsize = sizeof(hash);
-  EVP_DigestInit(ctx,m);
-  EVP_DigestUpdate(ctx,data,size);
-  EVP_DigestFinal(ctx,hash,&hashsize);
-  
-#if OPENSSL_VERSION_NUMBER < 0x1010000fL
-  free(ctx);
-#else
-  EVP_MD_CTX_free(ctx);
-#endif
+/*************************************************************************
+* Usage:        ctx = key:new()
+* Desc:         Create a hash context to compute an HMAC a piece at a time
+* Return:       ctx (userdata) hash context (see hash.new())
+**************************************************************************/
 
-  lua_pushlstring(L,(char *)hash,hashsize);
+static int hmaclua_new(lua_State *L)
+{
+  struct hmackey *hk  = luaL_checkudata(L,1,TYPE_HMAC);
+  struct hashctx *ctx = lua_newuserdata(L,sizeof(struct hashctx));
+  
+  ctx->type  = HASH_HMAC;
+  ctx->evp   = hash_evpnew();
+  ctx->outer = hash_evpnew();
+  luaL_getmetatable(L,TYPE_HASH);
+  lua_setmetatable(L,-2);
+  
+  if ((ctx->evp == NULL) || (ctx->outer == NULL))
+    return luaL_error(L,"out of memory");
+    
+  EVP_MD_CTX_copy_ex(ctx->evp,hk->inner);
+  EVP_MD_CTX_copy_ex(ctx->outer,hk->outer);
   return 1;
 }
 
-/*****************************************************************/
+/*************************************************************************
+* Usage:        mac = key:sum(data)
+* Desc:         Return the HMAC of some data
+* Input:        data (binary) data
+* Return:       mac (binary) HMAC
+**************************************************************************/
 
-static int hashlua_hexa(lua_State *L)
+static int hmaclua_sum(lua_State *L)
 {
-  char const *data;
-  size_t      size;
+  struct hmackey *hk = luaL_checkudata(L,1,TYPE_HMAC);
+  size_t          size;
+  char const     *data = luaL_checklstring(L,2,&size);
+  unsigned char   mac[EVP_MAX_MD_SIZE];
   
-  data = luaL_checklstring(L,1,&size);
-  return hash_hexa(L,data,size);
+  hmac_start(hk);
+  EVP_DigestUpdate(hk->work,data,size);
+  size = hmac_finish(hk,mac);
+  lua_pushlstring(L,(char *)mac,size);
+  return 1;
 }
 
 /************************************************************************/
 
-static int hashlua_sumhexa(lua_State *L)
+static int hmaclua_sumhexa(lua_State *L)
 {
   char const *data;
   size_t      size;
-  int         rc;
   
-  rc = hashlua_sum(L);
-  if (!lua_isstring(L,-1))
-    return rc;
-    
+  hmaclua_sum(L);
   data = lua_tolstring(L,-1,&size);
   return hash_hexa(L,data,size);
 }
 
+/*************************************************************************
+* Usage:        okay = key:verify(data,mac)
+* Desc:         Check the HMAC of some data, in constant time
+* Input:        data (binary) data
+*               mac (binary) expected HMAC
+* Return:       okay (boolean) true if the HMAC matches
+**************************************************************************/
+
+static int hmaclua_verify(lua_State *L)
+{
+  struct hmackey *hk = luaL_checkudata(L,1,TYPE_HMAC);
+  size_t          size;
+  char const     *data = luaL_checklstring(L,2,&size);
+  size_t          expsize;
+  char const     *expected = luaL_checklstring(L,3,&expsize);
+  unsigned char   mac[EVP_MAX_MD_SIZE];
+  
+  hmac_start(hk);
+  EVP_DigestUpdate(hk->work,data,size);
+  size = hmac_finish(hk,mac);
+  lua_pushboolean(L,(size == expsize) && (CRYPTO_memcmp(mac,expected,size) == 0));
+  return 1;
+}
+
 /************************************************************************/
 
-static int hashlua___tostring(lua_State *L)
+static int hmaclua___tostring(lua_State *L)
 {
-  lua_pushfstring(L,"hash (%p)",lua_touserdata(L,1));
+  lua_pushfstring(L,"hash:hmac (%p)",lua_touserdata(L,1));
   return 1;
 }
 
-/***********************************************************************/
+/************************************************************************/
 
-static int hashlua___gc(lua_State *L)
+static int hmaclua___gc(lua_State *L)
+{
+  hmac_free(luaL_checkudata(L,1,TYPE_HMAC));
+  return 0;
+}
+
+/*************************************************************************
+* Usage:        dk,err = hash.pbkdf2(password,salt,iterations,size[,alg])
+* Desc:         Derive a key from a password with PBKDF2 (RFC-8018)
+* Input:        password (binary) password
+*               salt (binary) salt
+*               iterations (integer) iteration count
+*               size (integer) size of key to return
+*               alg (string/optional) hash algorithm (default "sha256")
+* Return:       dk (binary) derived key, nil on error
+*               err (integer/optional) system error number
+**************************************************************************/
+
+static int hashlua_pbkdf2(lua_State *L)
 {
-  EVP_MD_CTX **ctx = luaL_checkudata(L,1,TYPE_HASH);
-  if (*ctx != NULL)
+  size_t         passsize;
+  size_t         saltsize;
+  char const    *pass  = luaL_checklstring(L,1,&passsize);
+  char const    *salt  = luaL_checklstring(L,2,&saltsize);
+  lua_Integer    iter  = luaL_checkinteger(L,3);
+  lua_Integer    size  = luaL_checkinteger(L,4);
+  EVP_MD const  *m     = EVP_get_digestbyname(luaL_optstring(L,5,"sha256"));
+  unsigned char *dk;
+  
+  luaL_argcheck(L,(iter > 0) && (iter <= INT_MAX),3,"bad iteration count");
+  luaL_argcheck(L,(size > 0) && (size <= INT_MAX),4,"bad key size");
+  
+  if ((m == NULL) || (passsize > INT_MAX) || (saltsize > INT_MAX))
   {
-#if OPENSSL_VERSION_NUMBER < 0x1010000fL
-    free(*ctx);
-#else
-    EVP_MD_CTX_free(*ctx);
-#endif
-    *ctx = NULL;
+    lua_pushnil(L);
+    lua_pushinteger(L,EINVAL);
+    return 2;
   }
   
-  return 0;
+  dk = lua_newuserdata(L,size);
+  if (PKCS5_PBKDF2_HMAC(pass,passsize,(unsigned char const *)salt,saltsize,iter,m,size,dk) != 1)
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,EINVAL);
+    return 2;
+  }
+  
+  lua_pushlstring(L,(char *)dk,size);
+  OPENSSL_cleanse(dk,size);
+  return 1;
+}
+
+/*************************************************************************
+* Usage:        okm,err = hash.hkdf(ikm,size[,salt[,info[,alg]]])
+* Desc:         Derive a key with HKDF (RFC-5869)
+* Input:        ikm (binary) input keying material
+*               size (integer) size of key to return, up to 255 times the
+*                       | hash size
+*               salt (binary/optional) salt (default none)
+*               info (binary/optional) context information (default none)
+*               alg (string/optional) hash algorithm (default "sha256")
+* Return:       okm (binary) derived key, nil on error
+*               err (integer/optional) system error number
+**************************************************************************/
+
+static int hashlua_hkdf(lua_State *L)
+{
+  size_t          ikmsize;
+  size_t          saltsize;
+  size_t          infosize;
+  char const     *ikm  = luaL_checklstring(L,1,&ikmsize);
+  lua_Integer     size = luaL_checkinteger(L,2);
+  char const     *salt = luaL_optlstring(L,3,"",&saltsize);
+  char const     *info = luaL_optlstring(L,4,"",&infosize);
+  EVP_MD const   *m    = EVP_get_digestbyname(luaL_optstring(L,5,"sha256"));
+  struct hmackey  hk;
+  unsigned char   prk[EVP_MAX_MD_SIZE];
+  unsigned char   t[EVP_MAX_MD_SIZE];
+  size_t          tsize;
+  unsigned char  *okm;
+  int             err;
+  
+  if (m == NULL)
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,EINVAL);
+    return 2;
+  }
+  
+  luaL_argcheck(L,(size > 0) && (size <= 255 * EVP_MD_size(m)),2,"bad key size");
+  okm = lua_newuserdata(L,size);
+  
+  /*-----------------------------------------------------------------
+  ; Extract: PRK = HMAC(salt,IKM).  An empty salt is the same as a salt
+  ; of zeros the size of the hash, as both are padded to the block size.
+  ;------------------------------------------------------------------*/
+  
+  if ((err = hmac_init(&hk,m,salt,saltsize)) != 0)
+  {
+    if (err == ENOMEM)
+      return luaL_error(L,"out of memory");
+    lua_pushnil(L);
+    lua_pushinteger(L,err);
+    return 2;
+  }
+  
+  hmac_start(&hk);
+  EVP_DigestUpdate(hk.work,ikm,ikmsize);
+  tsize = hmac_finish(&hk,prk);
+  hmac_free(&hk);
+  
+  /*-----------------------------------------------------------------
+  ; Expand: T(i) = HMAC(PRK,T(i-1) | info | i)
+  ;------------------------------------------------------------------*/
+  
+  if (hmac_init(&hk,m,prk,tsize) != 0)
+  {
+    OPENSSL_cleanse(prk,sizeof(prk));
+    return luaL_error(L,"out of memory");
+  }
+  
+  tsize = 0;
+  for (lua_Integer done = 0 , i = 1 ; done < size ; i++)
+  {
+    unsigned char n = i;
+    size_t        len;
+    
+    hmac_start(&hk);
+    EVP_DigestUpdate(hk.work,t,tsize);
+    EVP_DigestUpdate(hk.work,info,infosize);
+    EVP_DigestUpdate(hk.work,&n,1);
+    tsize = hmac_finish(&hk,t);
+    len   = (size_t)(size - done) < tsize ? (size_t)(size - done) : tsize;
+    memcpy(okm + done,t,len);
+    done += len;
+  }
+  
+  hmac_free(&hk);
+  lua_pushlstring(L,(char *)okm,size);
+  OPENSSL_cleanse(okm,size);
+  OPENSSL_cleanse(prk,sizeof(prk));
+  OPENSSL_cleanse(t,sizeof(t));
+  return 1;
 }
 
 /***********************************************************************/
@@ -258,12 +1983,22 @@ int luaopen_org_conman_hash(lua_State *L)
     { "sum"     , hashlua_sum     } ,
     { "hexa"    , hashlua_hexa    } ,
     { "sumhexa" , hashlua_sumhexa } ,
+    { "file"    , hashlua_file    } ,
+    { "multi"   , hashlua_multi   } ,
+    { "hmac"    , hashlua_hmac    } ,
+    { "pbkdf2"  , hashlua_pbkdf2  } ,
+    { "hkdf"    , hashlua_hkdf    } ,
+#if LUA_VERSION_NUM >= 503
+    { "xxh3"    , hashlua_xxh3    } ,
+    { "siphash" , hashlua_siphash } ,
+#endif
     { NULL      , NULL            }
   };
   
   static struct luaL_Reg const hashlua_meta[] =
   {
     { "update"     , hashlua_update     } ,
+    { "update_fd"  , hashlua_update_fd  } ,
     { "final"      , hashlua_final      } ,
     { "finalhexa"  , hashlua_finalhexa  } ,
     { "__tostring" , hashlua___tostring } ,
@@ -274,8 +2009,58 @@ int luaopen_org_conman_hash(lua_State *L)
     { NULL         , NULL               }
   };
   
+  static struct luaL_Reg const multilua_meta[] =
+  {
+    { "update"     , multilua_update     } ,
+    { "update_fd"  , multilua_update_fd  } ,
+    { "final"      , multilua_final      } ,
+    { "finalhexa"  , multilua_finalhexa  } ,
+    { "__tostring" , multilua___tostring } ,
+    { "__gc"       , multilua___gc       } ,
+  #if LUA_VERSION_NUM >= 504
+    { "__close"    , multilua___gc       } ,
+  #endif
+    { NULL         , NULL                }
+  };
+  
+  static struct luaL_Reg const hmaclua_meta[] =
+  {
+    { "new"        , hmaclua_new        } ,
+    { "sum"        , hmaclua_sum        } ,
+    { "sumhexa"    , hmaclua_sumhexa    } ,
+    { "verify"     , hmaclua_verify     } ,
+    { "__tostring" , hmaclua___tostring } ,
+    { "__gc"       , hmaclua___gc       } ,
+  #if LUA_VERSION_NUM >= 504
+    { "__close"    , hmaclua___gc       } ,
+  #endif
+    { NULL         , NULL               }
+  };
+  
   OpenSSL_add_all_digests();
   
+  luaL_newmetatable(L,TYPE_HMAC);
+#if LUA_VERSION_NUM == 501
+  luaL_register(L,NULL,hmaclua_meta);
+#else
+  luaL_setfuncs(L,hmaclua_meta,0);
+#endif
+
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  lua_pop(L,1);
+  
+  luaL_newmetatable(L,TYPE_MULTI);
+#if LUA_VERSION_NUM == 501
+  luaL_register(L,NULL,multilua_meta);
+#else
+  luaL_setfuncs(L,multilua_meta,0);
+#endif
+
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  lua_pop(L,1);
+  
   luaL_newmetatable(L,TYPE_HASH);
 #if LUA_VERSION_NUM == 501
   luaL_register(L,NULL,hashlua_meta);
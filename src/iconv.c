@@ -45,98 +45,762 @@
         y     = trans(x)                -- string now in UTF-8
         print(y)
         
+*
+* Data that arrives in pieces can be converted as a stream.  A sequence
+* split between two pieces is held by the converter until the rest shows
+* up, and trans:finish() ends the stream.  For example, to convert a
+* request body read from an org.conman.net.ios object on the fly:
+
+        trans = iconv("utf-8","utf-16le")
+        body  = mkios()
+        body._refill = function()
+          if done then return nil end
+          local data = ios:read(8192)
+          local out,err
+          if data then
+            out,err = trans:update(data)
+          else
+            done    = true
+            out,err = trans:finish()
+          end
+          if not out then return nil,"bad encoding",err end
+          return out
+        end
+        
+*
+* Conversions between UTF-8 and ISO-8859-1, UTF-16LE or UTF-16BE are done
+* directly, without iconv(), but give the same results (and errors) as
+* glibc---including dropping language tag characters (U+E0000 to U+E007F)
+* when converting to ISO-8859-1.
 *
 *********************************************************************/
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <errno.h>
 
 #include <iconv.h>
+#include <pthread.h>
 
 #include <lua.h>
 #include <lauxlib.h>
 
+#include "ascii.h"
+
 #if !defined(LUA_VERSION_NUM) || LUA_VERSION_NUM < 501
 #  error You need to compile against Lua 5.1 or higher
 #endif
 
 #define TYPE_ICONV      "org.conman.iconv:iconv"
+#define ICONV_MAXCACHE  16
+#define ICONV_KEYSIZE   64
+#define ICONV_MAXPEND   16
 
-/**************************************************************************/
+enum
+{
+  NATIVE_NONE,
+  NATIVE_UTF8_LATIN1,
+  NATIVE_LATIN1_UTF8,
+  NATIVE_UTF8_UTF16LE,
+  NATIVE_UTF8_UTF16BE,
+  NATIVE_UTF16LE_UTF8,
+  NATIVE_UTF16BE_UTF8
+};
 
-static int luaiconv_open(lua_State *L)
+typedef struct
 {
-  char const *fromcode;
-  char const *tocode;
-  iconv_t    *pic;
-  iconv_t     ic;
+  iconv_t ic;
+  int     native;
+  size_t  pos;
+  size_t  npend;
+  char    pend[ICONV_MAXPEND];
+  char    key [ICONV_KEYSIZE];
+} iconv__s;
+
+/*------------------------------------------------------------------------
+; Converters no longer in use are kept here (with their state reset) so
+; opening the same conversion again doesn't have to go through
+; iconv_open().  Like the signal handlers in org.conman.signal, this is
+; per-process, not per Lua state, so it's locked against Lua states in
+; other threads.
+;-------------------------------------------------------------------------*/
+
+static struct
+{
+  iconv_t ic;
+  char    key[ICONV_KEYSIZE];
+} m_cache[ICONV_MAXCACHE];
+
+static size_t          m_ncache;
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**************************************************************************
+*
+*                       NATIVE CONVERSIONS
+*
+***************************************************************************/
+
+/*************************************************************************
+* Usage:        name = iconv_charset(code)
+* Desc:         Reduce a character set name to one of the few handled
+*               natively
+* Input:        code (char const *) character set name
+* Return:       name (char const *) one of "UTF8", "LATIN1", "UTF16LE",
+*                       | "UTF16BE" or NULL
+**************************************************************************/
+
+static char const *iconv_charset(char const *code)
+{
+  static char const *const names[][2] =
+  {
+    { "UTF8"     , "UTF8"    } ,
+    { "ISO88591" , "LATIN1"  } ,
+    { "LATIN1"   , "LATIN1"  } ,
+    { "UTF16LE"  , "UTF16LE" } ,
+    { "UTF16BE"  , "UTF16BE" } ,
+  };
   
-  tocode   = luaL_checkstring(L,1);
-  fromcode = luaL_checkstring(L,2);
-  ic       = iconv_open(tocode,fromcode);
+  char   name[16];
+  size_t len = 0;
   
-  if (ic == (iconv_t)-1)
+  for ( ; *code != '\0' ; code++)
   {
-    lua_pushnil(L);
-    lua_pushinteger(L,errno);
-    lua_pushfstring(L,"%s:%s",tocode,fromcode);
+    if ((*code == '-') || (*code == '_'))
+      continue;
+    if (len == sizeof(name) - 1)
+      return NULL;
+    name[len++] = toupper((unsigned char)*code);
+  }
+  name[len] = '\0';
+  
+  for (size_t i = 0 ; i < sizeof(names) / sizeof(names[0]) ; i++)
+    if (strcmp(name,names[i][0]) == 0)
+      return names[i][1];
+  return NULL;
+}
+
+/************************************************************************/
+
+static int iconv_native(char const *tocode,char const *fromcode)
+{
+  static struct
+  {
+    char const *to;
+    char const *from;
+    int         native;
+  } const convs[] =
+  {
+    { "LATIN1"  , "UTF8"    , NATIVE_UTF8_LATIN1  } ,
+    { "UTF8"    , "LATIN1"  , NATIVE_LATIN1_UTF8  } ,
+    { "UTF16LE" , "UTF8"    , NATIVE_UTF8_UTF16LE } ,
+    { "UTF16BE" , "UTF8"    , NATIVE_UTF8_UTF16BE } ,
+    { "UTF8"    , "UTF16LE" , NATIVE_UTF16LE_UTF8 } ,
+    { "UTF8"    , "UTF16BE" , NATIVE_UTF16BE_UTF8 } ,
+  };
+  
+  char const *to   = iconv_charset(tocode);
+  char const *from = iconv_charset(fromcode);
+  
+  if ((to == NULL) || (from == NULL))
+    return NATIVE_NONE;
+    
+  for (size_t i = 0 ; i < sizeof(convs) / sizeof(convs[0]) ; i++)
+    if ((strcmp(to,convs[i].to) == 0) && (strcmp(from,convs[i].from) == 0))
+      return convs[i].native;
+  return NATIVE_NONE;
+}
+
+/*************************************************************************
+* Usage:        len = utf8_decode(p,n,&c)
+* Desc:         Decode a UTF-8 sequence
+* Input:        p (uint8_t const *) input
+*               n (size_t) bytes of input (at least 1)
+*               c (uint32_t *) code point
+* Return:       len (int) length of sequence, 0 if incomplete, -1 if invalid
+*
+* Note:         Overlong forms, surrogates and values past U+10FFFF are
+*               invalid.  But, as with glibc, a sequence cut short by the
+*               end of input is incomplete if what there is of it looks
+*               right, going by the length the lead byte gives.
+**************************************************************************/
+
+static int utf8_decode(uint8_t const *p,size_t n,uint32_t *c)
+{
+  uint8_t lo = 0x80;
+  uint8_t hi = 0xBF;
+  size_t  len;
+  
+  if (p[0] < 0x80)
+  {
+    *c = p[0];
+    return 1;
+  }
+  
+  if ((p[0] < 0xC2) || (p[0] > 0xFD))
+    return -1;
+    
+  len = p[0] < 0xE0 ? 2
+      : p[0] < 0xF0 ? 3
+      : p[0] < 0xF8 ? 4
+      : p[0] < 0xFC ? 5
+      :               6
+      ;
+      
+  if (n < len)
+  {
+    for (size_t i = 1 ; i < n ; i++)
+      if ((p[i] & 0xC0) != 0x80)
+        return -1;
+    return 0;
+  }
+  
+  switch(p[0])
+  {
+    case 0xE0: lo = 0xA0; break;
+    case 0xED: hi = 0x9F; break;
+    case 0xF0: lo = 0x90; break;
+    case 0xF4: hi = 0x8F; break;
+    default:   if (p[0] > 0xF4) return -1; break;
+  }
+  
+  *c = p[0] & (0x7F >> len);
+  for (size_t i = 1 ; i < len ; i++)
+  {
+    if ((p[i] < lo) || (p[i] > hi))
+      return -1;
+    *c = (*c << 6) | (p[i] & 0x3F);
+    lo = 0x80;
+    hi = 0xBF;
+  }
+  
+  return len;
+}
+
+/************************************************************************/
+
+static size_t utf8_encode(uint8_t *p,uint32_t c)
+{
+  if (c < 0x80)
+  {
+    p[0] = c;
+    return 1;
+  }
+  else if (c < 0x800)
+  {
+    p[0] = 0xC0 | (c >> 6);
+    p[1] = 0x80 | (c & 0x3F);
+    return 2;
+  }
+  else if (c < 0x10000)
+  {
+    p[0] = 0xE0 | (c >> 12);
+    p[1] = 0x80 | ((c >> 6) & 0x3F);
+    p[2] = 0x80 | (c & 0x3F);
     return 3;
   }
+  else
+  {
+    p[0] = 0xF0 | (c >> 18);
+    p[1] = 0x80 | ((c >> 12) & 0x3F);
+    p[2] = 0x80 | ((c >> 6) & 0x3F);
+    p[3] = 0x80 | (c & 0x3F);
+    return 4;
+  }
+}
+
+/************************************************************************/
+
+static inline void utf16_put(uint8_t *p,uint32_t u,bool be)
+{
+  p[ be] = u & 0xFF;
+  p[!be] = u >> 8;
+}
+
+static inline uint32_t utf16_get(uint8_t const *p,bool be)
+{
+  return (uint32_t)p[!be] << 8 | p[be];
+}
+
+/*************************************************************************
+* Usage:        err = native_run(native,src,n,out,&i,&o)
+* Desc:         Do one of the conversions handled without iconv().  The
+*               results are the same as from iconv(), including the errors
+*               for bad or incomplete input.
+* Input:        native (int) conversion
+*               src (uint8_t const *) input
+*               n (size_t) size of input
+*               out (uint8_t *) output, native_size() bytes
+*               i (size_t *) input consumed
+*               o (size_t *) output produced
+* Return:       err (int) 0 if okay, EINVAL if incomplete input, EILSEQ if
+*                       | bad input
+**************************************************************************/
+
+static size_t native_size(int native,size_t n)
+{
+  switch(native)
+  {
+    case NATIVE_UTF8_LATIN1:  return n;
+    case NATIVE_UTF16LE_UTF8:
+    case NATIVE_UTF16BE_UTF8: return n / 2 * 3;
+    default:                  return n * 2;
+  }
+}
+
+static int native_run(
+        int            native,
+        uint8_t const *src,
+        size_t         n,
+        uint8_t       *out,
+        size_t        *pi,
+        size_t        *po
+)
+{
+  size_t    o   = 0;
+  size_t    i   = 0;
+  int       err = 0;
+  bool      be;
+  uint32_t  c;
+  int       rc;
   
-  pic  = lua_newuserdata(L,sizeof(iconv_t));
-  *pic = ic;
+  switch(native)
+  {
+    case NATIVE_LATIN1_UTF8:
+         while(i < n)
+         {
+           size_t run = ascii_span(src + i,n - i);
+           
+           memcpy(out + o,src + i,run);
+           i += run;
+           o += run;
+           for ( ; (i < n) && (src[i] >= 0x80) ; i++ , o += 2)
+           {
+             out[o]     = 0xC0 | (src[i] >> 6);
+             out[o + 1] = 0x80 | (src[i] & 0x3F);
+           }
+         }
+         break;
+         
+    case NATIVE_UTF8_LATIN1:
+         while(i < n)
+         {
+           size_t run = ascii_span(src + i,n - i);
+           
+           memcpy(out + o,src + i,run);
+           i += run;
+           o += run;
+           if (i == n)
+             break;
+             
+           rc = utf8_decode(src + i,n - i,&c);
+           if (rc == 0)
+           {
+             err = EINVAL;
+             break;
+           }
+           
+           /*------------------------------------------------------------
+           ; glibc drops the language tag characters (U+E0000 to U+E007F)
+           ; when converting to a character set without them, so they're
+           ; dropped here too.
+           ;-------------------------------------------------------------*/
+           
+           if ((rc > 0) && ((c >> 7) == (0xE0000 >> 7)))
+           {
+             i += rc;
+             continue;
+           }
+           
+           if ((rc < 0) || (c > 0xFF))
+           {
+             err = EILSEQ;
+             break;
+           }
+           out[o++] = c;
+           i       += rc;
+         }
+         break;
+         
+    case NATIVE_UTF8_UTF16LE:
+    case NATIVE_UTF8_UTF16BE:
+         be = native == NATIVE_UTF8_UTF16BE;
+         while(i < n)
+         {
+           size_t run = ascii_span(src + i,n - i);
+           
+           for (size_t j = 0 ; j < run ; j++ , o += 2)
+             utf16_put(out + o,src[i + j],be);
+           i += run;
+           if (i == n)
+             break;
+             
+           rc = utf8_decode(src + i,n - i,&c);
+           if (rc <= 0)
+           {
+             err = rc == 0 ? EINVAL : EILSEQ;
+             break;
+           }
+           
+           if (c < 0x10000)
+           {
+             utf16_put(out + o,c,be);
+             o += 2;
+           }
+           else
+           {
+             c -= 0x10000;
+             utf16_put(out + o,    0xD800 | (c >> 10),  be);
+             utf16_put(out + o + 2,0xDC00 | (c & 0x3FF),be);
+             o += 4;
+           }
+           i += rc;
+         }
+         break;
+         
+    case NATIVE_UTF16LE_UTF8:
+    case NATIVE_UTF16BE_UTF8:
+         be = native == NATIVE_UTF16BE_UTF8;
+         for ( ; i + 2 <= n ; i += 2)
+         {
+           c = utf16_get(src + i,be);
+           if ((c >= 0xD800) && (c < 0xE000))
+           {
+             uint32_t c2;
+             
+             if (c >= 0xDC00)
+             {
+               err = EILSEQ;
+               break;
+             }
+             if (i + 4 > n)
+             {
+               err = EINVAL;
+               break;
+             }
+             c2 = utf16_get(src + i + 2,be);
+             if ((c2 < 0xDC00) || (c2 >= 0xE000))
+             {
+               err = EILSEQ;
+               break;
+             }
+             c  = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+             i += 2;
+           }
+           o += utf8_encode(out + o,c);
+         }
+         if ((err == 0) && (i < n))
+           err = EINVAL;
+         break;
+         
+    default:
+         assert(0);
+         break;
+  }
   
-  luaL_getmetatable(L,TYPE_ICONV);
-  lua_setmetatable(L,-2);
-  lua_pushinteger(L,0);
-  return 2;
+  *pi = i;
+  *po = o;
+  return err;
 }
 
-/*************************************************************************/
+/**************************************************************************
+*
+*                       CONVERTER OBJECTS
+*
+***************************************************************************/
 
-static int luametaiconv___call(lua_State *L)
+/*************************************************************************
+* Usage:        err = iconv_run(L,pic,src,n,&i,&o)
+* Desc:         Convert data into a buffer left on the Lua stack
+* Input:        L (lua_State *) Lua state
+*               pic (iconv__s *) converter
+*               src (char const *) input
+*               n (size_t) size of input
+*               i (size_t *) input consumed
+*               o (size_t *) output produced
+* Return:       err (int) 0 if okay, else system error number
+*
+* Note:         The output buffer is a userdata on the top of the stack.
+*               For iconv(), it's big enough for most conversions to start
+*               with, and doubled as needed.
+**************************************************************************/
+
+static int iconv_run(
+        lua_State  *L,
+        iconv__s   *pic,
+        char const *src,
+        size_t      n,
+        size_t     *pi,
+        size_t     *po
+)
 {
-  char const *from;
-  char const *ofrom;
-  size_t      fsize;
-  iconv_t    *pic;
-  char        to[LUAL_BUFFERSIZE];
+  char const *from  = src;
+  size_t      fsize = n;
+  size_t      tmax;
   size_t      tsize;
+  char       *to;
   char       *pto;
-  luaL_Buffer buf;
+  int         err   = 0;
   
-  pic   = luaL_checkudata(L,1,TYPE_ICONV);
-  from  = luaL_checklstring(L,2,&fsize);
-  tsize = sizeof(to);
-  pto   = to;
-  ofrom = from;
+  if (pic->native != NATIVE_NONE)
+  {
+    to = lua_newuserdata(L,native_size(pic->native,n));
+    return native_run(pic->native,(uint8_t const *)src,n,(uint8_t *)to,pi,po);
+  }
   
-  luaL_buffinit(L,&buf);
+  tmax  = n + n / 2 + 16;
+  to    = lua_newuserdata(L,tmax);
+  tsize = tmax;
+  pto   = to;
   
   while(fsize > 0)
   {
-    if (iconv(*pic,(char **)&from,&fsize,&pto,&tsize) == (size_t)-1)
+    if (iconv(pic->ic,(char **)&from,&fsize,&pto,&tsize) == (size_t)-1)
     {
       if (errno == E2BIG)
       {
-        luaL_addlstring(&buf,to,sizeof(to) - tsize);
-        pto   = to;
-        tsize = sizeof(to);
+        size_t  used = tmax - tsize;
+        char   *nto  = lua_newuserdata(L,tmax * 2);
+        
+        memcpy(nto,to,used);
+        lua_replace(L,-2);
+        to    = nto;
+        tmax *= 2;
+        pto   = to + used;
+        tsize = tmax - used;
       }
       else
       {
-        iconv(*pic,NULL,NULL,NULL,NULL); /* reset state */
+        err = errno;
+        break;
+      }
+    }
+  }
+  
+  *pi = from - src;
+  *po = tmax - tsize;
+  return err;
+}
+
+/*************************************************************************
+* Usage:        same = iconv_same(pic,src,n)
+* Desc:         Check if the output would be the same as the input, as it
+*               is for ASCII between UTF-8 and ISO-8859-1.
+**************************************************************************/
+
+static bool iconv_same(iconv__s *pic,char const *src,size_t n)
+{
+  return ((pic->native == NATIVE_UTF8_LATIN1) || (pic->native == NATIVE_LATIN1_UTF8))
+      && (ascii_span((uint8_t const *)src,n) == n)
+      ;
+}
+
+/************************************************************************/
+
+static void iconv_reset(iconv__s *pic)
+{
+  if (pic->ic != (iconv_t)-1)
+    iconv(pic->ic,NULL,NULL,NULL,NULL);
+  pic->pos   = 0;
+  pic->npend = 0;
+}
+
+static int luaiconv_open(lua_State *L)
+{
+  char const *fromcode;
+  char const *tocode;
+  iconv__s   *pic;
+  iconv_t     ic;
+  char        key[ICONV_KEYSIZE];
+  int         native;
+  
+  tocode   = luaL_checkstring(L,1);
+  fromcode = luaL_checkstring(L,2);
+  native   = iconv_native(tocode,fromcode);
+  ic       = (iconv_t)-1;
+  
+  if ((size_t)snprintf(key,sizeof(key),"%s\n%s",tocode,fromcode) >= sizeof(key))
+    key[0] = '\0';
+    
+  if (native == NATIVE_NONE)
+  {
+    if (key[0] != '\0')
+    {
+      pthread_mutex_lock(&m_lock);
+      for (size_t i = 0 ; i < m_ncache ; i++)
+      {
+        if (strcmp(m_cache[i].key,key) == 0)
+        {
+          ic         = m_cache[i].ic;
+          m_cache[i] = m_cache[--m_ncache];
+          break;
+        }
+      }
+      pthread_mutex_unlock(&m_lock);
+    }
+    
+    if (ic == (iconv_t)-1)
+    {
+      ic = iconv_open(tocode,fromcode);
+      if (ic == (iconv_t)-1)
+      {
         lua_pushnil(L);
         lua_pushinteger(L,errno);
-        lua_pushinteger(L,(int)(from - ofrom) + 1);
+        lua_pushfstring(L,"%s:%s",tocode,fromcode);
         return 3;
       }
     }
   }
   
-  luaL_addlstring(&buf,to,sizeof(to) - tsize);
-  luaL_pushresult(&buf);
+  pic         = lua_newuserdata(L,sizeof(iconv__s));
+  pic->ic     = ic;
+  pic->native = native;
+  pic->pos    = 0;
+  pic->npend  = 0;
+  memcpy(pic->key,key,sizeof(key));
+  
+  luaL_getmetatable(L,TYPE_ICONV);
+  lua_setmetatable(L,-2);
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/*************************************************************************/
+
+static int luametaiconv___call(lua_State *L)
+{
+  iconv__s   *pic = luaL_checkudata(L,1,TYPE_ICONV);
+  size_t      size;
+  char const *data = luaL_checklstring(L,2,&size);
+  size_t      i;
+  size_t      o;
+  int         err;
+  
+  if (iconv_same(pic,data,size))
+  {
+    lua_pushvalue(L,2);
+    lua_pushinteger(L,0);
+    return 2;
+  }
+  
+  err = iconv_run(L,pic,data,size,&i,&o);
+  if (err != 0)
+  {
+    iconv_reset(pic);
+    lua_pushnil(L);
+    lua_pushinteger(L,err);
+    lua_pushinteger(L,(lua_Integer)i + 1);
+    return 3;
+  }
+  
+  lua_pushlstring(L,lua_touserdata(L,-1),o);
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/*************************************************************************
+* Usage:        str,err[,idx] = trans:update(data)
+* Desc:         Convert the next piece of a stream.  A sequence cut off at
+*               the end of the data is kept until the next call.
+* Input:        data (binary) data
+* Return:       str (string) converted data (which may be empty), nil on
+*                       | error
+*               err (integer) 0 if okay, else system error number
+*               idx (integer/optional) index of error in the stream
+*
+* Note:         After an error, the converter is reset to the start of a
+*               stream.
+**************************************************************************/
+
+static int luametaiconv_update(lua_State *L)
+{
+  iconv__s   *pic = luaL_checkudata(L,1,TYPE_ICONV);
+  size_t      size;
+  char const *data = luaL_checklstring(L,2,&size);
+  size_t      i;
+  size_t      o;
+  int         err;
+  
+  if (pic->npend > 0)
+  {
+    char *both = lua_newuserdata(L,pic->npend + size);
+    
+    memcpy(both,pic->pend,pic->npend);
+    memcpy(both + pic->npend,data,size);
+    data  = both;
+    size += pic->npend;
+  }
+  else if (iconv_same(pic,data,size))
+  {
+    pic->pos += size;
+    lua_pushvalue(L,2);
+    lua_pushinteger(L,0);
+    return 2;
+  }
+  
+  err = iconv_run(L,pic,data,size,&i,&o);
+  
+  if ((err == EINVAL) && (size - i <= sizeof(pic->pend)))
+  {
+    memcpy(pic->pend,data + i,size - i);
+    pic->npend = size - i;
+  }
+  else if (err != 0)
+  {
+    lua_Integer idx = pic->pos + i + 1;
+    
+    iconv_reset(pic);
+    lua_pushnil(L);
+    lua_pushinteger(L,err);
+    lua_pushinteger(L,idx);
+    return 3;
+  }
+  else
+    pic->npend = 0;
+    
+  pic->pos += i;
+  lua_pushlstring(L,lua_touserdata(L,-1),o);
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/*************************************************************************
+* Usage:        str,err[,idx] = trans:finish()
+* Desc:         End a stream, returning any output needed to end it (like
+*               a shift back to ASCII), and reset the converter.
+* Return:       str (string) final output, nil on error
+*               err (integer) 0 if okay, EINVAL if the stream ended in the
+*                       | middle of a sequence
+*               idx (integer/optional) index of the incomplete sequence
+**************************************************************************/
+
+static int luametaiconv_finish(lua_State *L)
+{
+  iconv__s *pic = luaL_checkudata(L,1,TYPE_ICONV);
+  char      buf[64];
+  char     *pto   = buf;
+  size_t    tsize = sizeof(buf);
+  
+  if (pic->npend > 0)
+  {
+    lua_Integer idx = pic->pos + 1;
+    
+    iconv_reset(pic);
+    lua_pushnil(L);
+    lua_pushinteger(L,EINVAL);
+    lua_pushinteger(L,idx);
+    return 3;
+  }
+  
+  if (pic->ic != (iconv_t)-1)
+    iconv(pic->ic,NULL,NULL,&pto,&tsize);
+    
+  iconv_reset(pic);
+  lua_pushlstring(L,buf,sizeof(buf) - tsize);
   lua_pushinteger(L,0);
   return 2;
 }
@@ -153,11 +817,29 @@ static int luametaiconv___tostring(lua_State *L)
 
 static int luametaiconv___gc(lua_State *L)
 {
-  iconv_t *ic = luaL_checkudata(L,1,TYPE_ICONV);
-  if (*ic != NULL)
+  iconv__s *pic = luaL_checkudata(L,1,TYPE_ICONV);
+  
+  if (pic->ic != (iconv_t)-1)
   {
-    iconv_close(*ic);
-    *ic = NULL;
+    bool cached = false;
+    
+    if (pic->key[0] != '\0')
+    {
+      iconv(pic->ic,NULL,NULL,NULL,NULL);
+      pthread_mutex_lock(&m_lock);
+      if (m_ncache < ICONV_MAXCACHE)
+      {
+        m_cache[m_ncache].ic = pic->ic;
+        memcpy(m_cache[m_ncache].key,pic->key,sizeof(pic->key));
+        m_ncache++;
+        cached = true;
+      }
+      pthread_mutex_unlock(&m_lock);
+    }
+    
+    if (!cached)
+      iconv_close(pic->ic);
+    pic->ic = (iconv_t)-1;
   }
   return 0;
 }
@@ -168,6 +850,8 @@ int luaopen_org_conman_iconv(lua_State *L)
 {
   static struct luaL_Reg const reg_iconv_meta[] =
   {
+    { "update"            , luametaiconv_update           } ,
+    { "finish"            , luametaiconv_finish           } ,
     { "__call"            , luametaiconv___call           } ,
     { "__tostring"        , luametaiconv___tostring       } ,
     { "__gc"              , luametaiconv___gc             } ,
@@ -183,6 +867,8 @@ int luaopen_org_conman_iconv(lua_State *L)
 #else
   luaL_setfuncs(L,reg_iconv_meta,0);
 #endif
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
   lua_pushcfunction(L,luaiconv_open);
   return 1;
 }
@@ -0,0 +1,700 @@
+/***************************************************************************
+*
+* Copyright 2026 by Sean Conner.
+*
+* This library is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This library is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+* License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library; if not, see <http://www.gnu.org/licenses/>.
+*
+* Comments, questions and criticisms can be sent to: sean@conman.org
+*
+* ==================================================================
+*
+* A byte buffer with a read cursor, used by org.conman.net.ios to hold
+* input.  Appending data and consuming data from the front never copies
+* the unread portion more than a constant number of times, unlike the
+* Lua idiom of
+*
+*       buffer = buffer .. data
+*       line   = buffer:sub(1,n)
+*       buffer = buffer:sub(n + 1,-1)
+*
+* which copies the remaining data each time.
+*
+        iobuf = require "org.conman.iobuf"
+        buf   = iobuf()
+        buf:append("Hello, world!\r\n")
+        print(#buf,buf:find("\n"),buf:get(5))
+        
+*
+*********************************************************************/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "iobuf.h"
+
+#if !defined(LUA_VERSION_NUM) || LUA_VERSION_NUM < 501
+#  error You need to compile against Lua 5.1 or higher
+#endif
+
+#define IOBUF_MAXNUM    200     /* same as L_MAXLENNUM in liolib.c */
+
+typedef struct numscan
+{
+  char const *p;
+  char const *end;
+  int         c;
+  size_t      n;
+  char        buff[IOBUF_MAXNUM + 1];
+} numscan__t;
+
+/*************************************************************************/
+
+static inline void iobuf_consume(iobuf__t *buf,size_t len)
+{
+  assert(buf != NULL);
+  assert(len <= buf->tail - buf->head);
+  
+  buf->head += len;
+  if (buf->head == buf->tail)
+    buf->head = buf->tail = 0;
+    
+  buf->lscan = buf->lscan > len ? buf->lscan - len : 0;
+  buf->hscan = buf->hscan > len ? buf->hscan - len : 0;
+}
+
+/**************************************************************************
+*
+* Scan for the end of a line ("\n" or "\r\n").  Returns the offset of the
+* LF, or the number of unread bytes if not found.  Where we left off is
+* remembered, so data isn't rescanned as more arrives.  memchr() is used
+* as it is usually vectorized (glibc selects an SSE2/AVX2/EVEX version at
+* runtime).
+*
+***************************************************************************/
+
+static size_t iobuf_scaneol(iobuf__t *buf)
+{
+  size_t      unread = buf->tail - buf->head;
+  char const *start  = &buf->data[buf->head];
+  char const *lf;
+  
+  assert(buf->lscan <= unread);
+  
+  lf = memchr(start + buf->lscan,'\n',unread - buf->lscan);
+  if (lf == NULL)
+  {
+    buf->lscan = unread;
+    return unread;
+  }
+  
+  buf->lscan = (size_t)(lf - start);
+  return buf->lscan;
+}
+
+/**************************************************************************
+*
+* Scan for the end of a header block (a blank line, where lines end with
+* "\n" or "\r\n").  Returns the offset just past the final LF, or 0 if
+* not found.  Like iobuf_scaneol(), where we left off is remembered.
+*
+***************************************************************************/
+
+static size_t iobuf_scaneoh(iobuf__t *buf)
+{
+  size_t      unread = buf->tail - buf->head;
+  char const *start  = &buf->data[buf->head];
+  char const *end    = start + unread;
+  char const *lf     = start + buf->hscan;
+  
+  assert(buf->hscan <= unread);
+  
+  while((lf = memchr(lf,'\n',(size_t)(end - lf))) != NULL)
+  {
+    if (lf + 1 == end)
+      break;
+    if (lf[1] == '\n')
+    {
+      buf->hscan = (size_t)(lf - start);
+      return buf->hscan + 2;
+    }
+    if (lf[1] == '\r')
+    {
+      if (lf + 2 == end)
+        break;
+      if (lf[2] == '\n')
+      {
+        buf->hscan = (size_t)(lf - start);
+        return buf->hscan + 3;
+      }
+    }
+    lf++;
+  }
+  
+  /*-------------------------------------------------------------------
+  ; If we stopped on a LF at (or near) the end, we'll need to look at it
+  ; again once more data arrives.
+  ;--------------------------------------------------------------------*/
+  
+  buf->hscan = lf != NULL ? (size_t)(lf - start) : unread;
+  return 0;
+}
+
+/**************************************************************************
+*
+* The number scanner, a translation of read_number() from liolib.c, but
+* reading from memory.  c is the lookahead character, EOF at the end of
+* the data.
+*
+***************************************************************************/
+
+static int numscan_nextc(numscan__t *rn)
+{
+  if (rn->n >= IOBUF_MAXNUM)    /* too long---invalidate it, as liolib.c does */
+  {
+    rn->buff[0] = '\0';
+    return 0;
+  }
+  rn->buff[rn->n++] = rn->c;
+  rn->c = rn->p < rn->end ? (unsigned char)*rn->p++ : EOF;
+  return 1;
+}
+
+/*************************************************************************/
+
+static int numscan_test2(numscan__t *rn,char const *set)
+{
+  if ((rn->c == set[0]) || (rn->c == set[1]))
+    return numscan_nextc(rn);
+  else
+    return 0;
+}
+
+/*************************************************************************/
+
+static size_t numscan_digits(numscan__t *rn,int hex)
+{
+  size_t count = 0;
+  
+  while ((hex ? isxdigit(rn->c) : isdigit(rn->c)) && numscan_nextc(rn))
+    count++;
+  return count;
+}
+
+/*************************************************************************/
+
+static size_t iobuf_tosize(lua_State *L,int idx,iobuf__t *buf)
+{
+  size_t unread = buf->tail - buf->head;
+  
+  if (lua_isnoneornil(L,idx))
+    return unread;
+  else
+  {
+    lua_Integer amount = luaL_checkinteger(L,idx);
+    if (amount < 0)
+      return 0;
+    else if ((lua_Integer)unread < amount)
+      return unread;
+    else
+      return amount;
+  }
+}
+
+/**************************************************************************
+* Usage:        buf = iobuf([size])
+* Desc:         Create a new buffer
+* Input:        size (integer/optional) initial size of buffer
+* Return:       buf (userdata) buffer
+***************************************************************************/
+
+static int iobuflua(lua_State *L)
+{
+  lua_Integer  size = luaL_optinteger(L,1,0);
+  iobuf__t    *buf  = lua_newuserdata(L,sizeof(iobuf__t));
+  
+  buf->data = NULL;
+  buf->size = 0;
+  buf->head  = 0;
+  buf->tail  = 0;
+  buf->lscan = 0;
+  buf->hscan = 0;
+  luaL_getmetatable(L,TYPE_IOBUF);
+  lua_setmetatable(L,-2);
+  
+  if ((size > 0) && (iobuf_reserve(buf,size) == NULL))
+    return luaL_error(L,"not enough memory");
+    
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        buf = buf:append(data...)
+* Desc:         Append data to the end of the buffer
+* Input:        data (string number) data to append
+* Return:       buf (userdata) buffer
+***************************************************************************/
+
+static int iobufmeta_append(lua_State *L)
+{
+  iobuf__t *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  int       max = lua_gettop(L);
+  
+  for (int i = 2 ; i <= max ; i++)
+  {
+    size_t      len;
+    char const *data = luaL_checklstring(L,i,&len);
+    char       *dest = iobuf_reserve(buf,len);
+    
+    if (dest == NULL)
+      return luaL_error(L,"not enough memory");
+      
+    memcpy(dest,data,len);
+    buf->tail += len;
+  }
+  
+  lua_settop(L,1);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        buf = buf:unget(data)
+* Desc:         Return data to the front of the buffer
+* Input:        data (string number) data to return
+* Return:       buf (userdata) buffer
+***************************************************************************/
+
+static int iobufmeta_unget(lua_State *L)
+{
+  iobuf__t   *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  size_t      len;
+  char const *data = luaL_checklstring(L,2,&len);
+  
+  if (buf->head < len)
+  {
+    size_t unread = buf->tail - buf->head;
+    
+    if (iobuf_reserve(buf,len) == NULL)
+      return luaL_error(L,"not enough memory");
+      
+    memmove(&buf->data[len],&buf->data[buf->head],unread);
+    buf->head = len;
+    buf->tail = len + unread;
+  }
+  
+  buf->head  -= len;
+  buf->lscan  = 0;
+  buf->hscan  = 0;
+  memcpy(&buf->data[buf->head],data,len);
+  lua_settop(L,1);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        data = buf:get([amount])
+* Desc:         Remove data from the front of the buffer
+* Input:        amount (integer/optional) amount of data, all if not given
+* Return:       data (string) data (may be less than requested)
+***************************************************************************/
+
+static int iobufmeta_get(lua_State *L)
+{
+  iobuf__t *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  size_t    len = iobuf_tosize(L,2,buf);
+  
+  lua_pushlstring(L,&buf->data[buf->head],len);
+  iobuf_consume(buf,len);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        data = buf:peek([amount])
+* Desc:         Return data from the front of the buffer without removing it
+* Input:        amount (integer/optional) amount of data, all if not given
+* Return:       data (string) data (may be less than requested)
+***************************************************************************/
+
+static int iobufmeta_peek(lua_State *L)
+{
+  iobuf__t *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  size_t    len = iobuf_tosize(L,2,buf);
+  
+  lua_pushlstring(L,&buf->data[buf->head],len);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        buf = buf:skip(amount)
+* Desc:         Discard data from the front of the buffer
+* Input:        amount (integer) amount of data to discard
+* Return:       buf (userdata) buffer
+***************************************************************************/
+
+static int iobufmeta_skip(lua_State *L)
+{
+  iobuf__t *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  
+  luaL_checkinteger(L,2);
+  iobuf_consume(buf,iobuf_tosize(L,2,buf));
+  lua_settop(L,1);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        s,e = buf:find(text[,init])
+* Desc:         Find text in the unread portion of the buffer
+* Input:        text (string) text to find (no patterns)
+*               init (integer/optional) position to start search
+* Return:       s (integer) starting position, nil if not found
+*               e (integer) ending position
+***************************************************************************/
+
+static int iobufmeta_find(lua_State *L)
+{
+  iobuf__t   *buf    = luaL_checkudata(L,1,TYPE_IOBUF);
+  size_t      len;
+  char const *text   = luaL_checklstring(L,2,&len);
+  lua_Integer init   = luaL_optinteger(L,3,1);
+  size_t      unread = buf->tail - buf->head;
+  char const *start;
+  char const *end;
+  
+  if (init < 1)
+    init = 1;
+    
+  if ((len == 0) || ((size_t)init - 1 + len > unread))
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  
+  start = &buf->data[buf->head + init - 1];
+  end   = &buf->data[buf->tail - len + 1];
+  
+  while(start < end)
+  {
+    start = memchr(start,text[0],(size_t)(end - start));
+    if (start == NULL)
+      break;
+    if (memcmp(start,text,len) == 0)
+    {
+      size_t pos = (size_t)(start - &buf->data[buf->head]);
+      lua_pushinteger(L,pos + 1);
+      lua_pushinteger(L,pos + len);
+      return 2;
+    }
+    start++;
+  }
+  
+  lua_pushnil(L);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        line = buf:getline([keep])
+* Desc:         Remove a line from the front of the buffer
+* Input:        keep (boolean/optional) true to keep the line terminator
+* Return:       line (string) line of text, nil if no complete line
+*
+* Note:         A line ends with "\n" or "\r\n".
+***************************************************************************/
+
+static int iobufmeta_getline(lua_State *L)
+{
+  iobuf__t *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  size_t    lf  = iobuf_scaneol(buf);
+  size_t    len;
+  
+  if (lf == buf->tail - buf->head)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  
+  if (lua_toboolean(L,2))
+    len = lf + 1;
+  else if ((lf > 0) && (buf->data[buf->head + lf - 1] == '\r'))
+    len = lf - 1;
+  else
+    len = lf;
+    
+  lua_pushlstring(L,&buf->data[buf->head],len);
+  iobuf_consume(buf,lf + 1);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        header = buf:getheader()
+* Desc:         Remove a header block (up to and including a blank line)
+*               from the front of the buffer
+* Return:       header (string) header block, nil if not complete
+***************************************************************************/
+
+static int iobufmeta_getheader(lua_State *L)
+{
+  iobuf__t *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  size_t    len = iobuf_scaneoh(buf);
+  
+  if (len == 0)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  
+  lua_pushlstring(L,&buf->data[buf->head],len);
+  iobuf_consume(buf,len);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        number,more = buf:getnumber([eof])
+* Desc:         Remove a number (in text form) from the front of the buffer
+* Input:        eof (boolean/optional) true if no more data will be added
+* Return:       number (number) number, nil if not a number
+*               more (boolean) true if the number ran to the end of the
+*                       | buffer; if eof wasn't given, nothing (besides
+*                       | leading white space) was removed and the caller
+*                       | should add more data and try again
+*
+* Note:         This follows the rules of file:read("n"); what was
+*               scanned is removed even if it isn't a valid number.
+***************************************************************************/
+
+static int iobufmeta_getnumber(lua_State *L)
+{
+  iobuf__t    *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  int          eof = lua_toboolean(L,2);
+  int          hex = 0;
+  int          count;
+  char const  *expo = "eE";
+  size_t       skip = 0;
+  numscan__t   rn;
+  
+  while ((buf->head + skip < buf->tail) && isspace((unsigned char)buf->data[buf->head + skip]))
+    skip++;
+  iobuf_consume(buf,skip);
+  
+  rn.p   = &buf->data[buf->head];
+  rn.end = &buf->data[buf->tail];
+  rn.c   = rn.p < rn.end ? (unsigned char)*rn.p++ : EOF;
+  rn.n   = 0;
+  count  = 0;
+  
+  numscan_test2(&rn,"-+");
+  if (numscan_test2(&rn,"00"))
+  {
+    if (numscan_test2(&rn,"xX"))
+    {
+      hex  = 1;
+      expo = "pP";
+    }
+    else
+      count = 1;
+  }
+  
+  count += numscan_digits(&rn,hex);
+  if (numscan_test2(&rn,".."))
+    count += numscan_digits(&rn,hex);
+  if ((count > 0) && numscan_test2(&rn,expo))
+  {
+    numscan_test2(&rn,"-+");
+    numscan_digits(&rn,0);
+  }
+  
+  if ((rn.c == EOF) && !eof)
+  {
+    lua_pushnil(L);
+    lua_pushboolean(L,1);
+    return 2;
+  }
+  
+  iobuf_consume(buf,rn.n);
+  rn.buff[rn.n] = '\0';
+  
+#if LUA_VERSION_NUM >= 503
+  if (lua_stringtonumber(L,rn.buff) == 0)
+    lua_pushnil(L);
+#else
+  lua_pushstring(L,rn.buff);
+  if (!lua_isnumber(L,-1))
+  {
+    lua_pop(L,1);
+    lua_pushnil(L);
+  }
+  else
+    lua_pushnumber(L,lua_tonumber(L,-1));
+#endif
+  lua_pushboolean(L,rn.c == EOF);
+  return 2;
+}
+
+/**************************************************************************
+* Usage:        n = buf:getuint(size[,order])
+* Desc:         Remove an unsigned binary integer from the front of the
+*               buffer
+* Input:        size (integer) size in bytes (1 to 8)
+*               order (enum/optional)
+*                       * 'big' (default)
+*                       * 'little'
+* Return:       n (integer) value, nil if not enough data
+*
+* Note:         Values of 2^63 and above wrap to negative values on Lua
+*               5.3 or higher; earlier versions lose precision above 2^53.
+***************************************************************************/
+
+static int iobufmeta_getuint(lua_State *L)
+{
+  static char const *const morder[] = { "big" , "little" , NULL };
+  iobuf__t           *buf    = luaL_checkudata(L,1,TYPE_IOBUF);
+  lua_Integer         size   = luaL_checkinteger(L,2);
+  int                 little = luaL_checkoption(L,3,"big",morder);
+  unsigned char const *data;
+  unsigned long long  value  = 0;
+  
+  luaL_argcheck(L,(size >= 1) && (size <= 8),2,"size must be 1 to 8");
+  
+  if (buf->tail - buf->head < (size_t)size)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  
+  data = (unsigned char const *)&buf->data[buf->head];
+  
+  if (little)
+    for (lua_Integer i = size ; i-- > 0 ; )
+      value = (value << 8) | data[i];
+  else
+    for (lua_Integer i = 0 ; i < size ; i++)
+      value = (value << 8) | data[i];
+      
+  iobuf_consume(buf,size);
+#if LUA_VERSION_NUM >= 503
+  lua_pushinteger(L,(lua_Integer)value);
+#else
+  lua_pushnumber(L,(lua_Number)value);
+#endif
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        c = buf:byte(pos)
+* Desc:         Return a byte from the unread portion of the buffer
+* Input:        pos (integer) position of byte
+* Return:       c (integer) byte value, nil if out of range
+***************************************************************************/
+
+static int iobufmeta_byte(lua_State *L)
+{
+  iobuf__t    *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  lua_Integer  pos = luaL_checkinteger(L,2);
+  
+  if ((pos < 1) || ((size_t)pos > buf->tail - buf->head))
+    lua_pushnil(L);
+  else
+    lua_pushinteger(L,(unsigned char)buf->data[buf->head + pos - 1]);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        buf = buf:clear()
+* Desc:         Discard all data in the buffer
+* Return:       buf (userdata) buffer
+***************************************************************************/
+
+static int iobufmeta_clear(lua_State *L)
+{
+  iobuf__t *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  buf->head  = buf->tail  = 0;
+  buf->lscan = buf->hscan = 0;
+  lua_settop(L,1);
+  return 1;
+}
+
+/*************************************************************************/
+
+static int iobufmeta___len(lua_State *L)
+{
+  iobuf__t *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  lua_pushinteger(L,buf->tail - buf->head);
+  return 1;
+}
+
+/*************************************************************************/
+
+static int iobufmeta___tostring(lua_State *L)
+{
+  lua_pushfstring(L,"iobuf (%p)",lua_touserdata(L,1));
+  return 1;
+}
+
+/*************************************************************************/
+
+static int iobufmeta___gc(lua_State *L)
+{
+  iobuf__t *buf = luaL_checkudata(L,1,TYPE_IOBUF);
+  
+  free(buf->data);
+  buf->data  = NULL;
+  buf->size  = buf->head  = buf->tail = 0;
+  buf->lscan = buf->hscan = 0;
+  return 0;
+}
+
+/*************************************************************************/
+
+int luaopen_org_conman_iobuf(lua_State *L)
+{
+  static struct luaL_Reg const miobuf_meta[] =
+  {
+    { "append"     , iobufmeta_append     } ,
+    { "unget"      , iobufmeta_unget      } ,
+    { "get"        , iobufmeta_get        } ,
+    { "peek"       , iobufmeta_peek       } ,
+    { "skip"       , iobufmeta_skip       } ,
+    { "find"       , iobufmeta_find       } ,
+    { "byte"       , iobufmeta_byte       } ,
+    { "getline"    , iobufmeta_getline    } ,
+    { "getheader"  , iobufmeta_getheader  } ,
+    { "getnumber"  , iobufmeta_getnumber  } ,
+    { "getuint"    , iobufmeta_getuint    } ,
+    { "clear"      , iobufmeta_clear      } ,
+    { "__len"      , iobufmeta___len      } ,
+    { "__tostring" , iobufmeta___tostring } ,
+    { "__gc"       , iobufmeta___gc       } ,
+#if LUA_VERSION_NUM >= 504
+    { "__close"    , iobufmeta___gc       } ,
+#endif
+    { NULL         , NULL                 }
+  };
+  
+  luaL_newmetatable(L,TYPE_IOBUF);
+#if LUA_VERSION_NUM == 501
+  luaL_register(L,NULL,miobuf_meta);
+#else
+  luaL_setfuncs(L,miobuf_meta,0);
+#endif
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  
+  lua_pushcfunction(L,iobuflua);
+  return 1;
+}
+
+/**************************************************************************/
@@ -0,0 +1,102 @@
+/***************************************************************************
+*
+* Copyright 2026 by Sean Conner.
+*
+* This library is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This library is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+* License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library; if not, see <http://www.gnu.org/licenses/>.
+*
+* Comments, questions and criticisms can be sent to: sean@conman.org
+*
+* ==================================================================
+*
+* The layout of an org.conman.iobuf buffer, for other modules (like
+* org.conman.tls) that read directly into one.  Such a module appends data
+* with
+*
+*       buf = luaL_checkudata(L,idx,TYPE_IOBUF);
+*       p   = iobuf_reserve(buf,len);
+*       ... write up to len bytes to p ...
+*       buf->tail += bytes;
+*
+*********************************************************************/
+
+#ifndef I_iobuf_h
+#define I_iobuf_h
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define TYPE_IOBUF      "org.conman.iobuf:iobuf"
+#define IOBUF_MIN       4096uL
+
+typedef struct iobuf
+{
+  char   *data;
+  size_t  size;
+  size_t  head;  /* start of unread data                           */
+  size_t  tail;  /* end of unread data                             */
+  size_t  lscan; /* unread bytes already scanned for end of line   */
+  size_t  hscan; /* unread bytes already scanned for end of header */
+} iobuf__t;
+
+/**************************************************************************
+*
+* Make room for at least len more bytes at the end of the buffer.  Unread
+* data is only moved down if that frees up at least as much space as is
+* being moved, so each byte is moved at most a constant number of times.
+*
+***************************************************************************/
+
+static inline char *iobuf_reserve(iobuf__t *buf,size_t len)
+{
+  size_t unread;
+  
+  assert(buf != NULL);
+  assert(buf->head <= buf->tail);
+  assert(buf->tail <= buf->size);
+  
+  if (buf->size - buf->tail >= len)
+    return &buf->data[buf->tail];
+    
+  unread = buf->tail - buf->head;
+  
+  if ((buf->head >= unread) && (buf->size - unread >= len))
+  {
+    memmove(buf->data,&buf->data[buf->head],unread);
+    buf->head = 0;
+    buf->tail = unread;
+    return &buf->data[buf->tail];
+  }
+  
+  size_t  nsize = buf->size < IOBUF_MIN ? IOBUF_MIN : buf->size;
+  char   *ndata;
+  
+  while(nsize - unread < len)
+    nsize *= 2;
+    
+  ndata = malloc(nsize);
+  if (ndata == NULL)
+    return NULL;
+    
+  if (unread > 0)
+    memcpy(ndata,&buf->data[buf->head],unread);
+  free(buf->data);
+  buf->data = ndata;
+  buf->size = nsize;
+  buf->head = 0;
+  buf->tail = unread;
+  return &buf->data[buf->tail];
+}
+
+#endif
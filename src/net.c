@@ -29,12 +29,14 @@
 #  define _POSIX_SOURCE
 #  include <sys/ioctl.h>
 #  include <linux/sockios.h>
+#  include <netinet/udp.h>
 #endif
 
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <errno.h>
 #include <assert.h>
 
@@ -64,6 +66,8 @@
 
 #define TYPE_SOCK       "org.conman.net:sock"
 #define TYPE_ADDR       "org.conman.net:addr"
+#define TYPE_FDS        "org.conman.net:fds"
+#define MAX_FDS         253     /* SCM_MAX_FD under Linux */
 
 #ifdef __SunOS
 #  define SUN_LEN(x)    sizeof(struct sockaddr_un)
@@ -90,6 +94,12 @@ typedef struct sock
   int fh;
 } sock__t;
 
+typedef struct fds
+{
+  size_t num;
+  int    fd[MAX_FDS];
+} fds__t;
+
 struct strint
 {
   char const *const text;
@@ -813,7 +823,18 @@ static struct sockoptions const m_sockoptions[] =
   { "sendqueue"         , SIOCOUTQ      , 0             , 0                     , SOPT_IOCTL    , true , false } ,
 #endif
   { "sendtimeout"       , SOL_SOCKET    , 0             , SO_SNDTIMEO           , SOPT_INT      , true , true  } ,
+#if defined(SO_TIMESTAMPNS)
+  { "timestamp"         , SOL_SOCKET    , 0             , SO_TIMESTAMPNS        , SOPT_FLAG     , true , true  } ,
+#elif defined(SO_TIMESTAMP)
+  { "timestamp"         , SOL_SOCKET    , 0             , SO_TIMESTAMP          , SOPT_FLAG     , true , true  } ,
+#endif
   { "type"              , SOL_SOCKET    , 0             , SO_TYPE               , SOPT_INT      , true , false } ,
+#ifdef UDP_GRO
+  { "udpgro"            , IPPROTO_UDP   , 0             , UDP_GRO               , SOPT_FLAG     , true , true  } ,
+#endif
+#ifdef UDP_SEGMENT
+  { "udpsegment"        , IPPROTO_UDP   , 0             , UDP_SEGMENT           , SOPT_INT      , true , true  } ,
+#endif
 #ifdef SO_USELOOPBACK
   { "useloopback"       , SOL_SOCKET    , 0             , SO_USELOOPBACK        , SOPT_FLAG     , true , true  } ,
 #endif
@@ -1254,21 +1275,90 @@ static int socklua_accept(lua_State *L)
 
 /***********************************************************************
 *
-*       remaddr,data,err = sock:recv([timeout = inf])
+* Push the information found in the control messages from a receive.  This
+* is the kernel receive time (if the "timestamp" socket option is set) in
+* seconds, comparable to clock.get('realtime'), and the segment size (if
+* the "udpgro" socket option is set and the kernel coalesced packets).
+* The receive time is always pushed (possibly as nil) if there's a segment
+* size, to keep the return values in place.
+*
+************************************************************************/
+
+static int sock_pushcontrol(lua_State *L,struct msghdr *msg)
+{
+  struct cmsghdr *cmsg;
+  bool            when    = false;
+  int             segsize = 0;
+  int             top     = lua_gettop(L);
+  
+  for (cmsg = CMSG_FIRSTHDR(msg) ; cmsg != NULL ; cmsg = CMSG_NXTHDR(msg,cmsg))
+  {
+#ifdef SCM_TIMESTAMPNS
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS))
+    {
+      struct timespec ts;
+      
+      memcpy(&ts,CMSG_DATA(cmsg),sizeof(ts));
+      lua_pushnumber(L,(double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0));
+      when = true;
+      continue;
+    }
+#endif
+
+#ifdef SCM_TIMESTAMP
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMP))
+    {
+      struct timeval tv;
+      
+      memcpy(&tv,CMSG_DATA(cmsg),sizeof(tv));
+      lua_pushnumber(L,(double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0));
+      when = true;
+      continue;
+    }
+#endif
+
+#ifdef UDP_GRO
+    if ((cmsg->cmsg_level == IPPROTO_UDP) && (cmsg->cmsg_type == UDP_GRO))
+      memcpy(&segsize,CMSG_DATA(cmsg),sizeof(segsize));
+#endif
+  }
+  
+  if (segsize > 0)
+  {
+    if (!when)
+      lua_pushnil(L);
+    lua_pushinteger(L,segsize);
+  }
+  
+  return lua_gettop(L) - top;
+}
+
+/***********************************************************************
+*
+*       remaddr,data,err[,when[,segsize]] = sock:recv([timeout = inf])
 *
 *       sock    = net.socket(...)
 *       timeout = number (in seconds, -1 = inf)
 *       err     = number
+*       when    = number (kernel receive time, only if sock.timestamp set)
+*       segsize = integer (size of each coalesced datagram in data, only
+*                 if sock.udpgro set and the kernel coalesced datagrams)
 *
 **********************************************************************/
 
 static int socklua_recv(lua_State *L)
 {
   sockaddr_all__t *remaddr;
-  socklen_t        remsize;
   sock__t         *sock;
   char             buffer[65535uL];
   ssize_t          bytes;
+  struct msghdr    msg;
+  struct iovec     iov;
+  union
+  {
+    struct cmsghdr hdr;
+    char           buf[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(int))];
+  } control;
   
   sock = luaL_checkudata(L,1,TYPE_SOCK);
   
@@ -1293,12 +1383,21 @@ static int socklua_recv(lua_State *L)
   }
   
   remaddr = lua_newuserdata(L,sizeof(sockaddr_all__t));
-  remsize = sizeof(sockaddr_all__t);
   luaL_getmetatable(L,TYPE_ADDR);
   lua_setmetatable(L,-2);
   memset(remaddr,0,sizeof(sockaddr_all__t));
   
-  bytes = recvfrom(sock->fh,buffer,sizeof(buffer),0,&remaddr->sa,&remsize);
+  memset(&msg,0,sizeof(msg));
+  iov.iov_base       = buffer;
+  iov.iov_len        = sizeof(buffer);
+  msg.msg_name       = &remaddr->sa;
+  msg.msg_namelen    = sizeof(sockaddr_all__t);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  
+  bytes = recvmsg(sock->fh,&msg,0);
   if (bytes < 0)
   {
     lua_pushnil(L);
@@ -1309,16 +1408,18 @@ static int socklua_recv(lua_State *L)
   
   lua_pushlstring(L,buffer,bytes);
   lua_pushinteger(L,0);
-  return 3;
+  return 3 + sock_pushcontrol(L,&msg);
 }
 
 /*************************************************************************
 *
-*       numbytes,err = sock:send(addr,data)
+*       numbytes,err = sock:send(addr,data[,segsize])
 *
-*       sock = net.socket(...)
-*       addr = net.address(...)
-*       data = string
+*       sock    = net.socket(...)
+*       addr    = net.address(...)
+*       data    = string
+*       segsize = integer (UDP only---have the kernel split data into
+*                 datagrams of this size; the last may be shorter)
 *
 ***********************************************************************/
 
@@ -1353,7 +1454,47 @@ static int socklua_send(lua_State *L)
     remsize = Inet_len(remote);
   }
   
-  bytes  = sendto(sock->fh,buffer,bufsiz,0,remaddr,remsize);
+  if (lua_isnoneornil(L,4))
+    bytes = sendto(sock->fh,buffer,bufsiz,0,remaddr,remsize);
+  else
+  {
+#ifdef UDP_SEGMENT
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    lua_Integer     size;
+    uint16_t        segsize;
+    union
+    {
+      struct cmsghdr hdr;
+      char           buf[CMSG_SPACE(sizeof(uint16_t))];
+    } control;
+    
+    size = luaL_checkinteger(L,4);
+    luaL_argcheck(L,(size > 0) && (size <= UINT16_MAX),4,"segment size out of range");
+    segsize = size;
+    memset(&msg,0,sizeof(msg));
+    memset(&control,0,sizeof(control));
+    iov.iov_base       = (void *)buffer;
+    iov.iov_len        = bufsiz;
+    msg.msg_name       = remaddr;
+    msg.msg_namelen    = remsize;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg               = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level   = IPPROTO_UDP;
+    cmsg->cmsg_type    = UDP_SEGMENT;
+    cmsg->cmsg_len     = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cmsg),&segsize,sizeof(segsize));
+    bytes = sendmsg(sock->fh,&msg,0);
+#else
+    bytes = -1;
+    errno = ENOTSUP;
+#endif
+  }
+  
   if (bytes < 0)
   {
     lua_pushinteger(L,-1);
@@ -1366,6 +1507,230 @@ static int socklua_send(lua_State *L)
   return 2;
 }
 
+/*************************************************************************
+*
+*       numbytes,err = sock:sendfds(data,fds)
+*
+*       sock = net.socket('unix',...) or net.socketpair()
+*       data = string (at least one byte for stream sockets)
+*       fds  = array of sockets or integer file descriptors (at most 253)
+*
+* Note: the descriptors are duplicated into the receiving process; the
+*       caller still owns (and should eventually close) the ones sent.
+*
+**************************************************************************/
+
+static int socklua_sendfds(lua_State *L)
+{
+  sock__t        *sock;
+  char const     *buffer;
+  size_t          bufsiz;
+  size_t          numfds;
+  ssize_t         bytes;
+  struct msghdr   msg;
+  struct iovec    iov;
+  struct cmsghdr *cmsg;
+  int            *pfd;
+  union
+  {
+    struct cmsghdr hdr;
+    char           buf[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+  } control;
+  
+  sock   = luaL_checkudata(L,1,TYPE_SOCK);
+  buffer = luaL_checklstring(L,2,&bufsiz);
+  luaL_checktype(L,3,LUA_TTABLE);
+  numfds = lua_rawlen(L,3);
+  
+  if ((numfds == 0) || (numfds > MAX_FDS))
+  {
+    lua_pushinteger(L,-1);
+    lua_pushinteger(L,EINVAL);
+    return 2;
+  }
+  
+  memset(&msg,0,sizeof(msg));
+  memset(&control,0,sizeof(control));
+  
+  iov.iov_base       = (void *)buffer;
+  iov.iov_len        = bufsiz;
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * numfds);
+  
+  cmsg             = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * numfds);
+  pfd              = (int *)CMSG_DATA(cmsg);
+  
+  for (size_t i = 0 ; i < numfds ; i++)
+  {
+    lua_rawgeti(L,3,i + 1);
+    if (lua_isuserdata(L,-1))
+    {
+      sock__t *s = luaL_checkudata(L,-1,TYPE_SOCK);
+      pfd[i] = s->fh;
+    }
+    else
+      pfd[i] = luaL_checkinteger(L,-1);
+    lua_pop(L,1);
+  }
+  
+  bytes = sendmsg(sock->fh,&msg,0);
+  if (bytes < 0)
+  {
+    lua_pushinteger(L,-1);
+    lua_pushinteger(L,errno);
+    return 2;
+  }
+  
+  lua_pushinteger(L,bytes);
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/***********************************************************************
+*
+*       data,fds,err = sock:recvfds([timeout = inf])
+*
+*       sock    = net.socket('unix',...) or net.socketpair()
+*       timeout = number (in seconds, -1 = inf)
+*       data    = string
+*       fds     = array of sockets (possibly empty)
+*       err     = number
+*
+* Note: if the kernel had to truncate the passed descriptors, those that
+*       did arrive are closed and EMSGSIZE is returned.
+*
+***********************************************************************/
+
+static int socklua_recvfds(lua_State *L)
+{
+  sock__t        *sock;
+  fds__t         *pending;
+  char            buffer[65535uL];
+  ssize_t         bytes;
+  struct msghdr   msg;
+  struct iovec    iov;
+  struct cmsghdr *cmsg;
+  int             flags;
+  union
+  {
+    struct cmsghdr hdr;
+    char           buf[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+  } control;
+  
+  sock = luaL_checkudata(L,1,TYPE_SOCK);
+  
+  if (lua_isnumber(L,2))
+  {
+    int           timeout = (int)(lua_tonumber(L,2) * 1000.0);
+    struct pollfd fdlist;
+    int           rc;
+    
+    fdlist.events = POLLIN;
+    fdlist.fd     = sock->fh;
+    
+    rc = poll(&fdlist,1,timeout);
+    if (rc < 1)
+    {
+      int err = (rc == 0) ? ETIMEDOUT : errno;
+      lua_pushnil(L);
+      lua_pushnil(L);
+      lua_pushinteger(L,err);
+      return 3;
+    }
+  }
+  
+  /*--------------------------------------------------------------------
+  ; The received descriptors are held here until each one is wrapped in a
+  ; socket.  If we run out of memory before then, the ones left are closed
+  ; when this is collected.
+  ;---------------------------------------------------------------------*/
+  
+  pending      = lua_newuserdata(L,sizeof(fds__t));
+  pending->num = 0;
+  luaL_getmetatable(L,TYPE_FDS);
+  lua_setmetatable(L,-2);
+  
+  memset(&msg,0,sizeof(msg));
+  iov.iov_base       = buffer;
+  iov.iov_len        = sizeof(buffer);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  
+#ifdef MSG_CMSG_CLOEXEC
+  flags = MSG_CMSG_CLOEXEC;
+#else
+  flags = 0;
+#endif
+
+  bytes = recvmsg(sock->fh,&msg,flags);
+  if (bytes < 0)
+  {
+    lua_pushnil(L);
+    lua_pushnil(L);
+    lua_pushinteger(L,errno);
+    return 3;
+  }
+  
+  for (cmsg = CMSG_FIRSTHDR(&msg) ; cmsg != NULL ; cmsg = CMSG_NXTHDR(&msg,cmsg))
+  {
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+    {
+      int    *pfd = (int *)CMSG_DATA(cmsg);
+      size_t  num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      
+      for (size_t i = 0 ; i < num ; i++)
+      {
+        if (((msg.msg_flags & MSG_CTRUNC) != 0) || (pending->num == MAX_FDS))
+          close(pfd[i]);
+        else
+          pending->fd[pending->num++] = pfd[i];
+      }
+    }
+  }
+  
+  lua_pushlstring(L,buffer,bytes);
+  lua_createtable(L,(int)pending->num,0);
+  
+  for (size_t i = 0 ; i < pending->num ; i++)
+  {
+    sock__t *s = lua_newuserdata(L,sizeof(sock__t));
+    s->fh          = pending->fd[i];
+    pending->fd[i] = -1;
+    luaL_getmetatable(L,TYPE_SOCK);
+    lua_setmetatable(L,-2);
+    lua_rawseti(L,-2,i + 1);
+  }
+  
+  pending->num = 0;
+  lua_pushinteger(L,(msg.msg_flags & MSG_CTRUNC) ? EMSGSIZE : 0);
+  return 3;
+}
+
+/**********************************************************************
+*
+* Close any received descriptors that didn't make it into a socket.
+*
+***********************************************************************/
+
+static int fdslua___gc(lua_State *L)
+{
+  fds__t *fds = luaL_checkudata(L,1,TYPE_FDS);
+  
+  for (size_t i = 0 ; i < fds->num ; i++)
+    if (fds->fd[i] != -1)
+      close(fds->fd[i]);
+      
+  fds->num = 0;
+  return 0;
+}
+
 /**********************************************************************
 *
 *       err = sock:shutdown([how = "rw"])
@@ -1652,6 +2017,8 @@ int luaopen_org_conman_net(lua_State *L)
     { "accept"            , socklua_accept        } ,
     { "recv"              , socklua_recv          } ,
     { "send"              , socklua_send          } ,
+    { "sendfds"           , socklua_sendfds       } ,
+    { "recvfds"           , socklua_recvfds       } ,
     { "shutdown"          , socklua_shutdown      } ,
     { "close"             , socklua_close         } ,
     { "_tofd"             , socklua__tofd         } ,
@@ -1697,6 +2064,10 @@ int luaopen_org_conman_net(lua_State *L)
   luaL_newmetatable(L,TYPE_ADDR);
   luaL_setfuncs(L,m_addr_meta,0);
   
+  luaL_newmetatable(L,TYPE_FDS);
+  lua_pushcfunction(L,fdslua___gc);
+  lua_setfield(L,-2,"__gc");
+  
 #if LUA_VERSION_NUM == 501
   luaL_register(L,"org.conman.net",m_net_reg);
 #else
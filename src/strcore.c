@@ -41,6 +41,8 @@
 #include <lua.h>
 #include <lauxlib.h>
 
+#include "ascii.h"
+
 #if !defined(LUA_VERSION_NUM) || LUA_VERSION_NUM < 501
 #  error You need to compile against Lua 5.1 or higher
 #endif
@@ -840,89 +842,194 @@ static void C0(luaL_Buffer *buf,unsigned char c)
 
 /************************************************************************/
 
+static inline bool safe_char(unsigned char c)
+{
+  return (c >= ' ') && (c < 0x7F) && (c != '\\');
+}
+
+/*************************************************************************
+* Usage:        len = safe_span(s,n)
+* Desc:         Return the length of the leading run of bytes that
+*               safeascii() and safeutf8() pass through untouched---that
+*               is, printable ASCII other than the backslash.
+* Input:        s (unsigned char const *) text
+*               n (size_t) length of text
+* Return:       len (size_t) length of run
+*************************************************************************/
+
+static size_t safe_span(unsigned char const *s,size_t n)
+{
+  size_t i = 0;
+  
+#ifdef ASCII_SSE2
+  /*----------------------------------------------------------------------
+  ; The compare is signed, so bytes 0x80 and up also test as less than a
+  ; space.  That leaves DEL and backslash to check for.
+  ;-----------------------------------------------------------------------*/
+  
+  __m128i const space  = _mm_set1_epi8(' ');
+  __m128i const del    = _mm_set1_epi8(0x7F);
+  __m128i const bslash = _mm_set1_epi8('\\');
+  
+  for ( ; i + 16 <= n ; i += 16)
+  {
+    __m128i x    = _mm_loadu_si128((__m128i const *)(s + i));
+    __m128i bad  = _mm_or_si128(
+                     _mm_cmplt_epi8(x,space),
+                     _mm_or_si128(
+                       _mm_cmpeq_epi8(x,del),
+                       _mm_cmpeq_epi8(x,bslash)
+                     )
+                   );
+    int     mask = _mm_movemask_epi8(bad);
+    
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#else
+  /*----------------------------------------------------------------------
+  ; Check eight bytes at a time for a byte under a space, DEL, backslash
+  ; or any byte with the high bit set, then let the byte loop below find
+  ; exactly where it is.
+  ;-----------------------------------------------------------------------*/
+  
+  uint64_t const ones = 0x0101010101010101uLL;
+  uint64_t const high = 0x8080808080808080uLL;
+  
+  for ( ; i + 8 <= n ; i += 8)
+  {
+    uint64_t word;
+    uint64_t d;
+    uint64_t b;
+    
+    memcpy(&word,s + i,sizeof(word));
+    d = word ^ (ones * 0x7F);
+    b = word ^ (ones * '\\');
+    
+    if (
+            (word & high)
+         || ((word - ones * ' ') & ~word & high)
+         || ((d - ones) & ~d & high)
+         || ((b - ones) & ~b & high)
+       )
+      break;
+  }
+#endif
+
+  while((i < n) && safe_char(s[i]))
+    i++;
+  return i;
+}
+
+/*************************************************************************
+* Usage:        addrun(buf,s,n)
+* Desc:         Add a run of text that needs no escaping to the buffer.
+*               Short runs (common in text heavy with escapes) are cheaper
+*               to add a byte at a time.
+* Input:        buf (luaL_Buffer *) buffer
+*               s (unsigned char const *) text
+*               n (size_t) length of text
+*************************************************************************/
+
+static inline void addrun(luaL_Buffer *buf,unsigned char const *s,size_t n)
+{
+  assert(buf != NULL);
+  assert(s   != NULL);
+  
+  if (n < 8)
+    while(n--)
+      luaL_addchar(buf,*s++);
+  else
+    luaL_addlstring(buf,(char const *)s,n);
+}
+
+/************************************************************************/
+
 static int strcore_safeascii(lua_State *L)
 {
-  size_t              len;
+  size_t               len;
   unsigned char const *s = (unsigned char const *)luaL_checklstring(L,1,&len);
   luaL_Buffer          buf;
+  size_t               start = 0;
+  size_t               i     = 0;
+  bool                 copy  = false;
   
-  luaL_buffinit(L,&buf);
+  /*----------------------------------------------------------------------
+  ; Runs of safe characters are copied in one go.  The buffer isn't even
+  ; started until something needs escaping, so text that is already safe
+  ; is returned as is.
+  ;-----------------------------------------------------------------------*/
   
-  for ( ; len > 0 ; len--)
+  while(i < len)
   {
-    if (*s < ' ')
-      C0(&buf,*s++);
-    else if (*s > '~')
-      C0(&buf,*s++);
-    else
+    if (safe_char(s[i]))
     {
-      if (*s == '\\')
-        luaL_addlstring(&buf,"\\\\",2);
-      else
-        luaL_addchar(&buf,*s);
-      s++;
+      if ((++i < len) && safe_char(s[i]))
+        i += safe_span(s + i,len - i);
+      continue;
+    }
+    
+    if (!copy)
+    {
+      luaL_buffinit(L,&buf);
+      copy = true;
     }
+    
+    addrun(&buf,s + start,i - start);
+    
+    if (s[i] == '\\')
+      luaL_addlstring(&buf,"\\\\",2);
+    else
+      C0(&buf,s[i]);
+    start = ++i;
   }
   
+  if (!copy)
+  {
+    lua_settop(L,1);
+    return 1;
+  }
+  
+  addrun(&buf,s + start,len - start);
   luaL_pushresult(&buf);
   return 1;
 }
 
-/************************************************************************/
+/*************************************************************************
+* Usage:        len = utf8_len(s,n)
+* Desc:         Return the length of the UTF-8 sequence safeutf8() will
+*               pass through.  Only the form of the continuation bytes is
+*               checked.
+* Input:        s (unsigned char const *) text, starting with a byte
+*                       between 0xC2 and 0xF4
+*               n (size_t) length of text
+* Return:       len (size_t) length of sequence, 0 if not valid
+*************************************************************************/
 
-static void UTF8(luaL_Buffer *buf,unsigned char const **ps,size_t *plen)
+static size_t utf8_len(unsigned char const *s,size_t n)
 {
-  assert(buf   != NULL);
-  assert(ps    != NULL);
-  assert(*ps   != NULL);
-  assert(**ps  >= 0xC2);
-  assert(**ps  <= 0xF4);
-  assert(plen  != NULL);
-  assert(*plen >  0);
+  assert(s    != NULL);
+  assert(s[0] >= 0xC2);
+  assert(s[0] <= 0xF4);
+  assert(n    >  0);
   
   size_t delta;
   
-  if (((*ps)[0] & 0xE0) == 0xC0)
-  {
-    if (*plen < 2)
-      goto bad;
-    if (((*ps)[1] & 0xC0) != 0x80)
-      goto bad;
+  if ((s[0] & 0xE0) == 0xC0)
     delta = 2;
-  }
-  else if (((*ps)[0] & 0xF0) == 0xE0)
-  {
-    if (*plen < 3)
-      goto bad;
-    if (((*ps)[1] & 0xC0) != 0x80)
-      goto bad;
-    if (((*ps)[2] & 0xC0) != 0x80)
-      goto bad;
+  else if ((s[0] & 0xF0) == 0xE0)
     delta = 3;
-  }
   else
-  {
-    if (*plen < 4)
-      goto bad;
-    if (((*ps)[1] & 0xC0) != 0x80)
-      goto bad;
-    if (((*ps)[2] & 0xC0) != 0x80)
-      goto bad;
-    if (((*ps)[3] & 0xC0) != 0x80)
-      goto bad;
     delta = 4;
-  }
-  
-  luaL_addlstring(buf,(char *)*ps,delta);
-  (*ps)   += delta;
-  (*plen) -= delta;
-  return;
-  
-bad:
-
-  C0(buf,**ps);
-  (*ps)++;
-  (*plen)--;
+    
+  if (n < delta)
+    return 0;
+    
+  for (size_t i = 1 ; i < delta ; i++)
+    if ((s[i] & 0xC0) != 0x80)
+      return 0;
+      
+  return delta;
 }
 
 /************************************************************************/
@@ -932,40 +1039,153 @@ static int strcore_safeutf8(lua_State *L)
   size_t               len;
   unsigned char const *s = (unsigned char const *)luaL_checklstring(L,1,&len);
   luaL_Buffer          buf;
+  size_t               start = 0;
+  size_t               i     = 0;
+  bool                 copy  = false;
   
-  luaL_buffinit(L,&buf);
+  /*----------------------------------------------------------------------
+  ; Same as safeascii(), except valid UTF-8 sequences also become part of
+  ; the run being copied.
+  ;-----------------------------------------------------------------------*/
   
-  for ( ; len > 0 ; )
+  while(i < len)
   {
-    if (*s < ' ')
+    size_t delta;
+    
+    if (safe_char(s[i]))
     {
-      C0(&buf,*s++);
-      len--;
+      if ((++i < len) && safe_char(s[i]))
+        i += safe_span(s + i,len - i);
+      continue;
     }
-    else if (*s < 0x7F)
+    
+    if ((s[i] >= 0xC2) && (s[i] <= 0xF4) && ((delta = utf8_len(s + i,len - i)) > 0))
     {
-      if (*s == '\\')
-        luaL_addlstring(&buf,"\\\\",2);
-      else
-        luaL_addchar(&buf,*s);
-      s++;
-      len--;
+      i += delta;
+      continue;
     }
-    else if (*s < 0xC2)
+    
+    if (!copy)
     {
-      C0(&buf,*s++);
-      len--;
+      luaL_buffinit(L,&buf);
+      copy = true;
     }
-    else if (*s < 0xF5)
-      UTF8(&buf,&s,&len);
+    
+    addrun(&buf,s + start,i - start);
+    
+    if (s[i] == '\\')
+      luaL_addlstring(&buf,"\\\\",2);
     else
+      C0(&buf,s[i]);
+    start = ++i;
+  }
+  
+  if (!copy)
+  {
+    lua_settop(L,1);
+    return 1;
+  }
+  
+  addrun(&buf,s + start,len - start);
+  luaL_pushresult(&buf);
+  return 1;
+}
+
+/*************************************************************************
+* Usage:        len = utf8_valid(s,n)
+* Desc:         Strictly validate a UTF-8 sequence
+* Input:        s (unsigned char const *) text, starting with a byte
+*                       0x80 or higher
+*               n (size_t) length of text
+* Return:       len (size_t) length of sequence, 0 if not valid
+*
+* Note:         Overlong forms, surrogates and values past U+10FFFF are
+*               rejected.
+*************************************************************************/
+
+static size_t utf8_valid(unsigned char const *s,size_t n)
+{
+  assert(s    != NULL);
+  assert(s[0] >= 0x80);
+  assert(n    >  0);
+  
+  unsigned char lo = 0x80;
+  unsigned char hi = 0xBF;
+  size_t        delta;
+  
+  if (s[0] < 0xC2)
+    return 0;
+  else if (s[0] < 0xE0)
+    delta = 2;
+  else if (s[0] < 0xF0)
+  {
+    delta = 3;
+    if (s[0] == 0xE0)
+      lo = 0xA0;
+    else if (s[0] == 0xED)
+      hi = 0x9F;
+  }
+  else if (s[0] < 0xF5)
+  {
+    delta = 4;
+    if (s[0] == 0xF0)
+      lo = 0x90;
+    else if (s[0] == 0xF4)
+      hi = 0x8F;
+  }
+  else
+    return 0;
+    
+  if (n < delta)
+    return 0;
+  if ((s[1] < lo) || (s[1] > hi))
+    return 0;
+  for (size_t i = 2 ; i < delta ; i++)
+    if ((s[i] & 0xC0) != 0x80)
+      return 0;
+      
+  return delta;
+}
+
+/***********************************************************************
+* Usage:        okay[,idx] = strcore.isutf8(s)
+* Desc:         Check if a string is valid UTF-8, without copying it
+* Input:        s (string) text
+* Return:       okay (boolean) true if valid UTF-8
+*               idx (integer/optional) index of first invalid byte
+*
+* Note:         Validation is strict---overlong forms, surrogates and
+*               values past U+10FFFF are invalid.  Unlike safeutf8(),
+*               control characters are fine.
+************************************************************************/
+
+static int strcore_isutf8(lua_State *L)
+{
+  size_t               len;
+  unsigned char const *s = (unsigned char const *)luaL_checklstring(L,1,&len);
+  size_t               i = 0;
+  
+  while(i < len)
+  {
+    size_t delta;
+    
+    if (s[i] < 0x80)
+    {
+      i += ascii_span(s + i,len - i);
+      continue;
+    }
+    
+    delta = utf8_valid(s + i,len - i);
+    if (delta == 0)
     {
-      C0(&buf,*s++);
-      len--;
+      lua_pushboolean(L,false);
+      lua_pushinteger(L,(lua_Integer)i + 1);
+      return 2;
     }
+    i += delta;
   }
   
-  luaL_pushresult(&buf);
+  lua_pushboolean(L,true);
   return 1;
 }
 
@@ -982,6 +1202,7 @@ int luaopen_org_conman_strcore(lua_State *L)
     { "comparei"  , strcore_comparei      } ,
     { "safeascii" , strcore_safeascii     } ,
     { "safeutf8"  , strcore_safeutf8      } ,
+    { "isutf8"    , strcore_isutf8        } ,
     { NULL        , NULL                  }
   };
   
@@ -20,15 +20,31 @@
 *************************************************************************/
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#  include <sys/socket.h>
+#  include <linux/tls.h>
+#  ifndef SOL_TLS
+#    define SOL_TLS 282
+#  endif
+#endif
+
 #include <tls.h>
 #include <lua.h>
 #include <lauxlib.h>
 
+#include "iobuf.h"
+
 /*---------------------------------------------------------------------------
 ; See <http://boston.conman.org/2021/01/01.1> to see why the minimum support
 ; API is now 20180210 (which was released for LibreSSL 2.7.0).  For more
@@ -49,6 +65,11 @@
 #define TYPE_TLS_CONF   "org.conman.tls:CONF"
 #define TYPE_TLS        "org.conman.tls:TLS"
 #define TYPE_TLS_MEM    "org.conman.tls:TLS_MEM"
+#define TYPE_TLS_POOL   "org.conman.tls:TLS_POOL"
+#define TYPE_TLS_BIO    "org.conman.tls:TLS_BIO"
+#define TYPE_TLS_DRV    "org.conman.tls:TLS_DRV"
+
+#define TLSPOOL_MAXTHREADS 256
 
 /**************************************************************************/
 
@@ -58,6 +79,35 @@ struct Ltlsmem
   uint8_t *buf;
 };
 
+/**************************************************************************
+* A handshake handed to a pool (see TLS HANDSHAKE POOL below).  A context
+* freed while its job is queued or running is orphaned, and the worker
+* frees it once it's done with it.
+***************************************************************************/
+
+struct tlsjob
+{
+  struct tlsjob *next;
+  struct tls    *ctx;
+  int            rc;
+  bool           finished;
+  bool           orphan;
+};
+
+struct tlspool
+{
+  pthread_mutex_t  lock;
+  pthread_cond_t   cond;
+  struct tlsjob   *work;
+  struct tlsjob  **worktail;
+  struct tlsjob   *done;
+  bool             stop;
+  int              fdread;
+  int              fdwrite;
+  size_t           nthreads;
+  pthread_t        threads[];
+};
+
 /**************************************************************************/
 
 static ssize_t Xtls_read(struct tls *tls,void *buf,size_t buflen,void *cb_arg)
@@ -136,6 +186,101 @@ static ssize_t Xtls_write(struct tls *tls,void const *buf,size_t buflen,void *cb
   return len;
 }
 
+/**************************************************************************
+*
+* Buffers for contexts created with ctx:accept_mem() or ctx:connect_mem().
+* Ciphertext is given to TLS with ctx:feed() and collected with
+* ctx:pending_output(), so the callbacks below never call back into Lua.
+*
+***************************************************************************/
+
+struct tlsbio
+{
+  iobuf__t in;
+  iobuf__t out;
+  bool     eof;
+};
+
+/*************************************************************************/
+
+static ssize_t Xtls_memread(struct tls *tls,void *buf,size_t buflen,void *cb_arg)
+{
+  struct tlsbio *bio = cb_arg;
+  size_t         len = bio->in.tail - bio->in.head;
+  
+  (void)tls;
+  
+  if (len == 0)
+    return bio->eof ? 0 : TLS_WANT_POLLIN;
+    
+  if (len > buflen)
+    len = buflen;
+    
+  memcpy(buf,&bio->in.data[bio->in.head],len);
+  bio->in.head += len;
+  if (bio->in.head == bio->in.tail)
+    bio->in.head = bio->in.tail = 0;
+  return len;
+}
+
+/*************************************************************************/
+
+static ssize_t Xtls_memwrite(struct tls *tls,void const *buf,size_t buflen,void *cb_arg)
+{
+  struct tlsbio *bio = cb_arg;
+  char          *p   = iobuf_reserve(&bio->out,buflen);
+  
+  (void)tls;
+  
+  if (p == NULL)
+    return -1;
+    
+  memcpy(p,buf,buflen);
+  bio->out.tail += buflen;
+  return buflen;
+}
+
+/*************************************************************************/
+
+static struct tlsbio *tls_newbio(lua_State *L)
+{
+  struct tlsbio *bio = lua_newuserdata(L,sizeof(struct tlsbio));
+  
+  memset(bio,0,sizeof(struct tlsbio));
+  luaL_getmetatable(L,TYPE_TLS_BIO);
+  lua_setmetatable(L,-2);
+  return bio;
+}
+
+/*************************************************************************/
+
+static struct tlsbio *tls_getbio(lua_State *L,int idx)
+{
+  struct tlsbio *bio;
+  
+  luaL_checkudata(L,idx,TYPE_TLS);
+  lua_getuservalue(L,idx);
+  lua_getfield(L,-1,"_bio");
+  bio = lua_touserdata(L,-1);
+  lua_pop(L,2);
+  
+  if (bio == NULL)
+    luaL_argerror(L,idx,"not a memory context");
+  return bio;
+}
+
+/*************************************************************************/
+
+static int Ltlsbio___gc(lua_State *L)
+{
+  struct tlsbio *bio = luaL_checkudata(L,1,TYPE_TLS_BIO);
+  
+  free(bio->in.data);
+  free(bio->out.data);
+  memset(bio,0,sizeof(struct tlsbio));
+  return 0;
+}
+
 /**************************************************************************
 *
 *                             TLS CONFIG OBJECT
@@ -671,21 +816,30 @@ static int Ltlsconf_add_keypair_ocsp_mem(lua_State *L)
 }
 
 /**************************************************************************
-* Usage:
-* Desc:
-* Input:
-* Return:
+* Usage:        okay = config:add_ticket_key(keyrev,key)
+* Desc:         Add a key for encrypting session tickets
+* Input:        keyrev (integer) key revision
+*               key (string) key, tls.TICKET_KEY_SIZE bytes long
+* Return:       okay (boolean) true if okay, false if error
+*
+* Note:         The most recently added key is used to encrypt new
+*               tickets; older keys are still used to decrypt tickets.
+*               libtls copies the key (it isn't modified).  See
+*               org.conman.net.tlssession for managing these.
 ***************************************************************************/
 
 static int Ltlsconf_add_ticket_key(lua_State *L)
 {
-  /*----------------------------------------------------------------------
-  ; XXX Until I figure out what tls_confif_add_ticket_key() actually does,
-  ; I'm leaving it undefiend.  My main question is---what does it do with
-  ; the key parameter?  Is it modified?
-  ;-----------------------------------------------------------------------*/
+  size_t         len;
+  unsigned char *key = (unsigned char *)luaL_checklstring(L,3,&len);
   
-  lua_pushboolean(L,false);
+  lua_pushboolean(
+          L,
+          tls_config_add_ticket_key(
+                  *(struct tls_config **)luaL_checkudata(L,1,TYPE_TLS_CONF),
+                  (uint32_t)luaL_checkinteger(L,2),
+                  key,len
+          ) == 0);
   return 1;
 }
 
@@ -880,19 +1034,30 @@ static int Ltlsconf_ecdhecurves(lua_State *L)
 }
 
 /**************************************************************************
-* Usage:
-* Desc:
-* Input:
-* Return:
+* Usage:        okay = config:session_fd(fd)
+* Desc:         Set a file to keep a client session in, for resumption
+* Input:        fd (integer/userdata) file descriptor, or object with a
+*                       | _tofd() method (like a file); it must be a
+*                       | regular file, read/write only by the owner
+* Return:       okay (boolean) true if okay, false if error
 ***************************************************************************/
 
 static int Ltlsconf_session_fd(lua_State *L)
 {
+  int fd;
+  
+  if (lua_isnumber(L,2))
+    fd = lua_tointeger(L,2);
+  else if (luaL_callmeta(L,2,"_tofd"))
+    fd = luaL_checkinteger(L,-1);
+  else
+    return luaL_argerror(L,2,"integer or file expected");
+    
   lua_pushboolean(
           L,
           tls_config_set_session_fd(
                   *(struct tls_config **)luaL_checkudata(L,1,TYPE_TLS_CONF),
-                  luaL_checkinteger(L,2)
+                  fd
           ) == 0);
   return 1;
 }
@@ -962,15 +1127,103 @@ static int Ltls___gc(lua_State *L)
   struct tls **tls = luaL_checkudata(L,1,TYPE_TLS);
   if (*tls != NULL)
   {
+    bool inpool = false;
+    
     lua_pushlightuserdata(L,*tls);
     lua_pushnil(L);
     lua_settable(L,LUA_REGISTRYINDEX);
-    tls_free(*tls);
+    
+    /*-------------------------------------------------------------------
+    ; A context handed to a pool is kept alive by the pool, but it can
+    ; still be freed explicitly, or by lua_close(), which finalizes
+    ; everything in no useful order.  If a worker could still be using it,
+    ; leave it to the worker to free.  Once a pool is stopped, its threads
+    ; are gone (and its jobs freed), so there's nothing to check.
+    ;--------------------------------------------------------------------*/
+    
+    lua_getuservalue(L,1);
+    if (lua_istable(L,-1))
+    {
+      struct tlspool *pool;
+      struct tlsjob  *job;
+      
+      lua_getfield(L,-1,"_pool");
+      lua_getfield(L,-2,"_job");
+      pool = lua_touserdata(L,-2);
+      job  = lua_touserdata(L,-1);
+      
+      if ((pool != NULL) && (job != NULL) && (pool->fdread != -1))
+      {
+        pthread_mutex_lock(&pool->lock);
+        if (!job->finished)
+          inpool = job->orphan = true;
+        pthread_mutex_unlock(&pool->lock);
+        
+        /*---------------------------------------------------------------
+        ; An orphaned job never shows up in pool:done(), so drop the
+        ; pool's reference to us here.
+        ;----------------------------------------------------------------*/
+        
+        if (inpool)
+        {
+          lua_getuservalue(L,-2);
+          lua_pushlightuserdata(L,job);
+          lua_pushnil(L);
+          lua_rawset(L,-3);
+          lua_pop(L,1);
+        }
+      }
+      
+      lua_pop(L,2);
+      lua_pushnil(L);
+      lua_setfield(L,-2,"_pool");
+      lua_pushnil(L);
+      lua_setfield(L,-2,"_job");
+    }
+    lua_pop(L,1);
+    
+    if (!inpool)
+      tls_free(*tls);
     *tls = NULL;
   }
   return 0;
 }
 
+/**************************************************************************
+* Usage:        cctx = ctx:accept_mem()
+* Desc:         Accept a connection whose ciphertext is passed in memory
+* Return:       cctx (userdata/TLS) connection context, nil on error
+*
+* Note:         Use cctx:feed() to give TLS data received from the peer,
+*               and cctx:pending_output() to get the data to send to it.
+***************************************************************************/
+
+static int Ltls_accept_mem(lua_State *L)
+{
+  struct tls    **tls = luaL_checkudata(L,1,TYPE_TLS);
+  struct tls    **ctls;
+  struct tlsbio  *bio;
+  
+  lua_settop(L,1);
+  ctls = lua_newuserdata(L,sizeof(struct tls *));
+  bio  = tls_newbio(L);
+  
+  if (tls_accept_cbs(*tls,ctls,Xtls_memread,Xtls_memwrite,bio) != 0)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  
+  luaL_getmetatable(L,TYPE_TLS);
+  lua_setmetatable(L,2);
+  lua_createtable(L,0,0);
+  lua_pushvalue(L,3);
+  lua_setfield(L,-2,"_bio");
+  lua_setuservalue(L,2);
+  lua_settop(L,2);
+  return 1;
+}
+
 /**************************************************************************
 * Usage:
 * Desc:
@@ -1022,6 +1275,8 @@ static int Ltls_accept_socket(lua_State *L)
     luaL_getmetatable(L,TYPE_TLS);
     lua_setmetatable(L,-2);
     lua_createtable(L,0,0);
+    lua_pushinteger(L,sock);
+    lua_setfield(L,-2,"_fd");
     lua_setuservalue(L,-2);
   }
   
@@ -1173,6 +1428,38 @@ static int Ltls_connect_fds(lua_State *L)
   return 1;
 }
 
+/**************************************************************************
+* Usage:        okay = ctx:connect_mem(servername)
+* Desc:         Initiate TLS with the ciphertext passed in memory
+* Input:        servername (string) server name
+* Return:       okay (boolean) true if okay, false if error
+* Note:         use ctx:error() to return the error
+*
+*               See ctx:accept_mem() for details.
+***************************************************************************/
+
+static int Ltls_connect_mem(lua_State *L)
+{
+  struct tls    **tls = luaL_checkudata(L,1,TYPE_TLS);
+  char const     *sn  = luaL_checkstring(L,2);
+  struct tlsbio  *bio;
+  
+  lua_settop(L,2);
+  bio = tls_newbio(L);
+  
+  if (tls_connect_cbs(*tls,Xtls_memread,Xtls_memwrite,bio,sn) != 0)
+    lua_pushboolean(L,false);
+  else
+  {
+    lua_getuservalue(L,1);
+    lua_pushvalue(L,3);
+    lua_setfield(L,-2,"_bio");
+    lua_pushboolean(L,true);
+  }
+  
+  return 1;
+}
+
 /**************************************************************************
 * Usage:        okay = ctx:connect_socket(socket,servername)
 * Desc:         Initiate TLS over the given socket
@@ -1187,11 +1474,20 @@ static int Ltls_connect_fds(lua_State *L)
 
 static int Ltls_connect_socket(lua_State *L)
 {
-  lua_pushboolean(L,tls_connect_socket(
+  bool okay = tls_connect_socket(
           *(struct tls **)luaL_checkudata(L,1,TYPE_TLS),
           luaL_checkinteger(L,2),
           luaL_checkstring(L,3)
-        ) == 0);
+        ) == 0;
+        
+  if (okay)
+  {
+    lua_getuservalue(L,1);
+    lua_pushvalue(L,2);
+    lua_setfield(L,-2,"_fd");
+  }
+  
+  lua_pushboolean(L,okay);
   return 1;
 }
 
@@ -1207,6 +1503,72 @@ static int Ltls_error(lua_State *L)
   return 1;
 }
 
+/**************************************************************************
+* Usage:        okay = ctx:feed([data])
+* Desc:         Give TLS data received from the peer
+* Input:        data (string/optional) data from peer; if not given, the
+*                       | peer has closed the connection
+* Return:       okay (boolean) true
+*
+* Note:         Only for contexts from ctx:accept_mem() or
+*               ctx:connect_mem().  Once the data is fed, call the function
+*               that returned tls.WANT_INPUT again.
+***************************************************************************/
+
+static int Ltls_feed(lua_State *L)
+{
+  struct tlsbio *bio = tls_getbio(L,1);
+  
+  if (lua_isnoneornil(L,2))
+    bio->eof = true;
+  else
+  {
+    size_t      len;
+    char const *data = luaL_checklstring(L,2,&len);
+    char       *p;
+    
+    /*-------------------------------------------------------------------
+    ; pending_output() returns "" when there's nothing to send, so that's
+    ; common.  An empty buffer has no memory to reserve from.
+    ;--------------------------------------------------------------------*/
+    
+    if (len > 0)
+    {
+      p = iobuf_reserve(&bio->in,len);
+      if (p == NULL)
+        return luaL_error(L,"not enough memory");
+        
+      memcpy(p,data,len);
+      bio->in.tail += len;
+    }
+  }
+  
+  lua_pushboolean(L,true);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        data = ctx:pending_output()
+* Desc:         Return (and remove) the data TLS has to send to the peer
+* Return:       data (string) data to send, "" if none
+*
+* Note:         Only for contexts from ctx:accept_mem() or
+*               ctx:connect_mem().  Check this after any call, including
+*               ones that return tls.WANT_INPUT (like the handshake).
+***************************************************************************/
+
+static int Ltls_pending_output(lua_State *L)
+{
+  struct tlsbio *bio = tls_getbio(L,1);
+  
+  if (bio->out.head == bio->out.tail)
+    lua_pushliteral(L,"");
+  else
+    lua_pushlstring(L,&bio->out.data[bio->out.head],bio->out.tail - bio->out.head);
+  bio->out.head = bio->out.tail = 0;
+  return 1;
+}
+
 /**************************************************************************
 * Usage:        advise = ctx:handshake()
 * Desc:         Check if a TLS handshake has been done
@@ -1226,6 +1588,65 @@ static int Ltls_handshake(lua_State *L)
   return 1;
 }
 
+/**************************************************************************
+* Usage:        tx,rx = ctx:ktls([fd])
+* Desc:         Report if kernel TLS is active on the connection
+* Input:        fd (integer/optional) socket, if not given to
+*                       | ctx:accept_socket() or ctx:connect_socket()
+* Return:       tx (boolean) kernel is encrypting output
+*               rx (boolean) kernel is decrypting input
+*
+* Note:         libtls has no call to turn on kernel TLS.  Where the TLS
+*               library can do it itself (OpenSSL 3 with "Options = KTLS"
+*               in its configuration) it does so after the handshake on
+*               contexts using a socket.  Once tx is true, data can be
+*               written (or sent with sendfile()) straight to the socket.
+*               Input should still go through ctx:read(), since the kernel
+*               hands TLS control records to the TLS library.
+***************************************************************************/
+
+static int Ltls_ktls(lua_State *L)
+{
+  bool tx = false;
+  bool rx = false;
+  int  fd;
+  
+  luaL_checkudata(L,1,TYPE_TLS);
+  
+  if (lua_isnoneornil(L,2))
+  {
+    lua_getuservalue(L,1);
+    lua_getfield(L,-1,"_fd");
+    fd = lua_isnumber(L,-1) ? lua_tointeger(L,-1) : -1;
+  }
+  else
+    fd = luaL_checkinteger(L,2);
+    
+#ifdef __linux__
+  if (fd >= 0)
+  {
+    struct tls_crypto_info info;
+    socklen_t              len;
+    
+    /*-------------------------------------------------------------------
+    ; Asking for just the header keeps the kernel from handing back the
+    ; keys.  It fails if that direction isn't set up.
+    ;--------------------------------------------------------------------*/
+    
+    len = sizeof(info);
+    tx  = getsockopt(fd,SOL_TLS,TLS_TX,&info,&len) == 0;
+    len = sizeof(info);
+    rx  = getsockopt(fd,SOL_TLS,TLS_RX,&info,&len) == 0;
+  }
+#else
+  (void)fd;
+#endif
+
+  lua_pushboolean(L,tx);
+  lua_pushboolean(L,rx);
+  return 2;
+}
+
 /**************************************************************************
 * Usage:        exists = ctx:peer_cert_contains_name(name)
 * Desc:         Return if the name appears in the SAN or CN of the certificate
@@ -1295,6 +1716,48 @@ static int Ltls_peer_cert_subject(lua_State *L)
   return 1;
 }
 
+/**************************************************************************
+*
+* Return true if the context does its I/O through callbacks (Lua or
+* memory).  In that case, reading can continue until the callback runs out
+* of data; with a (possibly blocking) socket, another read could wait for
+* more data to arrive, so only one read is done.
+*
+***************************************************************************/
+
+static bool tls_cbmode(lua_State *L,int idx)
+{
+  bool cbs;
+  
+  lua_getuservalue(L,idx);
+  lua_getfield(L,-1,"_readf");
+  lua_getfield(L,-2,"_bio");
+  cbs = !lua_isnil(L,-1) || !lua_isnil(L,-2);
+  lua_pop(L,3);
+  return cbs;
+}
+
+/*************************************************************************/
+
+static ssize_t tls_readbuf(struct tls *tls,luaL_Buffer *buf,size_t len)
+{
+  char    *p;
+  ssize_t  in;
+  
+#if LUA_VERSION_NUM >= 502
+  p = luaL_prepbuffsize(buf,len);
+#else
+  if (len > LUAL_BUFFERSIZE)
+    len = LUAL_BUFFERSIZE;
+  p = luaL_prepbuffer(buf);
+#endif
+
+  in = tls_read(tls,p,len);
+  if (in > 0)
+    luaL_addsize(buf,in);
+  return in;
+}
+
 /**************************************************************************
 * Usage:        data,size = tls.read([amount])
 * Desc:         Read data from a TLS context
@@ -1311,30 +1774,78 @@ static int Ltls_peer_cert_subject(lua_State *L)
 *               immedately recall the function.
 *
 *               Use ctx:error() to return the error.
+*
+*               With the callback interface, this returns all the data
+*               available, up to amount, not just what is left of the
+*               current TLS record.
 ***************************************************************************/
 
 static int Ltls_read(lua_State *L)
 {
-  struct tls  **tls = luaL_checkudata(L,1,TYPE_TLS);
-  size_t        len = luaL_optinteger(L,2,LUAL_BUFFERSIZE);
+  struct tls  **tls   = luaL_checkudata(L,1,TYPE_TLS);
+  lua_Integer   len   = luaL_optinteger(L,2,LUAL_BUFFERSIZE);
+  bool          cbs   = tls_cbmode(L,1);
+  size_t        total = 0;
   luaL_Buffer   buf;
-  char         *p;
   ssize_t       in;
   
-  if (len > LUAL_BUFFERSIZE)
-    return luaL_error(L,"buffer size %d exceeds maximum %d",len,LUAL_BUFFERSIZE);
-    
+  luaL_argcheck(L,len >= 0,2,"negative amount");
   luaL_buffinit(L,&buf);
   
-  p  = luaL_prepbuffer(&buf);
-  in = tls_read(*tls,p,len);
+  do
+  {
+    in = tls_readbuf(*tls,&buf,len - total);
+    if (in > 0)
+      total += in;
+  } while ((in > 0) && (total < (size_t)len) && cbs);
   
-  luaL_addsize(&buf,in > 0 ? in : 0);
   luaL_pushresult(&buf);
-  lua_pushinteger(L,in);
+  lua_pushinteger(L,total > 0 ? (lua_Integer)total : in);
   return 2;
 }
 
+/**************************************************************************
+* Usage:        size = ctx:read_into(buffer[,amount])
+* Desc:         Read data from a TLS context directly into a buffer
+* Input:        buffer (userdata) an org.conman.iobuf buffer
+*               amount (integer/optional) Amount of data to read
+* Return:       size (integer) amount of data added to buffer, or
+*                       * tls.ERROR
+*                       * tls.WANT_INPUT
+*                       * tls.WANT_OUTPUT
+*
+* Note:         The default amount is tls.BUFFERSIZE.  See ctx:read() for
+*               details.
+***************************************************************************/
+
+static int Ltls_read_into(lua_State *L)
+{
+  struct tls  **tls   = luaL_checkudata(L,1,TYPE_TLS);
+  iobuf__t     *buf   = luaL_checkudata(L,2,TYPE_IOBUF);
+  lua_Integer   len   = luaL_optinteger(L,3,LUAL_BUFFERSIZE);
+  bool          cbs   = tls_cbmode(L,1);
+  size_t        total = 0;
+  char         *p;
+  ssize_t       in;
+  
+  luaL_argcheck(L,len >= 0,3,"negative amount");
+  
+  p = iobuf_reserve(buf,len);
+  if (p == NULL)
+    return luaL_error(L,"not enough memory");
+    
+  do
+  {
+    in = tls_read(*tls,&p[total],len - total);
+    if (in > 0)
+      total += in;
+  } while ((in > 0) && (total < (size_t)len) && cbs);
+  
+  buf->tail += total;
+  lua_pushinteger(L,total > 0 ? (lua_Integer)total : in);
+  return 1;
+}
+
 /**************************************************************************
 * Usage:        ctx:reset()
 * Desc:         Reset a TLS context for reuse
@@ -1360,11 +1871,15 @@ static int Ltls_reset(lua_State *L)
   lua_setfield(L,-2,"_readf");
   lua_pushnil(L);
   lua_setfield(L,-2,"_writef");
+  lua_pushnil(L);
+  lua_setfield(L,-2,"_bio");
+  lua_pushnil(L);
+  lua_setfield(L,-2,"_fd");
   return 0;
 }
 
 /**************************************************************************
-* Usage:        amount = tls.write(data)
+* Usage:        amount = tls.write(data...)
 * Desc:         Write data to a TLS context
 * Input:        data (string) data to write
 * Return:       amount (integer) amount of data written, or
@@ -1374,15 +1889,35 @@ static int Ltls_reset(lua_State *L)
 * Note:         If you receive tls.WANT_INPUT or tls.WANT_OUTPUT, you should
 *               immedately recall the function.
 *
+*               Multiple strings are written as one, so they can share TLS
+*               records.  The amount written is from the start of the
+*               first string.
+*
 *               Use ctx:error() to return the error.
 ***************************************************************************/
 
 static int Ltls_write(lua_State *L)
 {
   struct tls **tls  = luaL_checkudata(L,1,TYPE_TLS);
+  int          max  = lua_gettop(L);
   size_t       len;
   char const  *data = luaL_checklstring(L,2,&len);
   
+  if (max > 2)
+  {
+    luaL_Buffer buf;
+    
+    luaL_buffinit(L,&buf);
+    for (int i = 2 ; i <= max ; i++)
+    {
+      luaL_checkstring(L,i);
+      lua_pushvalue(L,i);
+      luaL_addvalue(&buf);
+    }
+    luaL_pushresult(&buf);
+    data = lua_tolstring(L,-1,&len);
+  }
+  
   lua_pushinteger(L,tls_write(*tls,data,len));
   return 1;
 }
@@ -1685,6 +2220,545 @@ static int Ltls_conn_cipher_strength(lua_State *L)
 }
 #endif
 
+/**************************************************************************
+*
+*                             TLS I/O DRIVER
+*
+* Runs one operation (handshake, read, write or close) on a context that
+* does its own I/O on a non-blocking socket.  When the operation needs the
+* socket to be readable or writable, the driver keeps it, and an event
+* loop calls drv:pump() once the socket is ready, until the operation is
+* done.  So the code waiting on the result (say, a coroutine) is only run
+* once, with the final result, and not every time TLS wants more I/O.
+*
+***************************************************************************/
+
+enum
+{
+  TLSDRV_NONE,
+  TLSDRV_HANDSHAKE,
+  TLSDRV_READ,
+  TLSDRV_WRITE,
+  TLSDRV_CLOSE,
+};
+
+struct tlsdrv
+{
+  struct tls **tls;
+  int          op;
+  size_t       amount;
+};
+
+/**************************************************************************
+*
+* Run the current operation.  The data for the operation (an iobuf for a
+* read, a string for a write) is kept at index 2 of the uservalue table.
+* Returns the result, or nil and the I/O wanted if it's not done yet.
+*
+***************************************************************************/
+
+static int tlsdrv_run(lua_State *L,struct tlsdrv *drv)
+{
+  struct tls  *tls = *drv->tls;
+  ssize_t      rc;
+  
+  lua_getuservalue(L,1);
+  lua_rawgeti(L,-1,2);
+  
+  switch(drv->op)
+  {
+    case TLSDRV_HANDSHAKE:
+         rc = tls_handshake(tls);
+         break;
+         
+    case TLSDRV_READ:
+         {
+           iobuf__t *buf = lua_touserdata(L,-1);
+           char     *p   = iobuf_reserve(buf,drv->amount);
+           
+           if (p == NULL)
+           {
+             drv->op = TLSDRV_NONE;
+             lua_pushnil(L);
+             lua_rawseti(L,-3,2);
+             return luaL_error(L,"not enough memory");
+           }
+           
+           rc = tls_read(tls,p,drv->amount);
+           if (rc > 0)
+             buf->tail += rc;
+         }
+         break;
+         
+    case TLSDRV_WRITE:
+         {
+           size_t      len;
+           char const *data = lua_tolstring(L,-1,&len);
+           
+           rc = tls_write(tls,data,len);
+         }
+         break;
+         
+    case TLSDRV_CLOSE:
+         rc = tls_close(tls);
+         break;
+         
+    default:
+         assert(0);
+         rc = -1;
+         break;
+  }
+  
+  if ((rc == TLS_WANT_POLLIN) || (rc == TLS_WANT_POLLOUT))
+  {
+    lua_pushnil(L);
+    lua_pushstring(L,rc == TLS_WANT_POLLIN ? "r" : "w");
+    return 2;
+  }
+  
+  /*---------------------------------------------------------------------
+  ; A finished close frees the context, as ctx:close() does.
+  ;----------------------------------------------------------------------*/
+  
+  if (drv->op == TLSDRV_CLOSE)
+  {
+    tls_free(tls);
+    *drv->tls = NULL;
+  }
+  
+  drv->op = TLSDRV_NONE;
+  lua_pushnil(L);
+  lua_rawseti(L,-3,2);
+  lua_pushinteger(L,rc);
+  return 1;
+}
+
+/*************************************************************************/
+
+static struct tlsdrv *tlsdrv_start(lua_State *L,int op)
+{
+  struct tlsdrv *drv = luaL_checkudata(L,1,TYPE_TLS_DRV);
+  
+  if (drv->op != TLSDRV_NONE)
+    luaL_error(L,"operation in progress");
+  if (*drv->tls == NULL)
+    luaL_error(L,"context is closed");
+    
+  drv->op = op;
+  return drv;
+}
+
+/**************************************************************************
+* Usage:        rc[,want] = drv:handshake()
+* Desc:         Start a TLS handshake
+* Return:       rc (integer) 0 if done, tls.ERROR on error, nil if not
+*                       | done yet
+*               want (string/optional) 'r' if the socket needs to be
+*                       | readable, 'w' if writable, before calling
+*                       | drv:pump()
+***************************************************************************/
+
+static int Ltlsdrv_handshake(lua_State *L)
+{
+  return tlsdrv_run(L,tlsdrv_start(L,TLSDRV_HANDSHAKE));
+}
+
+/**************************************************************************
+* Usage:        size[,want] = drv:read_into(buffer[,amount])
+* Desc:         Start reading data into a buffer
+* Input:        buffer (userdata) an org.conman.iobuf buffer
+*               amount (integer/optional) Amount of data to read (default
+*                       | tls.BUFFERSIZE)
+* Return:       size (integer) amount of data added to buffer, 0 on EOF,
+*                       | tls.ERROR on error, nil if not done yet
+*               want (string/optional) see drv:handshake()
+***************************************************************************/
+
+static int Ltlsdrv_read_into(lua_State *L)
+{
+  lua_Integer    len;
+  struct tlsdrv *drv;
+  
+  luaL_checkudata(L,2,TYPE_IOBUF);
+  len = luaL_optinteger(L,3,LUAL_BUFFERSIZE);
+  luaL_argcheck(L,len > 0,3,"amount must be positive");
+  drv         = tlsdrv_start(L,TLSDRV_READ);
+  drv->amount = len;
+  lua_getuservalue(L,1);
+  lua_pushvalue(L,2);
+  lua_rawseti(L,-2,2);
+  lua_pop(L,1);
+  return tlsdrv_run(L,drv);
+}
+
+/**************************************************************************
+* Usage:        bytes[,want] = drv:write(data)
+* Desc:         Start writing data
+* Input:        data (string) data to write
+* Return:       bytes (integer) amount of data written (it may be less
+*                       | than given), tls.ERROR on error, nil if not
+*                       | done yet
+*               want (string/optional) see drv:handshake()
+*
+* Note:         If not done, TLS expects the same data when it's retried,
+*               so the data is held on to until drv:pump() finishes.
+***************************************************************************/
+
+static int Ltlsdrv_write(lua_State *L)
+{
+  struct tlsdrv *drv;
+  
+  luaL_checkstring(L,2);
+  drv = tlsdrv_start(L,TLSDRV_WRITE);
+  lua_getuservalue(L,1);
+  lua_pushvalue(L,2);
+  lua_rawseti(L,-2,2);
+  lua_pop(L,1);
+  return tlsdrv_run(L,drv);
+}
+
+/**************************************************************************
+* Usage:        rc[,want] = drv:close()
+* Desc:         Start closing the TLS connection
+* Return:       rc (integer) 0 if done, tls.ERROR on error, nil if not
+*                       | done yet
+*               want (string/optional) see drv:handshake()
+*
+* Note:         Once done, the context is freed (as with ctx:close()).
+*               The socket is still the caller's to close.
+***************************************************************************/
+
+static int Ltlsdrv_close(lua_State *L)
+{
+  return tlsdrv_run(L,tlsdrv_start(L,TLSDRV_CLOSE));
+}
+
+/**************************************************************************
+* Usage:        rc[,want] = drv:pump()
+* Desc:         Continue the current operation, when the socket is ready
+* Return:       rc (integer) result of the operation, nil if not done
+*                       | yet, or if there's no operation
+*               want (string/optional) see drv:handshake(), nil if there
+*                       | is no operation
+***************************************************************************/
+
+static int Ltlsdrv_pump(lua_State *L)
+{
+  struct tlsdrv *drv = luaL_checkudata(L,1,TYPE_TLS_DRV);
+  
+  if (drv->op == TLSDRV_NONE)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  
+  if (*drv->tls == NULL)
+    return luaL_error(L,"context is closed");
+    
+  return tlsdrv_run(L,drv);
+}
+
+/**************************************************************************
+* Usage:        drv:cancel()
+* Desc:         Drop the current operation (say, the socket is gone)
+***************************************************************************/
+
+static int Ltlsdrv_cancel(lua_State *L)
+{
+  struct tlsdrv *drv = luaL_checkudata(L,1,TYPE_TLS_DRV);
+  
+  drv->op = TLSDRV_NONE;
+  lua_getuservalue(L,1);
+  lua_pushnil(L);
+  lua_rawseti(L,-2,2);
+  return 0;
+}
+
+/*************************************************************************/
+
+static int Ltlsdrv___tostring(lua_State *L)
+{
+  lua_pushfstring(L,"tlsdrv: %p",luaL_checkudata(L,1,TYPE_TLS_DRV));
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        drv = ctx:driver()
+* Desc:         Return an I/O driver for a context
+* Return:       drv (userdata/TLS_DRV) I/O driver
+*
+* Note:         The context has to be using a non-blocking socket (from
+*               ctx:accept_socket() or ctx:connect_socket()).  The driver
+*               keeps a reference to the context.
+***************************************************************************/
+
+static int Ltls_driver(lua_State *L)
+{
+  struct tls    **tls = luaL_checkudata(L,1,TYPE_TLS);
+  struct tlsdrv  *drv;
+  
+  luaL_argcheck(L,*tls != NULL,1,"context is closed");
+  luaL_argcheck(L,!tls_cbmode(L,1),1,"callback contexts do their own I/O");
+  
+  drv         = lua_newuserdata(L,sizeof(struct tlsdrv));
+  drv->tls    = tls;
+  drv->op     = TLSDRV_NONE;
+  drv->amount = 0;
+  luaL_getmetatable(L,TYPE_TLS_DRV);
+  lua_setmetatable(L,-2);
+  lua_createtable(L,2,0);
+  lua_pushvalue(L,1);
+  lua_rawseti(L,-2,1);
+  lua_setuservalue(L,-2);
+  return 1;
+}
+
+/**************************************************************************
+*
+*                            TLS HANDSHAKE POOL
+*
+* Handshakes (the private key operations in particular) can take
+* milliseconds of CPU, which stalls every other connection in an event
+* driven program.  A pool runs handshakes on a fixed number of threads and
+* signals completion by making a pipe readable, so it can be added to a
+* pollset like any other file.  Only contexts doing their own I/O on a
+* (non-blocking) socket can be handed off, since the Lua callbacks can't be
+* called from another thread.
+*
+***************************************************************************/
+
+static void *tlspool_worker(void *arg)
+{
+  struct tlspool *pool = arg;
+  struct tlsjob  *job;
+  char            c    = 0;
+  
+  pthread_mutex_lock(&pool->lock);
+  
+  while(true)
+  {
+    while(!pool->stop && (pool->work == NULL))
+      pthread_cond_wait(&pool->cond,&pool->lock);
+      
+    if (pool->stop)
+      break;
+      
+    job        = pool->work;
+    pool->work = job->next;
+    if (pool->work == NULL)
+      pool->worktail = &pool->work;
+      
+    if (!job->orphan)
+    {
+      pthread_mutex_unlock(&pool->lock);
+      job->rc = tls_handshake(job->ctx);
+      pthread_mutex_lock(&pool->lock);
+    }
+    
+    /*-------------------------------------------------------------------
+    ; An orphaned context was freed from Lua while we had it; it's ours
+    ; to free, and nobody is waiting on the result.
+    ;--------------------------------------------------------------------*/
+    
+    if (job->orphan)
+    {
+      tls_free(job->ctx);
+      free(job);
+      continue;
+    }
+    
+    job->finished = true;
+    job->next     = pool->done;
+    pool->done    = job;
+    pthread_mutex_unlock(&pool->lock);
+    
+    /*-------------------------------------------------------------------
+    ; The pipe is non-blocking.  If it's full, it's readable anyway and
+    ; pool:done() collects every finished job, so the error is ignored.
+    ;--------------------------------------------------------------------*/
+    
+    if (write(pool->fdwrite,&c,1)) { }
+    pthread_mutex_lock(&pool->lock);
+  }
+  
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/*************************************************************************/
+
+static void tlspool_freejobs(struct tlsjob *job)
+{
+  while(job != NULL)
+  {
+    struct tlsjob *next = job->next;
+    if (job->orphan)
+      tls_free(job->ctx);
+    free(job);
+    job = next;
+  }
+}
+
+/**************************************************************************
+* Usage:        okay = pool:handshake(ctx)
+* Desc:         Start a handshake on a pool thread
+* Input:        ctx (userdata/TLS) context from server:accept_socket()
+* Return:       okay (boolean) true if queued, false if out of memory
+*
+* Note:         The context must not be used until pool:done() returns it.
+***************************************************************************/
+
+static int Ltlspool_handshake(lua_State *L)
+{
+  struct tlspool  *pool = luaL_checkudata(L,1,TYPE_TLS_POOL);
+  struct tls     **tls  = luaL_checkudata(L,2,TYPE_TLS);
+  struct tlsjob   *job;
+  
+  luaL_argcheck(L,*tls != NULL,2,"context is closed");
+  luaL_argcheck(L,!tls_cbmode(L,2),2,"callback contexts can't be handed off");
+  
+  job = malloc(sizeof(struct tlsjob));
+  if (job == NULL)
+  {
+    lua_pushboolean(L,false);
+    return 1;
+  }
+  
+  job->next     = NULL;
+  job->ctx      = *tls;
+  job->rc       = TLS_WANT_POLLIN;
+  job->finished = false;
+  job->orphan   = false;
+  
+  /*---------------------------------------------------------------------
+  ; Keep a reference to the context while it's in the pool, so it isn't
+  ; collected out from under a thread.  The context in turn knows its job,
+  ; so freeing it explicitly can leave it to the pool (see Ltls___gc()).
+  ;----------------------------------------------------------------------*/
+  
+  lua_getuservalue(L,1);
+  lua_pushlightuserdata(L,job);
+  lua_pushvalue(L,2);
+  lua_rawset(L,-3);
+  lua_getuservalue(L,2);
+  lua_pushvalue(L,1);
+  lua_setfield(L,-2,"_pool");
+  lua_pushlightuserdata(L,job);
+  lua_setfield(L,-2,"_job");
+  
+  pthread_mutex_lock(&pool->lock);
+  *pool->worktail = job;
+  pool->worktail  = &job->next;
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  
+  lua_pushboolean(L,true);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        results = pool:done()
+* Desc:         Collect the finished handshakes
+* Return:       results (table) result of ctx:handshake() indexed by
+*                       | context:
+*                       * 0 - okay
+*                       * tls.ERROR
+*                       * tls.WANT_INPUT
+*                       * tls.WANT_OUTPUT
+***************************************************************************/
+
+static int Ltlspool_done(lua_State *L)
+{
+  struct tlspool *pool = luaL_checkudata(L,1,TYPE_TLS_POOL);
+  struct tlsjob  *done;
+  char            buf[64];
+  
+  while(read(pool->fdread,buf,sizeof(buf)) > 0)
+    ;
+    
+  pthread_mutex_lock(&pool->lock);
+  done       = pool->done;
+  pool->done = NULL;
+  pthread_mutex_unlock(&pool->lock);
+  
+  lua_settop(L,1);
+  lua_getuservalue(L,1);
+  lua_createtable(L,0,0);
+  
+  while(done != NULL)
+  {
+    struct tlsjob *next = done->next;
+    
+    lua_pushlightuserdata(L,done);
+    lua_rawget(L,2);
+    lua_getuservalue(L,-1);
+    lua_pushnil(L);
+    lua_setfield(L,-2,"_pool");
+    lua_pushnil(L);
+    lua_setfield(L,-2,"_job");
+    lua_pop(L,1);
+    lua_pushinteger(L,done->rc);
+    lua_rawset(L,3);
+    lua_pushlightuserdata(L,done);
+    lua_pushnil(L);
+    lua_rawset(L,2);
+    free(done);
+    done = next;
+  }
+  
+  return 1;
+}
+
+/*************************************************************************/
+
+static int Ltlspool__tofd(lua_State *L)
+{
+  struct tlspool *pool = luaL_checkudata(L,1,TYPE_TLS_POOL);
+  lua_pushinteger(L,pool->fdread);
+  return 1;
+}
+
+/*************************************************************************/
+
+static int Ltlspool___tostring(lua_State *L)
+{
+  lua_pushfstring(L,"tlspool: %p",luaL_checkudata(L,1,TYPE_TLS_POOL));
+  return 1;
+}
+
+/*************************************************************************/
+
+static void tlspool_free(struct tlspool *pool)
+{
+  if (pool->fdread == -1)
+    return;
+    
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  
+  for (size_t i = 0 ; i < pool->nthreads ; i++)
+    pthread_join(pool->threads[i],NULL);
+    
+  tlspool_freejobs(pool->work);
+  tlspool_freejobs(pool->done);
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+  close(pool->fdread);
+  close(pool->fdwrite);
+  pool->fdread  = -1;
+  pool->fdwrite = -1;
+}
+
+/*************************************************************************/
+
+static int Ltlspool___gc(lua_State *L)
+{
+  tlspool_free(luaL_checkudata(L,1,TYPE_TLS_POOL));
+  return 0;
+}
+
 /**************************************************************************
 *
 *                                  TLS API
@@ -1703,6 +2777,15 @@ static int Ltlsmem___tostring(lua_State *L)
   return 1;
 }
 
+/*************************************************************************/
+
+static int Ltlsmem___len(lua_State *L)
+{
+  struct Ltlsmem *mem = luaL_checkudata(L,1,TYPE_TLS_MEM);
+  lua_pushinteger(L,mem->len);
+  return 1;
+}
+
 /**************************************************************************
 * Usage:        config = tls.config()
 * Desc:         Create a configuration context
@@ -1785,6 +2868,180 @@ static int Ltlstop_load_file(lua_State *L)
   return 1;
 }
 
+/**************************************************************************
+* Usage:        pool,err = tls.pool([threads])
+* Desc:         Create a pool of threads to do TLS handshakes
+* Input:        threads (integer/optional) number of threads (default is
+*                       | the number of CPUs online, no more than 256)
+* Return:       pool (userdata/TLS_POOL) handshake pool, nil on error
+*               err (integer) system error, 0 on success
+*
+* Note:         The pool can be added to a pollset; it's readable when
+*               handshakes have finished.
+***************************************************************************/
+
+static int Ltlstop_pool(lua_State *L)
+{
+  lua_Integer     threads = luaL_optinteger(L,1,sysconf(_SC_NPROCESSORS_ONLN));
+  struct tlspool *pool;
+  int             fh[2];
+  int             err     = 0;
+  
+  if (threads < 1)
+    threads = 1;
+  if (lua_isnoneornil(L,1) && (threads > TLSPOOL_MAXTHREADS))
+    threads = TLSPOOL_MAXTHREADS;
+  luaL_argcheck(L,threads <= TLSPOOL_MAXTHREADS,1,"too many threads");
+  
+  if (pipe(fh) < 0)
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,errno);
+    return 2;
+  }
+  
+  for (size_t i = 0 ; i < 2 ; i++)
+  {
+    fcntl(fh[i],F_SETFL,fcntl(fh[i],F_GETFL) | O_NONBLOCK);
+    fcntl(fh[i],F_SETFD,FD_CLOEXEC);
+  }
+  
+  pool = lua_newuserdata(L,sizeof(struct tlspool) + threads * sizeof(pthread_t));
+  pthread_mutex_init(&pool->lock,NULL);
+  pthread_cond_init(&pool->cond,NULL);
+  pool->work     = NULL;
+  pool->worktail = &pool->work;
+  pool->done     = NULL;
+  pool->stop     = false;
+  pool->fdread   = fh[0];
+  pool->fdwrite  = fh[1];
+  pool->nthreads = 0;
+  luaL_getmetatable(L,TYPE_TLS_POOL);
+  lua_setmetatable(L,-2);
+  lua_createtable(L,0,0);
+  lua_setuservalue(L,-2);
+  
+  for (lua_Integer i = 0 ; i < threads ; i++)
+  {
+    err = pthread_create(&pool->threads[i],NULL,tlspool_worker,pool);
+    if (err != 0)
+      break;
+    pool->nthreads++;
+  }
+  
+  if (pool->nthreads == 0)
+  {
+    tlspool_free(pool);
+    lua_pushnil(L);
+    lua_pushinteger(L,err);
+    return 2;
+  }
+  
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/**************************************************************************
+* Usage:        name = tls.servername(data)
+* Desc:         Return the server name (SNI) from a TLS ClientHello
+* Input:        data (binary) start of data received from a client
+* Return:       name (string) server name, nil if more data is needed,
+*                       | false if there is no server name
+*
+* Note:         This allows picking a server context (and certificate)
+*               before handing any data to TLS.  Only a ClientHello in the
+*               first TLS record is looked at.
+***************************************************************************/
+
+static int Ltlstop_servername(lua_State *L)
+{
+  size_t               size;
+  uint8_t const       *p   = (uint8_t const *)luaL_checklstring(L,1,&size);
+  uint8_t const       *end;
+  size_t               len;
+  
+  if (size < 5)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  
+  if (p[0] != 0x16) /* handshake record */
+    goto tls_servername_none;
+    
+  len = (p[3] << 8) | p[4];
+  if (size < 5 + len)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  
+  end = p + 5 + len;
+  p  += 5;
+  
+  /*---------------------------------------------------------------------
+  ; ClientHello: type, length, version, random, session id, cipher suites,
+  ; compression methods, then the extensions.
+  ;----------------------------------------------------------------------*/
+  
+  if ((end - p < 38) || (p[0] != 0x01))
+    goto tls_servername_none;
+  p += 38;
+  
+  /*---------------------------------------------------------------------
+  ; Each skip can leave p at the end of the record, so make sure the
+  ; length byte(s) are there before reading them.
+  ;----------------------------------------------------------------------*/
+  
+  if ((end - p < 1) || (end - p < 1 + p[0])) goto tls_servername_none;
+  p += 1 + p[0];
+  if ((end - p < 2) || (end - p < 2 + ((p[0] << 8) | p[1]))) goto tls_servername_none;
+  p += 2 + ((p[0] << 8) | p[1]);
+  if ((end - p < 1) || (end - p < 1 + p[0])) goto tls_servername_none;
+  p += 1 + p[0];
+  if (end - p < 2) goto tls_servername_none;
+  
+  len = (p[0] << 8) | p[1];
+  p  += 2;
+  if ((size_t)(end - p) < len)
+    goto tls_servername_none;
+  end = p + len;
+  
+  while(end - p >= 4)
+  {
+    unsigned int  type = (p[0] << 8) | p[1];
+    uint8_t const *ext;
+    
+    len = (p[2] << 8) | p[3];
+    ext = p + 4;
+    if ((size_t)(end - ext) < len)
+      break;
+    p = ext + len;
+    
+    if (type != 0) /* server_name */
+      continue;
+      
+    /*-------------------------------------------------------------------
+    ; The extension is a list of names; only the first host_name counts.
+    ;--------------------------------------------------------------------*/
+    
+    if ((len >= 5) && (ext[2] == 0))
+    {
+      size_t nlen = (ext[3] << 8) | ext[4];
+      if ((nlen > 0) && (nlen <= len - 5))
+      {
+        lua_pushlstring(L,(char const *)ext + 5,nlen);
+        return 1;
+      }
+    }
+    break;
+  }
+  
+tls_servername_none:
+  lua_pushboolean(L,false);
+  return 1;
+}
+
 /**************************************************************************
 * Usage:        ctx = tls.server()
 * Desc:         Return a TLS server context
@@ -1880,6 +3137,7 @@ int luaopen_org_conman_tls(lua_State *L)
   static luaL_Reg const m_tlsmemmeta[] =
   {
     { "__tostring"                , Ltlsmem___tostring               } ,
+    { "__len"                     , Ltlsmem___len                    } ,
     { "__gc"                      , Ltlstop_unload_file              } ,
 #if LUA_VERSION_NUM >= 504
     { "__close"                   , Ltlstop_unload_file              } ,
@@ -1898,7 +3156,7 @@ int luaopen_org_conman_tls(lua_State *L)
     { "add_keypair_mem"           , Ltlsconf_add_keypair_mem         } ,
     { "add_keypair_ocsp_file"     , Ltlsconf_add_keypair_ocsp_file   } ,
     { "add_keypair_ocsp_mem"      , Ltlsconf_add_keypair_ocsp_mem    } ,
-    { "add_ticket_key"            , Ltlsconf_add_ticket_key          } , // XXX
+    { "add_ticket_key"            , Ltlsconf_add_ticket_key          } ,
     { "alpn"                      , Ltlsconf_alpn                    } ,
     { "ca_file"                   , Ltlsconf_ca_file                 } ,
     { "ca_mem"                    , Ltlsconf_ca_mem                  } ,
@@ -1953,6 +3211,7 @@ int luaopen_org_conman_tls(lua_State *L)
 #endif
     { "accept_cbs"                , Ltls_accept_cbs                  } ,
     { "accept_fds"                , Ltls_accept_fds                  } ,
+    { "accept_mem"                , Ltls_accept_mem                  } ,
     { "accept_socket"             , Ltls_accept_socket               } ,
     { "close"                     , Ltls_close                       } ,
     { "configure"                 , Ltls_configure                   } ,
@@ -1964,10 +3223,14 @@ int luaopen_org_conman_tls(lua_State *L)
     { "connect"                   , Ltls_connect                     } ,
     { "connect_cbs"               , Ltls_connect_cbs                 } ,
     { "connect_fds"               , Ltls_connect_fds                 } ,
+    { "connect_mem"               , Ltls_connect_mem                 } ,
     { "connect_socket"            , Ltls_connect_socket              } ,
+    { "driver"                    , Ltls_driver                      } ,
     { "error"                     , Ltls_error                       } ,
+    { "feed"                      , Ltls_feed                        } ,
     { "free"                      , Ltls___gc                        } ,
     { "handshake"                 , Ltls_handshake                   } ,
+    { "ktls"                      , Ltls_ktls                        } ,
     { "ocsp_process_response"     , Ltls_ocsp_process_response       } , // XXX
     { "peer_cert_chain_pem"       , Ltls_peer_cert_chain_pem         } ,
     { "peer_cert_contains_name"   , Ltls_peer_cert_contains_name     } ,
@@ -1984,7 +3247,9 @@ int luaopen_org_conman_tls(lua_State *L)
     { "peer_ocsp_revocation_time" , Ltls_peer_ocsp_revocation_time   } ,
     { "peer_ocsp_this_update"     , Ltls_peer_ocsp_this_update       } ,
     { "peer_ocsp_url"             , Ltls_peer_ocsp_url               } ,
+    { "pending_output"            , Ltls_pending_output              } ,
     { "read"                      , Ltls_read                        } ,
+    { "read_into"                 , Ltls_read_into                   } ,
     { "reset"                     , Ltls_reset                       } ,
     { "write"                     , Ltls_write                       } ,
 #if TLS_API >= 20200120
@@ -1993,12 +3258,42 @@ int luaopen_org_conman_tls(lua_State *L)
     { NULL                        , NULL                             }
   };
   
+  static luaL_Reg const m_tlspoolmeta[] =
+  {
+    { "__tostring"                , Ltlspool___tostring              } ,
+    { "__gc"                      , Ltlspool___gc                    } ,
+    { "_tofd"                     , Ltlspool__tofd                   } ,
+    { "done"                      , Ltlspool_done                    } ,
+    { "handshake"                 , Ltlspool_handshake               } ,
+    { NULL                        , NULL                             }
+  };
+  
+  static luaL_Reg const m_tlsbiometa[] =
+  {
+    { "__gc"                      , Ltlsbio___gc                     } ,
+    { NULL                        , NULL                             }
+  };
+  
+  static luaL_Reg const m_tlsdrvmeta[] =
+  {
+    { "__tostring"                , Ltlsdrv___tostring               } ,
+    { "cancel"                    , Ltlsdrv_cancel                   } ,
+    { "close"                     , Ltlsdrv_close                    } ,
+    { "handshake"                 , Ltlsdrv_handshake                } ,
+    { "pump"                      , Ltlsdrv_pump                     } ,
+    { "read_into"                 , Ltlsdrv_read_into                } ,
+    { "write"                     , Ltlsdrv_write                    } ,
+    { NULL                        , NULL                             }
+  };
+  
   static luaL_Reg const m_tlsreg[] =
   {
     { "client"                    , Ltlstop_client                   } ,
     { "config"                    , Ltlstop_config                   } ,
     { "load_file"                 , Ltlstop_load_file                } ,
+    { "pool"                      , Ltlstop_pool                     } ,
     { "server"                    , Ltlstop_server                   } ,
+    { "servername"                , Ltlstop_servername               } ,
     { "unload_file"               , Ltlstop_unload_file              } ,
     { "default_ca_cert_file"      , Ltlstop_default_ca_cert_file     } ,
     { NULL                        , NULL                             }
@@ -2018,6 +3313,16 @@ int luaopen_org_conman_tls(lua_State *L)
   lua_setfield(L,-2,"__index");
   luaL_newmetatable(L,TYPE_TLS);
   luaL_setfuncs(L,m_tlsmeta,0);
+  luaL_newmetatable(L,TYPE_TLS_BIO);
+  luaL_setfuncs(L,m_tlsbiometa,0);
+  luaL_newmetatable(L,TYPE_TLS_DRV);
+  luaL_setfuncs(L,m_tlsdrvmeta,0);
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  luaL_newmetatable(L,TYPE_TLS_POOL);
+  luaL_setfuncs(L,m_tlspoolmeta,0);
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
   luaL_newlib(L,m_tlsreg);
   
   for (size_t i = 0 ; m_tls_consts[i].text != NULL ; i++)
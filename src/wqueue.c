@@ -0,0 +1,405 @@
+/***************************************************************************
+*
+* Copyright 2026 by Sean Conner.
+*
+* This library is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This library is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+* License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library; if not, see <http://www.gnu.org/licenses/>.
+*
+* Comments, questions and criticisms can be sent to: sean@conman.org
+*
+* ==================================================================
+*
+* A queue of strings waiting to be written, used by org.conman.net.ios to
+* hold output.  The strings themselves are kept (not copied) and an offset
+* into the first one records how much of it has already been written, so a
+* partial write never has to copy what remains.  The queue can be written
+* directly to a file descriptor with writev(), or handed out a piece at a
+* time with queue:peek() for things like TLS that need a string.
+*
+        wqueue = require "org.conman.wqueue"
+        queue  = wqueue()
+        queue:push("Hello, ","world!\n")
+        print(#queue,queue:writev(1))
+        
+*
+*********************************************************************/
+
+#include <stddef.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/uio.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#if !defined(LUA_VERSION_NUM) || LUA_VERSION_NUM < 501
+#  error You need to compile against Lua 5.1 or higher
+#endif
+
+#if LUA_VERSION_NUM == 501
+#  define lua_getuservalue(L,idx) lua_getfenv((L),(idx))
+#  define lua_setuservalue(L,idx) lua_setfenv((L),(idx))
+#  define lua_rawlen(L,idx)       lua_objlen((L),(idx))
+#  define luaL_setfuncs(L,reg,up) luaL_register((L),NULL,(reg))
+#endif
+
+#define TYPE_WQUEUE     "org.conman.wqueue:wqueue"
+#define WQUEUE_IOV      64
+
+/*--------------------------------------------------------------------------
+; The strings are stored in the uservalue table of the userdata, at indices
+; [head,tail).  offset is how much of the string at head has been written.
+;---------------------------------------------------------------------------*/
+
+typedef struct wqueue
+{
+  size_t      bytes;
+  size_t      offset;
+  lua_Integer head;
+  lua_Integer tail;
+} wqueue__t;
+
+/**************************************************************************
+*
+* Remove len bytes from the front of the queue.  The uservalue table is
+* expected at the top of the stack.
+*
+***************************************************************************/
+
+static void wqueue_consume(lua_State *L,wqueue__t *queue,size_t len)
+{
+  assert(len <= queue->bytes);
+  
+  queue->bytes -= len;
+  len          += queue->offset;
+  
+  while (len > 0)
+  {
+    size_t size;
+    
+    lua_rawgeti(L,-1,queue->head);
+    size = lua_rawlen(L,-1);
+    lua_pop(L,1);
+    
+    if (len < size)
+      break;
+      
+    len -= size;
+    lua_pushnil(L);
+    lua_rawseti(L,-2,queue->head++);
+  }
+  
+  queue->offset = len;
+  
+  if (queue->head == queue->tail)
+  {
+    assert(queue->bytes  == 0);
+    assert(queue->offset == 0);
+    queue->head = queue->tail = 1;
+  }
+}
+
+/**************************************************************************
+* Usage:        queue = wqueue()
+* Desc:         Create a new write queue
+* Return:       queue (userdata) write queue
+***************************************************************************/
+
+static int wqueuelua(lua_State *L)
+{
+  wqueue__t *queue = lua_newuserdata(L,sizeof(wqueue__t));
+  
+  queue->bytes  = 0;
+  queue->offset = 0;
+  queue->head   = 1;
+  queue->tail   = 1;
+  lua_createtable(L,0,0);
+  lua_setuservalue(L,-2);
+  luaL_getmetatable(L,TYPE_WQUEUE);
+  lua_setmetatable(L,-2);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        queue = queue:push(data...)
+* Desc:         Add data to the end of the queue
+* Input:        data (string number) data to add
+* Return:       queue (userdata) write queue
+***************************************************************************/
+
+static int wqueuemeta_push(lua_State *L)
+{
+  wqueue__t *queue = luaL_checkudata(L,1,TYPE_WQUEUE);
+  int        max   = lua_gettop(L);
+  
+  lua_getuservalue(L,1);
+  
+  for (int i = 2 ; i <= max ; i++)
+  {
+    size_t len;
+    
+    luaL_checklstring(L,i,&len);
+    if (len == 0)
+      continue;
+      
+    lua_pushvalue(L,i); /* converted to a string by luaL_checklstring() */
+    lua_rawseti(L,-2,queue->tail++);
+    queue->bytes += len;
+  }
+  
+  lua_settop(L,1);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        data = queue:peek([amount])
+* Desc:         Return data from the front of the queue without removing it
+* Input:        amount (integer/optional) maximum amount of data
+* Return:       data (string) data, nil if queue is empty
+*
+* Note:         Without amount, the unwritten part of the first string is
+*               returned.  With amount, short strings are joined up to that
+*               amount (useful to avoid tiny TLS records).  The string
+*               originally pushed is returned when possible, so no copy is
+*               made.
+***************************************************************************/
+
+static int wqueuemeta_peek(lua_State *L)
+{
+  wqueue__t   *queue = luaL_checkudata(L,1,TYPE_WQUEUE);
+  size_t       max   = queue->bytes;
+  size_t       len;
+  char const  *data;
+  int          uv;
+  
+  lua_settop(L,2);
+  if (!lua_isnoneornil(L,2))
+  {
+    lua_Integer amount = luaL_checkinteger(L,2);
+    if (amount < 1)
+      amount = 1;
+    if ((lua_Integer)max > amount)
+      max = amount;
+  }
+  
+  if (queue->bytes == 0)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  
+  lua_getuservalue(L,1);
+  uv = lua_gettop(L);
+  lua_rawgeti(L,uv,queue->head);
+  data  = lua_tolstring(L,-1,&len);
+  data += queue->offset;
+  len  -= queue->offset;
+  
+  if (lua_isnoneornil(L,2))
+    max = len;
+    
+  if (len == max)
+  {
+    if (queue->offset > 0)
+      lua_pushlstring(L,data,len);
+    return 1;
+  }
+  
+  if (len > max)
+  {
+    lua_pushlstring(L,data,max);
+    return 1;
+  }
+  
+  luaL_Buffer buf;
+  lua_Integer i = queue->head;
+  
+  lua_pop(L,1);
+  luaL_buffinit(L,&buf);
+  luaL_addlstring(&buf,data,len);
+  max -= len;
+  
+  /*---------------------------------------------------------------------
+  ; The string is popped before adding it to the buffer, since luaL_Buffer
+  ; requires balanced stack use between calls.  It's still referenced by
+  ; the uservalue table, so the pointer remains valid.
+  ;----------------------------------------------------------------------*/
+  
+  while (max > 0)
+  {
+    lua_rawgeti(L,uv,++i);
+    data = lua_tolstring(L,-1,&len);
+    lua_pop(L,1);
+    if (len > max)
+      len = max;
+    luaL_addlstring(&buf,data,len);
+    max -= len;
+  }
+  
+  luaL_pushresult(&buf);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        queue = queue:skip(amount)
+* Desc:         Discard data from the front of the queue
+* Input:        amount (integer) amount of data to discard
+* Return:       queue (userdata) write queue
+***************************************************************************/
+
+static int wqueuemeta_skip(lua_State *L)
+{
+  wqueue__t   *queue  = luaL_checkudata(L,1,TYPE_WQUEUE);
+  lua_Integer  amount = luaL_checkinteger(L,2);
+  
+  if (amount > 0)
+  {
+    if ((lua_Integer)queue->bytes < amount)
+      amount = queue->bytes;
+    lua_getuservalue(L,1);
+    wqueue_consume(L,queue,amount);
+  }
+  
+  lua_settop(L,1);
+  return 1;
+}
+
+/**************************************************************************
+* Usage:        bytes,err = queue:writev(fd)
+* Desc:         Write as much of the queue as possible to a file descriptor
+* Input:        fd (integer) file descriptor
+* Return:       bytes (integer) bytes written (and removed), -1 on error
+*               err (integer) system error, 0 on success
+*
+* Note:         At most WQUEUE_IOV strings are written per call.
+***************************************************************************/
+
+static int wqueuemeta_writev(lua_State *L)
+{
+  wqueue__t    *queue = luaL_checkudata(L,1,TYPE_WQUEUE);
+  int           fd    = luaL_checkinteger(L,2);
+  struct iovec  iov[WQUEUE_IOV];
+  int           cnt   = 0;
+  ssize_t       bytes;
+  
+  lua_settop(L,2);
+  lua_getuservalue(L,1);
+  
+  for (lua_Integer i = queue->head ; (i < queue->tail) && (cnt < WQUEUE_IOV) ; i++)
+  {
+    size_t      len;
+    char const *data;
+    
+    /*-------------------------------------------------------------------
+    ; The strings are referenced from the uservalue table, so the pointers
+    ; stay valid after they're popped off the stack.
+    ;--------------------------------------------------------------------*/
+    
+    lua_rawgeti(L,3,i);
+    data = lua_tolstring(L,-1,&len);
+    lua_pop(L,1);
+    
+    if (i == queue->head)
+    {
+      data += queue->offset;
+      len  -= queue->offset;
+    }
+    
+    iov[cnt].iov_base = (void *)data;
+    iov[cnt].iov_len  = len;
+    cnt++;
+  }
+  
+  if (cnt == 0)
+    bytes = 0;
+  else
+  {
+    bytes = writev(fd,iov,cnt);
+    if (bytes < 0)
+    {
+      lua_pushinteger(L,-1);
+      lua_pushinteger(L,errno);
+      return 2;
+    }
+  }
+  
+  wqueue_consume(L,queue,bytes);
+  lua_pushinteger(L,bytes);
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/**************************************************************************
+* Usage:        queue = queue:clear()
+* Desc:         Discard all data in the queue
+* Return:       queue (userdata) write queue
+***************************************************************************/
+
+static int wqueuemeta_clear(lua_State *L)
+{
+  wqueue__t *queue = luaL_checkudata(L,1,TYPE_WQUEUE);
+  
+  queue->bytes  = 0;
+  queue->offset = 0;
+  queue->head   = 1;
+  queue->tail   = 1;
+  lua_createtable(L,0,0);
+  lua_setuservalue(L,1);
+  lua_settop(L,1);
+  return 1;
+}
+
+/*************************************************************************/
+
+static int wqueuemeta___len(lua_State *L)
+{
+  wqueue__t *queue = luaL_checkudata(L,1,TYPE_WQUEUE);
+  lua_pushinteger(L,queue->bytes);
+  return 1;
+}
+
+/*************************************************************************/
+
+static int wqueuemeta___tostring(lua_State *L)
+{
+  lua_pushfstring(L,"wqueue (%p)",lua_touserdata(L,1));
+  return 1;
+}
+
+/*************************************************************************/
+
+int luaopen_org_conman_wqueue(lua_State *L)
+{
+  static struct luaL_Reg const mwqueue_meta[] =
+  {
+    { "push"       , wqueuemeta_push       } ,
+    { "peek"       , wqueuemeta_peek       } ,
+    { "skip"       , wqueuemeta_skip       } ,
+    { "writev"     , wqueuemeta_writev     } ,
+    { "clear"      , wqueuemeta_clear      } ,
+    { "__len"      , wqueuemeta___len      } ,
+    { "__tostring" , wqueuemeta___tostring } ,
+    { NULL         , NULL                  }
+  };
+  
+  luaL_newmetatable(L,TYPE_WQUEUE);
+  luaL_setfuncs(L,mwqueue_meta,0);
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  
+  lua_pushcfunction(L,wqueuelua);
+  return 1;
+}
+
+/**************************************************************************/
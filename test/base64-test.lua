@@ -76,7 +76,7 @@ local tests =
   },
 }
 
-tap.plan(#tests * 5 + 4)
+tap.plan(#tests * 5 + 4 + #tests * 4)
 
 for _,t in ipairs(tests) do
   local b = base64(t)
@@ -97,6 +97,56 @@ for _,t in ipairs(tests) do
   tap.assert(y == data,"%s: decoding data check",t.name)
 end
 
+-- ----------------------------------------------------------------------
+-- Long runs are done in blocks, with the rest (and line breaks) done a
+-- group at a time, so check every length up to a few blocks.
+-- ----------------------------------------------------------------------
+
+for _,t in ipairs(tests) do
+  local b    = base64(t)
+  local okay = true
+  local crlf = true
+  
+  for i = 0 , 100 do
+    local src = data:sub(i + 1,i * 2 + 1)
+    local x   = b:encode(src)
+    if b:decode(x) ~= src then
+      okay = false
+    end
+    if t.len > 0 and b:decode((x:gsub("\n","\r\n"))) ~= src then
+      crlf = false
+    end
+  end
+  tap.assert(okay,"%s: round trip of all lengths",t.name)
+  tap.assert(crlf,"%s: round trip with CRLF",t.name)
+end
+
+-- ----------------------------------------------------------------------
+-- The encoder and decoder objects, given the data in pieces, should come
+-- up with the same thing as doing it all at once.
+-- ----------------------------------------------------------------------
+
+for _,t in ipairs(tests) do
+  local b    = base64(t)
+  local x    = b:encode(data)
+  local enc  = b:encoder()
+  local dec  = b:decoder()
+  local out  = {}
+  local back = {}
+  
+  for i = 1 , #data , 7 do
+    table.insert(out,enc:update(data:sub(i,i + 6)))
+  end
+  table.insert(out,enc:finish())
+  tap.assert(table.concat(out) == x,"%s: encoder",t.name)
+  
+  for i = 1 , #x , 5 do
+    table.insert(back,dec:update(x:sub(i,i + 4)))
+  end
+  table.insert(back,dec:finish())
+  tap.assert(table.concat(back) == data,"%s: decoder",t.name)
+end
+
 local b = base64 { strict = true }
 local y = b:decode("QQ==")
 tap.assert(y,"strict mode: decoding good data")
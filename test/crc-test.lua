@@ -0,0 +1,69 @@
+-- luacheck: ignore 611
+
+local tap = require "tap14"
+local crc = require "org.conman.crc"
+
+local CHECK = "123456789"
+local data  = "" do
+  for i = 0 , 1023 do
+    data = data .. string.char((i * 7 + math.floor(i / 3)) % 256)
+  end
+end
+
+local types = { "crc32" , "crc32c" }
+if crc.crc64 then
+  table.insert(types,"crc64")
+end
+
+tap.plan(4 + #types * 4)
+
+tap.assert(crc(CHECK)           == 0xCBF43926,"crc(): check value")
+tap.assert(crc.crc32(CHECK)     == 0xCBF43926,"crc32: check value")
+tap.assert(crc.crc32c(CHECK)    == 0xE3069283,"crc32c: check value")
+if crc.crc64 then
+  tap.assert(crc.crc64(CHECK) == math.tointeger(0x995DC9BBDF1939FA),"crc64: check value")
+else
+  tap.assert(true,"crc64: not supported")
+end
+
+for _,name in ipairs(types) do
+  local f     = crc[name]
+  local whole = f(data)
+  
+  -- --------------------------------------------------------------------
+  -- Lengths that don't divide into eight bytes, and unaligned starts,
+  -- take a different path through the table code.
+  -- --------------------------------------------------------------------
+  
+  local okay = true
+  for i = 1 , 17 do
+    local oneshot = f(data:sub(i,-1))
+    for j = i , i + 40 do
+      if f(data:sub(j + 1,-1),f(data:sub(i,j))) ~= oneshot then
+        okay = false
+      end
+    end
+  end
+  tap.assert(okay,"%s: continued",name)
+  
+  okay = true
+  for i = 0 , #data , 61 do
+    local c1 = f(data:sub(1,i))
+    local c2 = f(data:sub(i + 1,-1))
+    if crc.combine(c1,c2,#data - i,name) ~= whole then
+      okay = false
+    end
+  end
+  tap.assert(okay,"%s: combine",name)
+  
+  local obj = crc.new(name)
+  for i = 1 , #data , 100 do
+    obj:update(data:sub(i,i + 99))
+  end
+  tap.assert(obj:value() == whole,"%s: object",name)
+  
+  obj:reset()
+  tap.assert(obj:update(CHECK):value() == f(CHECK),"%s: reset",name)
+end
+
+os.exit(tap.done())
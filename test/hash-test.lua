@@ -0,0 +1,357 @@
+-- luacheck: ignore 611
+
+local tap  = require "tap14"
+local hash = require "org.conman.hash"
+local _    = require "org.conman.fsys" -- _tofd() for files
+
+local function X(s)
+  return (s:gsub("%x%x",function(c) return string.char(tonumber(c,16)) end))
+end
+
+local function H(s)
+  return (s:gsub(".",function(c) return string.format("%02x",c:byte()) end))
+end
+
+-- ************************************************************************
+-- HMAC (RFC-4231, plus SHA3, whose block sizes are larger than any other)
+-- ************************************************************************
+
+local hmac =
+{
+  { "sha256" , X"0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b" ,
+    "Hi There" ,
+    "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7" ,
+    "RFC-4231 case 1" } ,
+  { "sha512" , X"0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b" ,
+    "Hi There" ,
+    "87aa7cdea5ef619d4ff0b4241a1d6cb02379f4e2ce4ec2787ad0b30545e17cdedaa833b7d6b8a702038b274eaea3f4e4be9d914eeb61f1702e696c203a126854" ,
+    "RFC-4231 case 1" } ,
+  { "sha256" , "Jefe" ,
+    "what do ya want for nothing?" ,
+    "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" ,
+    "RFC-4231 case 2" } ,
+  { "sha512" , "Jefe" ,
+    "what do ya want for nothing?" ,
+    "164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea2505549758bf75c05a994a6d034f65f8f0e6fdcaeab1a34d4a6b4b636e070a38bce737" ,
+    "RFC-4231 case 2" } ,
+  { "sha256" , X"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa" ,
+    X(string.rep("dd",50)) ,
+    "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe" ,
+    "RFC-4231 case 3" } ,
+  { "sha512" , X"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa" ,
+    X(string.rep("dd",50)) ,
+    "fa73b0089d56a284efb0f0756c890be9b1b5dbdd8ee81a3655f83e33b2279d39bf3e848279a722c806b485a47e67c807b946a337bee8942674278859e13292fb" ,
+    "RFC-4231 case 3" } ,
+  { "sha256" , X"0102030405060708090a0b0c0d0e0f10111213141516171819" ,
+    X(string.rep("cd",50)) ,
+    "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b" ,
+    "RFC-4231 case 4" } ,
+  { "sha512" , X"0102030405060708090a0b0c0d0e0f10111213141516171819" ,
+    X(string.rep("cd",50)) ,
+    "b0ba465637458c6990e5a8c5f61d4af7e576d97ff94b872de76f8050361ee3dba91ca5c11aa25eb4d679275cc5788063a5f19741120c4f2de2adebeb10a298dd" ,
+    "RFC-4231 case 4" } ,
+  { "sha256" , X(string.rep("aa",131)) ,
+    "Test Using Larger Than Block-Size Key - Hash Key First" ,
+    "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" ,
+    "RFC-4231 case 6" } ,
+  { "sha512" , X(string.rep("aa",131)) ,
+    "Test Using Larger Than Block-Size Key - Hash Key First" ,
+    "80b24263c7c1a3ebb71493c1dd7be8b49b46d1f41b4aeec1121b013783f8f3526b56d037e05f2598bd0fd2215d6a1e5295e64f73f63f0aec8b915a985d786598" ,
+    "RFC-4231 case 6" } ,
+  { "sha256" , X(string.rep("aa",131)) ,
+    "This is a test using a larger than block-size key and a larger than block-size data. The key needs to be hashed before being used by the HMAC algorithm." ,
+    "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2" ,
+    "RFC-4231 case 7" } ,
+  { "sha512" , X(string.rep("aa",131)) ,
+    "This is a test using a larger than block-size key and a larger than block-size data. The key needs to be hashed before being used by the HMAC algorithm." ,
+    "e37b6a775dc87dbaa4dfa9f96e5e3ffddebd71f8867289865df5a32d20cdc944b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58" ,
+    "RFC-4231 case 7" } ,
+  { "sha3-256" , "key" ,
+    "The quick brown fox jumps over the lazy dog" ,
+    "8c6e0683409427f8931711b10ca92a506eb1fafa48fadd66d76126f47ac2c333" ,
+    "SHA3-256" } ,
+  { "sha3-224" , X(string.rep("aa",200)) ,
+    "The quick brown fox jumps over the lazy dog" ,
+    "ad85b16eaa28b23044568444672ee71e981e65cca215af4440a13a48" ,
+    "SHA3-224 (long key)" } ,
+}
+
+-- ************************************************************************
+-- PBKDF2 (RFC-6070, plus SHA3)
+-- ************************************************************************
+
+local pbkdf2 =
+{
+  { "password" , "salt" , 1 , 20 , "sha1" ,
+    "0c60c80f961f0e71f3a9b524af6012062fe037a6" } ,
+  { "password" , "salt" , 2 , 20 , "sha1" ,
+    "ea6c014dc72d6f8ccd1ed92ace1d41f0d8de8957" } ,
+  { "password" , "salt" , 4096 , 20 , "sha1" ,
+    "4b007901b765489abead49d926f721d065a429c1" } ,
+  { "passwordPASSWORDpassword" , "saltSALTsaltSALTsaltSALTsaltSALTsalt" , 4096 , 25 , "sha1" ,
+    "3d2eec4fe41c849b80c8d83662c0e44a8b291a964cf2f07038" } ,
+  { "pass\0word" , "sa\0lt" , 4096 , 16 , "sha1" ,
+    "56fa6aa75548099dcc37d7f03425e0c3" } ,
+  { "password" , "salt" , 4096 , 32 , "sha3-256" ,
+    "778b6e237a0f49621549ff70d218d2080756b9fb38d71b5d7ef447fa2254af61" } ,
+}
+
+-- ************************************************************************
+-- HKDF (RFC-5869, plus SHA3)
+-- ************************************************************************
+
+local hkdf =
+{
+  { X"0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b" ,
+    X"000102030405060708090a0b0c" ,
+    X"f0f1f2f3f4f5f6f7f8f9" ,
+    42 , "sha256" ,
+    "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865" ,
+    "RFC-5869 case 1" } ,
+  { X"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f404142434445464748494a4b4c4d4e4f" ,
+    X"606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9fa0a1a2a3a4a5a6a7a8a9aaabacadaeaf" ,
+    X"b0b1b2b3b4b5b6b7b8b9babbbcbdbebfc0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedfe0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff" ,
+    82 , "sha256" ,
+    "b11e398dc80327a1c8e7f78c596a49344f012eda2d4efad8a050cc4c19afa97c59045a99cac7827271cb41c65e590e09da3275600c2f09b8367793a9aca3db71cc30c58179ec3e87c14c01d5c1f3434f1d87" ,
+    "RFC-5869 case 2" } ,
+  { X"0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b" ,
+    X"" ,
+    X"" ,
+    42 , "sha256" ,
+    "8da4e775a563c18f715f802a063c5a31b8a11f5c5ee1879ec3454e5f3c738d2d9d201395faa4b61a96c8" ,
+    "RFC-5869 case 3" } ,
+  { X"0b0b0b0b0b0b0b0b0b0b0b" ,
+    X"000102030405060708090a0b0c" ,
+    X"f0f1f2f3f4f5f6f7f8f9" ,
+    42 , "sha1" ,
+    "085a01ea1b10f36933068b56efa5ad81a4f14b822f5b091568a9cdd4f155fda2c22e422478d305f3f896" ,
+    "RFC-5869 case 4" } ,
+  { X"0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c" ,
+    X"" ,
+    X"" ,
+    42 , "sha1" ,
+    "2c91117204d745f3500d636a62f64f0ab3bae548aa53d423b0d1f27ebba6f5e5673a081d70cce7acfc48" ,
+    "RFC-5869 case 7" } ,
+  { X"0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b" ,
+    X"000102030405060708090a0b0c" ,
+    X"f0f1f2f3f4f5f6f7f8f9" ,
+    42 , "sha3-256" ,
+    "0c5160501d65021deaf2c14f5abce04c5bd2635abceeba61c2edb6e8ed72674900557728f2c9f2c4c179" ,
+    "SHA3-256" } ,
+}
+
+-- ************************************************************************
+-- XXH3 sanity vectors from the xxHash test suite.  The buffer is generated
+-- the same way; lengths cover each code path (0, 1-3, 4-8, 9-16, 17-128,
+-- 129-240 and the long hash, with and without a partial stripe).
+-- ************************************************************************
+
+local PRIME64 = math.tointeger and math.tointeger(0x9E3779B185EBCA8D)
+local sanity  = "" do
+  if math.tointeger then
+    local gen = 2654435761
+    local t   = {}
+    for i = 1 , 4587 do
+      t[i] = string.pack(">i8",gen):sub(1,1)
+      gen  = gen * PRIME64
+    end
+    sanity = table.concat(t)
+  end
+end
+
+local xxh3 =
+{
+  {    0 , 0       , "2D06800538D394C2" , "99AA06D3014798D86001C324468D497F" } ,
+  {    0 , PRIME64 , "A8A6B918B2F0364A" , "00FEAA732A3CE25EA986DFC5D7605BFE" } ,
+  {    1 , 0       , "C44BDFF4074EECDB" , "A6CD5E9392000F6AC44BDFF4074EECDB" } ,
+  {    1 , PRIME64 , "032BE332DD766EF8" , "20E49ABCC53B3842032BE332DD766EF8" } ,
+  {    6 , 0       , "27B56A84CD2D7325" , "082AFE0B8162D12A3E7039BDDA43CFC6" } ,
+  {    6 , PRIME64 , "84589C116AB59AB9" , "014BD95A51CA5DDBC5B54D56038E4E40" } ,
+  {   12 , 0       , "A713DAF0DFBB77E7" , "6E3EFD8FC7802B18061A192713F69AD9" } ,
+  {   12 , PRIME64 , "E7303E1B2336DE0E" , "FF0D60ACD02ED4015D92B5D7190B12D1" } ,
+  {   24 , 0       , "A3FE70BF9D3510EB" , "0CE966E4678D37611E7044D28B1B901D" } ,
+  {   24 , PRIME64 , "850E80FC35BDD690" , "D7895DED1F62559DC6CBF92A70680B19" } ,
+  {   48 , 0       , "397DA259ECBA1F11" , "A002AC4E5478227EF942219AED80F67B" } ,
+  {   48 , PRIME64 , "ADC2CBAA44ACC616" , "BC689F4C0152FB443A94D91333ED395A" } ,
+  {   80 , 0       , "BCDEFBBB2C47C90A" , "FDF2CEFDE9EAAC8A454AE6BF7A8A532D" } ,
+  {   80 , PRIME64 , "C6DD0CB699532E73" , "19BF02D69BC56833A5EAC764D1FF1166" } ,
+  {  195 , 0       , "CD94217EE362EC3A" , "7729543A26B207EE3FB593C086A66075" } ,
+  {  195 , PRIME64 , "BA68003D370CB3D9" , "0326104C4D4849E7CF9D9EC2C8C9913F" } ,
+  {  403 , 0       , "CDEB804D65C6DEA4" , "1B6DE21E332DD73DCDEB804D65C6DEA4" } ,
+  {  403 , PRIME64 , "6259F6ECFD6443FD" , "BED311971E0BE8F26259F6ECFD6443FD" } ,
+  {  512 , 0       , "617E49599013CB6B" , "18D2D110DCC9BCA1617E49599013CB6B" } ,
+  {  512 , PRIME64 , "3CE457DE14C27708" , "925D06B8EC5B80403CE457DE14C27708" } ,
+  { 2048 , 0       , "DD59E2C3A5F038E0" , "F736557FD47073A5DD59E2C3A5F038E0" } ,
+  { 2048 , PRIME64 , "66F81670669ABABC" , "23CC3A2E75EBAAEA66F81670669ABABC" } ,
+  { 2099 , 0       , "C6B9D9B3FC9AC765" , "AD48AE0A0951DC52C6B9D9B3FC9AC765" } ,
+  { 2099 , PRIME64 , "184F316843663974" , "EF4C13B1D2FDAD6E184F316843663974" } ,
+  { 2240 , 0       , "6E73A90539CF2948" , "CCB134FBFA7CE49D6E73A90539CF2948" } ,
+  { 2240 , PRIME64 , "757BA8487D1B5247" , "E40842F585875BA9757BA8487D1B5247" } ,
+  { 2367 , 0       , "CB37AEB9E5D361ED" , "E89C0F6FF369B427CB37AEB9E5D361ED" } ,
+  { 2367 , PRIME64 , "D2DB3415B942B42A" , "CCB7A94CCA1A6496D2DB3415B942B42A" } ,
+  { 4587 , 0       , "F5F15784B002ADD6" , "E9C96842BDA47568F5F15784B002ADD6" } ,
+  { 4587 , PRIME64 , "8CAC10B1CCE1BA72" , "BF8BA2082F1CFE028CAC10B1CCE1BA72" } ,
+}
+
+-- ************************************************************************
+-- SipHash-2-4 vectors from the SipHash paper: key 00..0F, message of
+-- length 0 to 63 of 00, 01, 02, ...
+-- ************************************************************************
+
+local siphash =
+{
+  "310e0edd47db6f72" , "fd67dc93c539f874" , "5a4fa9d909806c0d" , "2d7efbd796666785" ,
+  "b7877127e09427cf" , "8da699cd64557618" , "cee3fe586e46c9cb" , "37d1018bf50002ab" ,
+  "6224939a79f5f593" , "b0e4a90bdf82009e" , "f3b9dd94c5bb5d7a" , "a7ad6b22462fb3f4" ,
+  "fbe50e86bc8f1e75" , "903d84c02756ea14" , "eef27a8e90ca23f7" , "e545be4961ca29a1" ,
+  "db9bc2577fcc2a3f" , "9447be2cf5e99a69" , "9cd38d96f0b3c14b" , "bd6179a71dc96dbb" ,
+  "98eea21af25cd6be" , "c7673b2eb0cbf2d0" , "883ea3e395675393" , "c8ce5ccd8c030ca8" ,
+  "94af49f6c650adb8" , "eab8858ade92e1bc" , "f315bb5bb835d817" , "adcf6b0763612e2f" ,
+  "a5c91da7acaa4dde" , "716595876650a2a6" , "28ef495c53a387ad" , "42c341d8fa92d832" ,
+  "ce7cf2722f512771" , "e37859f94623f3a7" , "381205bb1ab0e012" , "ae97a10fd434e015" ,
+  "b4a31508beff4d31" , "81396229f0907902" , "4d0cf49ee5d4dcca" , "5c73336a76d8bf9a" ,
+  "d0a704536ba93e0e" , "925958fcd6420cad" , "a915c29bc8067318" , "952b79f3bc0aa6d4" ,
+  "f21df2e41d4535f9" , "87577519048f53a9" , "10a56cf5dfcd9adb" , "eb75095ccd986cd0" ,
+  "51a9cb9ecba312e6" , "96afadfc2ce666c7" , "72fe52975a4364ee" , "5a1645b276d592a1" ,
+  "b274cb8ebf87870a" , "6f9bb4203de7b381" , "eaecb2a30b22a87f" , "9924a43cc1315724" ,
+  "bd838d3aafbf8db7" , "0b1a2a3265d51aea" , "135079a3231ce660" , "932b2846e4d70666" ,
+  "e1915f5cb1eca46c" , "f325965ca16d629f" , "575ff28e60381be5" , "724506eb4c328a95" ,
+}
+
+local SIPMSG = "" do
+  for i = 0 , 63 do SIPMSG = SIPMSG .. string.char(i) end
+end
+
+local SIPKEY = SIPMSG:sub(1,16)
+
+tap.plan(#hmac * 3 + 2 + #pbkdf2 + #hkdf + 1 + 3 + 2 + 5 + 5)
+
+for _,t in ipairs(hmac) do
+  local key = hash.hmac(t[1],t[2])
+  tap.assert(key and key:sumhexa(t[3]):lower() == t[4],"hmac %s: %s",t[1],t[5])
+  
+  local ctx = key:new()
+  for i = 1 , #t[3] , 7 do
+    ctx:update(t[3]:sub(i,i + 6))
+  end
+  tap.assert(H(ctx:final()) == t[4],"hmac %s: %s (piecemeal)",t[1],t[5])
+  tap.assert(key:verify(t[3],X(t[4])),"hmac %s: %s (verify)",t[1],t[5])
+end
+
+local key = hash.hmac("sha256","key")
+tap.assert(not key:verify("data",string.rep("\0",32)),"hmac: verify fails")
+tap.assert(hash.hmac("no-such-hash","key") == nil,"hmac: unknown algorithm")
+
+for _,t in ipairs(pbkdf2) do
+  tap.assert(H(hash.pbkdf2(t[1],t[2],t[3],t[4],t[5])) == t[6],"pbkdf2 %s: %d iterations",t[5],t[3])
+end
+
+for _,t in ipairs(hkdf) do
+  tap.assert(H(hash.hkdf(t[1],t[4],t[2],t[3],t[5])) == t[6],"hkdf %s: %s",t[5],t[7])
+end
+
+tap.assert(not pcall(hash.hkdf,"ikm",255 * 32 + 1),"hkdf: size limit")
+
+-- ************************************************************************
+-- The native hashes
+-- ************************************************************************
+
+if math.tointeger then
+  local okay64  = true
+  local okay128 = true
+  local okayint = true
+  
+  for _,t in ipairs(xxh3) do
+    local data = sanity:sub(1,t[1])
+    local seed = t[2]
+    
+    if hash.sumhexa(data,"xxh3",seed) ~= t[3] then okay64 = false end
+    if hash.sumhexa(data,"xxh3-128",seed) ~= t[4] then okay128 = false end
+    if string.format("%016X",hash.xxh3(data,seed)) ~= t[3] then okayint = false end
+  end
+  
+  tap.assert(okay64,"xxh3: sanity vectors")
+  tap.assert(okay128,"xxh3-128: sanity vectors")
+  tap.assert(okayint,"hash.xxh3(): sanity vectors")
+  
+  local okay = true
+  okayint    = true
+  for i = 0 , 63 do
+    local msg = SIPMSG:sub(1,i)
+    if H(hash.sum(msg,"siphash",SIPKEY)) ~= siphash[i + 1] then okay = false end
+    if string.format("%016x",hash.siphash(msg,SIPKEY)) ~= H(hash.sum(msg,"siphash",SIPKEY):reverse()) then
+      okayint = false
+    end
+  end
+  tap.assert(okay,"siphash: paper vectors")
+  tap.assert(okayint,"hash.siphash(): paper vectors")
+else
+  for _ = 1 , 5 do
+    tap.assert(true,"# SKIP needs Lua 5.3 or higher")
+  end
+end
+
+-- ************************************************************************
+-- Piecemeal hashing gives the same result as all at once, with pieces
+-- that straddle the internal buffers.
+-- ************************************************************************
+
+local big = "" do
+  local t = {}
+  for i = 1 , 70000 do
+    t[i] = string.char((i * 131 + math.floor(i / 32)) % 256)
+  end
+  big = table.concat(t)
+end
+
+for _,alg in ipairs { "sha256" , "xxh3" , "xxh3-128" , "siphash" , "md5" } do
+  local key = alg == "siphash" and SIPKEY or nil
+  local ctx = hash.new(alg,key)
+  local i   = 1
+  local n   = 1
+  
+  while i <= #big do
+    ctx:update(big:sub(i,i + n - 1))
+    i = i + n
+    n = n * 3 % 1021 + 1
+  end
+  tap.assert(ctx:final() == hash.sum(big,alg,key),"%s: piecemeal",alg)
+end
+
+-- ************************************************************************
+-- Files, file descriptors and several hashes at once
+-- ************************************************************************
+
+local name = os.tmpname()
+local f    = io.open(name,"wb")
+f:write(big)
+f:close()
+
+local fh,ferr = hash.file(name,"sha256")
+tap.assert(fh == hash.sum(big,"sha256") and ferr == 0,"hash.file(): matches hash.sum()")
+
+local ctx = hash.new("xxh3")
+f = io.open(name,"rb")
+f:setvbuf("no")
+f:seek("set",1000)
+tap.assert(ctx:update_fd(f) and ctx:final() == hash.sum(big:sub(1001,-1),"xxh3"),"ctx:update_fd(): from current position")
+f:close()
+
+ctx = hash.new("sha256")
+f   = io.open(name,"rb")
+local line = f:read("*l") -- leaves the rest of a block in the stdio buffer
+tap.assert(ctx:update_fd(f) and ctx:final() == hash.sum(big:sub(#line + 2,-1),"sha256"),"ctx:update_fd(): after a buffered read")
+tap.assert(f:read(1) == nil,"ctx:update_fd(): file left at the end")
+f:close()
+os.remove(name)
+
+local multi = hash.multi { "md5" , "sha1" , "xxh3" }
+multi:update(big:sub(1,12345))
+multi:update(big:sub(12346,-1))
+local sums = multi:final()
+tap.assert(
+        sums.md5 == hash.sum(big,"md5") and sums.sha1 == hash.sum(big,"sha1") and sums.xxh3 == hash.sum(big,"xxh3"),
+        "multi: same as each hash on its own"
+)
+
+os.exit(tap.done())
@@ -0,0 +1,136 @@
+-- luacheck: ignore 611
+
+local tap   = require "tap14"
+local iconv = require "org.conman.iconv"
+local errno = require "org.conman.errno"
+
+local EILSEQ = errno.EILSEQ
+local EINVAL = errno.EINVAL
+
+-- ************************************************************************
+-- Each conversion done natively, with the results (and errors) iconv()
+-- gives: { to , from , input , output , err , idx , description }
+-- ************************************************************************
+
+local tests =
+{
+  { "ISO-8859-1" , "UTF-8" , "caf\195\169" , "caf\233" , 0 , nil , "valid" } ,
+  { "ISO-8859-1" , "UTF-8" , "a\226\130\172b" , nil , EILSEQ , 2 , "not in Latin-1" } ,
+  { "ISO-8859-1" , "UTF-8" , "ab\128" , nil , EILSEQ , 3 , "bad sequence" } ,
+  { "ISO-8859-1" , "UTF-8" , "a\192\128" , nil , EILSEQ , 2 , "overlong" } ,
+  { "ISO-8859-1" , "UTF-8" , "ab\195" , nil , EINVAL , 3 , "incomplete" } ,
+  { "ISO-8859-1" , "UTF-8" , "x\243\160\129\131y" , "xy" , 0 , nil , "tag character dropped" } ,
+  
+  { "UTF-8" , "ISO-8859-1" , "caf\233 \255" , "caf\195\169 \195\191" , 0 , nil , "valid" } ,
+  
+  { "UTF-16LE" , "UTF-8" , "A\195\169\240\159\152\128" , "A\0\233\0\61\216\0\222" , 0 , nil , "valid" } ,
+  { "UTF-16LE" , "UTF-8" , "ab\237\160\128" , nil , EILSEQ , 3 , "surrogate" } ,
+  { "UTF-16LE" , "UTF-8" , "a\244\144\128\128" , nil , EILSEQ , 2 , "past U+10FFFF" } ,
+  { "UTF-16LE" , "UTF-8" , "ab\240\159\152" , nil , EINVAL , 3 , "incomplete" } ,
+  
+  { "UTF-16BE" , "UTF-8" , "A\195\169\240\159\152\128" , "\0A\0\233\216\61\222\0" , 0 , nil , "valid" } ,
+  { "UTF-16BE" , "UTF-8" , "a\255" , nil , EILSEQ , 2 , "bad byte" } ,
+  { "UTF-16BE" , "UTF-8" , "a\226\130" , nil , EINVAL , 2 , "incomplete" } ,
+  
+  { "UTF-8" , "UTF-16LE" , "A\0\233\0\61\216\0\222" , "A\195\169\240\159\152\128" , 0 , nil , "valid" } ,
+  { "UTF-8" , "UTF-16LE" , "A\0\0\220" , nil , EILSEQ , 3 , "lone low surrogate" } ,
+  { "UTF-8" , "UTF-16LE" , "\61\216A\0" , nil , EILSEQ , 1 , "unpaired high surrogate" } ,
+  { "UTF-8" , "UTF-16LE" , "A\0B" , nil , EINVAL , 3 , "odd length" } ,
+  { "UTF-8" , "UTF-16LE" , "A\0\61\216" , nil , EINVAL , 3 , "incomplete pair" } ,
+  
+  { "UTF-8" , "UTF-16BE" , "\0A\0\233\216\61\222\0" , "A\195\169\240\159\152\128" , 0 , nil , "valid" } ,
+  { "UTF-8" , "UTF-16BE" , "\0A\220\0" , nil , EILSEQ , 3 , "lone low surrogate" } ,
+  { "UTF-8" , "UTF-16BE" , "\0A\216\61" , nil , EINVAL , 3 , "incomplete pair" } ,
+}
+
+tap.plan(#tests + 2 + 10)
+
+for _,t in ipairs(tests) do
+  local trans       = iconv(t[1],t[2])
+  local out,err,idx = trans(t[3])
+  tap.assert(
+          out == t[4] and err == t[5] and idx == t[6],
+          "%s from %s: %s",t[1],t[2],t[7]
+  )
+end
+
+local text  = "plain ASCII text"
+local trans = iconv("utf8","latin1")
+tap.assert(trans(text) == text,"ASCII passes through")
+
+-- ************************************************************************
+-- Converters not done natively are cached when collected; the next one
+-- opened must start in the initial state.
+-- ************************************************************************
+
+local jis = iconv("ISO-2022-JP","UTF-8")
+jis("\227\129\130")
+jis = nil -- luacheck: ignore
+collectgarbage()
+collectgarbage()
+jis = iconv("ISO-2022-JP","UTF-8")
+tap.assert(jis("a") == "a","cached converter is reset")
+
+-- ************************************************************************
+-- Streams.  A sequence split between two calls to update() is held until
+-- the rest shows up, and error indices are from the start of the stream.
+-- ************************************************************************
+
+local stream = iconv("UTF-16LE","UTF-8")
+local a1,e1  = stream:update("a\226")
+local a2,e2  = stream:update("\130\172")
+local a3,e3  = stream:finish()
+tap.assert(
+        a1 == "a\0" and e1 == 0 and a2 == "\172\32" and e2 == 0 and a3 == "" and e3 == 0,
+        "stream: sequence split across update()"
+)
+
+stream:update("abc")
+local b1,err,idx = stream:update("d\255")
+tap.assert(b1 == nil and err == EILSEQ and idx == 5,"stream: error index from start of stream")
+tap.assert(stream:update("x") == "x\0","stream: reset after error")
+stream:finish()
+
+stream:update("ab\240\159")
+local c1,cerr,cidx = stream:finish()
+tap.assert(c1 == nil and cerr == EINVAL and cidx == 3,"stream: finish() with a held sequence")
+tap.assert(stream:update("y") == "y\0","stream: reset after finish()")
+stream:finish()
+
+local shift = iconv("ISO-2022-JP","UTF-8")
+local s1 = shift:update("\227\129")
+local s2 = shift:update("\130")
+local s3 = shift:finish()
+tap.assert(
+        s1 == "" and s2 == "\27$B$\"" and s3 == "\27(B",
+        "stream: shift sequence flushed by finish()"
+)
+
+-- ------------------------------------------------------------------------
+-- Splitting the input at every point gives the same output as all at once.
+-- ------------------------------------------------------------------------
+
+local splits =
+{
+  { "ISO-8859-1"  , "UTF-8"    , "caf\195\169 \243\160\129\131 na\195\175ve" } ,
+  { "UTF-16BE"    , "UTF-8"    , "A\195\169\226\130\172\240\159\152\128z" } ,
+  { "UTF-8"       , "UTF-16LE" , "A\0\233\0\172\32\61\216\0\222z\0" } ,
+  { "ISO-2022-JP" , "UTF-8"    , "a\227\129\130\227\129\132b" } ,
+}
+
+for _,t in ipairs(splits) do
+  local whole = iconv(t[1],t[2])
+  local want  = whole:update(t[3]) .. whole:finish()
+  local okay  = true
+  
+  for i = 0 , #t[3] do
+    local trans = iconv(t[1],t[2])
+    local got   = trans:update(t[3]:sub(1,i))
+               .. trans:update(t[3]:sub(i + 1,-1))
+               .. trans:finish()
+    if got ~= want then okay = false end
+  end
+  tap.assert(okay,"stream %s from %s: any split",t[1],t[2])
+end
+
+os.exit(tap.done())
@@ -0,0 +1,142 @@
+-- ***************************************************************
+--
+-- Benchmark of the org.conman.net.ios line and header readers.
+--
+-- Usage:       lua ios-bench.lua [iterations]
+--
+-- For a small and a large request header (delivered in MSS sized
+-- chunks), times reading the header with ios:read("*h"), and reading it
+-- line by line with ios:read("*l"), against a reference reader using the
+-- string.find() patterns ios used to use.
+--
+-- ***************************************************************
+-- luacheck: ignore 611
+
+local mkios = require "org.conman.net.ios"
+local clock = require "org.conman.clock"
+
+local ITERATIONS = tonumber(arg[1]) or 2000
+local MSS        = 1460
+
+-- ***************************************************************
+
+local function mkheader(fields)
+  local h = { "GET /index.html HTTP/1.1\r\n" }
+  for i = 1 , fields do
+    h[#h + 1] = string.format("X-Field-%d: %s\r\n",i,string.rep("v",40))
+  end
+  h[#h + 1] = "\r\n"
+  return table.concat(h)
+end
+
+local function chunk(text)
+  local list = {}
+  for i = 1 , #text , MSS do
+    list[#list + 1] = text:sub(i,i + MSS - 1)
+  end
+  return list
+end
+
+-- ***************************************************************
+-- The reader this benchmark compares against, using Lua patterns and
+-- string concatenation.
+-- ***************************************************************
+
+local function reference_h(chunks)
+  local buf  = ""
+  local rpos = 1
+  local i    = 0
+  
+  while true do
+    local s = buf:find("[\r\n]",rpos)
+    if s then
+      local s2 = buf:find("\r?\n",s)
+      if s2 then
+        local _,e3 = buf:find("\r?\n\r?\n",s2)
+        if e3 then
+          return buf:sub(1,e3)
+        end
+      end
+    else
+      rpos = #buf + 1
+    end
+    i   = i + 1
+    buf = buf .. chunks[i]
+  end
+end
+
+local function reference_l(chunks)
+  local buf   = ""
+  local rpos  = 1
+  local i     = 0
+  local count = 0
+  
+  while true do
+    local s = buf:find("[\r\n]",rpos)
+    local s2,e2
+    if s then
+      s2,e2 = buf:find("\r?\n",s)
+    else
+      rpos = #buf + 1
+    end
+    
+    if s2 then
+      local line = buf:sub(1,s2 - 1)
+      buf  = buf:sub(e2 + 1,-1)
+      rpos = 1
+      count = count + 1
+      if line == "" then return count end
+    else
+      i   = i + 1
+      buf = buf .. chunks[i]
+    end
+  end
+end
+
+-- ***************************************************************
+
+local function ios_h(chunks)
+  local ios = mkios()
+  local i   = 0
+  ios._refill = function() i = i + 1 return chunks[i] end
+  return ios:read("*h")
+end
+
+local function ios_l(chunks)
+  local ios   = mkios()
+  local i     = 0
+  local count = 0
+  ios._refill = function() i = i + 1 return chunks[i] end
+  for line in ios:lines() do
+    count = count + 1
+    if line == "" then break end
+  end
+  return count
+end
+
+-- ***************************************************************
+
+local function bench(label,f,chunks)
+  local zen = clock.get('monotonic')
+  for _ = 1 , ITERATIONS do
+    f(chunks)
+  end
+  local elapsed = clock.get('monotonic') - zen
+  print(string.format("%-24s %10.0f headers/sec",label,ITERATIONS / elapsed))
+end
+
+-- ***************************************************************
+
+for _,size in ipairs { { "small" , 5 } , { "large" , 400 } } do
+  local header = mkheader(size[2])
+  local chunks = chunk(header)
+  assert(ios_h(chunks) == header)
+  assert(reference_h(chunks) == header)
+  assert(ios_l(chunks) == reference_l(chunks))
+  
+  print(string.format("%s header: %d bytes in %d chunks",size[1],#header,#chunks))
+  bench("  reference *h",reference_h,chunks)
+  bench("  ios *h",ios_h,chunks)
+  bench("  reference *l",reference_l,chunks)
+  bench("  ios *l",ios_l,chunks)
+end
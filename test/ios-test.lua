@@ -0,0 +1,178 @@
+-- luacheck: ignore 611
+
+local tap   = require "tap14"
+local mkios = require "org.conman.net.ios"
+
+-- ---------------------------------------------------------------------
+-- Create an ios that returns the given chunks of data, one per refill.
+-- ---------------------------------------------------------------------
+
+local function source(...)
+  local chunks = { ... }
+  local ios    = mkios()
+  local i      = 0
+  
+  ios._refill = function()
+    i = i + 1
+    return chunks[i]
+  end
+  
+  ios._drain = function(self,data)
+    self.__output = (self.__output or "") .. data
+    return true
+  end
+  
+  return ios
+end
+
+-- ---------------------------------------------------------------------
+
+tap.plan(10)
+
+tap.plan(5,"lines") do
+  local ios = source("one\r","\ntwo\n","thr","ee\r\nfour")
+  tap.assert(ios:read("*l") == "one",  "CRLF split across refills")
+  tap.assert(ios:read("*L") == "two\n","line with terminator")
+  tap.assert(ios:read("*l") == "three","line split across refills")
+  tap.assert(ios:read("*l") == "four", "last line without terminator")
+  tap.assert(ios:read("*l") == nil,    "EOF")
+  tap.done()
+end
+
+tap.plan(3,"headers") do
+  local ios = source("Host: example.com\r\nAccept: */*\r","\n\r","\nbody")
+  tap.assert(ios:read("*h") == "Host: example.com\r\nAccept: */*\r\n\r\n","header block")
+  tap.assert(ios:read("*a") == "body","remaining data")
+  tap.assert(ios:read("*a") == nil,"EOF")
+  tap.done()
+end
+
+tap.plan(4,"byte counts") do
+  local ios = source("abc","defghij","k")
+  tap.assert(ios:read(2) == "ab","partial chunk")
+  tap.assert(ios:read(6) == "cdefgh","spanning chunks")
+  tap.assert(ios:read(10) == "ijk","short read at EOF")
+  tap.assert(ios:read(1) == nil,"EOF")
+  tap.done()
+end
+
+tap.plan(4,"numbers") do
+  local ios = source("  12"," 0x1F","  -3.5e1 rest")
+  tap.assert(ios:read("*n") == 12,"integer")
+  tap.assert(ios:read("*n") == 31,"hexadecimal")
+  tap.assert(ios:read("*n","*a") == -35,"float, followed by data")
+  
+  ios = source(string.rep("1",150),string.rep("1",150) .. " 5")
+  tap.assert(ios:read("*n") == nil,"too long, like io.read()")
+  tap.done()
+end
+
+tap.plan(5,"binary integers") do
+  local ios = source("\1","\2\0\0\1\0","\4\3\2\1\0\0\0\0\0\0\1\0","\9")
+  tap.assert(ios:readu16() == 0x0102,"16 bits, split across refills")
+  tap.assert(ios:readu32() == 0x00000100,"32 bits")
+  tap.assert(ios:readu32('little') == 0x01020304,"32 bits, little endian")
+  tap.assert(ios:readu64() == 256,"64 bits")
+  tap.assert(ios:readu16() == nil,"short read at EOF")
+  tap.done()
+end
+
+tap.plan(3,"blocks") do
+  local ios = source("first","second")
+  tap.assert(ios:read("*b") == "first","first block")
+  tap.assert(ios:read("*b") == "second","second block")
+  tap.assert((ios:read("*b") or "") == "","no more data")
+  tap.done()
+end
+
+tap.plan(2,"large input") do
+  local line  = string.rep("x",100) .. "\n"
+  local chunk = string.rep(line,1000)
+  local ios   = source(chunk,chunk,chunk)
+  local count = 0
+  
+  for l in ios:lines() do
+    if l == line:sub(1,-2) then
+      count = count + 1
+    end
+  end
+  tap.assert(count == 3000,"all lines read")
+  tap.assert(ios:read("*a") == nil,"EOF")
+  tap.done()
+end
+
+tap.plan(2,"refill into buffer") do
+  local ios   = mkios()
+  local count = 0
+  
+  ios._refill = function(self)
+    count = count + 1
+    if count > 2 then return nil end
+    self._readbuf:append("line ",count,"\n")
+    return true
+  end
+  
+  tap.assert(ios:read("*l") == "line 1","first refill")
+  tap.assert(ios:read("*a") == "line 2\n","rest")
+  tap.done()
+end
+
+tap.plan(6,"output") do
+  local ios = source()
+  ios:write("abc",12)
+  tap.assert(ios.__output == nil,"full buffering holds output")
+  ios:flush()
+  tap.assert(ios.__output == "abc12","flush")
+  
+  ios:setvbuf('line')
+  ios:write("one","two\nthree")
+  tap.assert(ios.__output == "abc12onetwo\nthree","line buffering")
+  
+  ios = source()
+  ios:setvbuf('full',4)
+  ios:write("ab","cd","e")
+  tap.assert(ios.__output == "abcde","buffer full")
+  
+  ios = source()
+  ios:setvbuf('no')
+  ios:write(string.rep("x",10000))
+  tap.assert(#ios.__output == 10000,"no buffering")
+  tap.assert(#ios._writebuf == 0,"queue empty")
+  tap.done()
+end
+
+tap.plan(3,"watermarks") do
+  local ios = source()
+  local out = {}
+  
+  -- -------------------------------------------------------
+  -- Only 3 bytes can be written without waiting.
+  -- -------------------------------------------------------
+  
+  ios._drainv = function(_,queue,low)
+    local room = 3
+    while #queue > (low or 0) do
+      local data = queue:peek()
+      if not low then
+        if room == 0 then break end
+        data = data:sub(1,room)
+        room = room - #data
+      end
+      table.insert(out,data)
+      queue:skip(#data)
+    end
+    return true
+  end
+  
+  ios:setvbuf('full',4)
+  ios:setwatermark(2,10)
+  ios:write("abcdefgh")
+  tap.assert(#ios._writebuf == 5,"under high water mark")
+  ios:write("ijklmnop")
+  tap.assert(#ios._writebuf <= 2,"drained to low water mark")
+  ios:flush()
+  tap.assert(table.concat(out) == "abcdefghijklmnop","all output")
+  tap.done()
+end
+
+os.exit(tap.done(),true)
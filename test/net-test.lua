@@ -1,8 +1,9 @@
 
 -- luacheck: ignore 611
 
-local tap = require "tap14"
-local net = require "org.conman.net"
+local tap   = require "tap14"
+local net   = require "org.conman.net"
+local clock = require "org.conman.clock"
 
 local function compare_lists(a,b)
   if (#a ~= #b) then return false end
@@ -16,7 +17,7 @@ end
 -- Address tests
 -- ---------------------------------------------------------------------
 
-tap.plan(7)
+tap.plan(10)
 
 local function address_test(case)
   tap.plan(10,case.desc)
@@ -173,4 +174,108 @@ table.remove(list2) -- last slot with 0.  So remove that 0.
 table.sort(list1)
 
 tap.assert(compare_lists(list1,list2),"test sortability")
+
+-- ---------------------------------------------------------------------
+-- Descriptor passing
+-- ---------------------------------------------------------------------
+
+tap.plan(8,"descriptor passing") do
+  local s1,s2 = net.socketpair()
+  local p1,p2 = net.socketpair()
+  
+  local bytes,err = s1:sendfds("x",{ p2 })
+  tap.assert(bytes == 1 and err == 0,"sent descriptor")
+  p2:close()
+  
+  local data,fds,err1 = s2:recvfds(1)
+  tap.assert(data == "x" and err1 == 0,"received data")
+  tap.assert(#fds == 1,"received one descriptor")
+  
+  p1:send(nil,"hello")
+  local _,hello = fds[1]:recv(1)
+  tap.assert(hello == "hello","passed descriptor is usable")
+  
+  local _,err2 = s1:sendfds("x",{})
+  tap.assert(err2 ~= 0,"empty descriptor list rejected")
+  
+  local _,_,err3 = s2:recvfds(0)
+  tap.assert(err3 ~= 0,"timeout with nothing pending")
+  
+  local many = {}
+  for i = 1 , 200 do many[i] = p1 end
+  local _,err4 = s1:sendfds("y",many)
+  local _,fds2,err5 = s2:recvfds(1)
+  tap.assert(err4 == 0 and err5 == 0,"passed 200 descriptors")
+  tap.assert(fds2 and #fds2 == 200,"received 200 descriptors")
+  for _,fd in ipairs(fds2 or {}) do fd:close() end
+  tap.done()
+end
+
+-- ---------------------------------------------------------------------
+-- Kernel receive timestamps
+-- ---------------------------------------------------------------------
+
+tap.plan(4,"receive timestamps") do
+  local r = net.socket('ip','udp')
+  local s = net.socket('ip','udp')
+  r:bind(net.address('127.0.0.1','udp',0))
+  
+  r.timestamp = true
+  tap.assert(r.timestamp,"timestamp option set")
+  
+  local zen = clock.get('realtime')
+  s:send(r:addr(),"ping")
+  local _,data,err,when = r:recv(1)
+  local now = clock.get('realtime')
+  tap.assert(data == "ping" and err == 0,"received packet")
+  tap.assert(when and when >= zen - 1 and when <= now + 1,"timestamp comparable to realtime clock")
+  
+  r.timestamp = false
+  s:send(r:addr(),"pong")
+  local _,_,_,when2 = r:recv(1)
+  tap.assert(when2 == nil,"no timestamp when option cleared")
+  tap.done()
+end
+
+-- ---------------------------------------------------------------------
+-- UDP segmentation offload.  If the kernel doesn't support it, the send
+-- fails and the remaining checks are skipped.
+-- ---------------------------------------------------------------------
+
+tap.plan(6,"segmentation offload") do
+  local r = net.socket('ip','udp')
+  local s = net.socket('ip','udp')
+  r:bind(net.address('127.0.0.1','udp',0))
+  
+  tap.assert(not pcall(s.send,s,r:addr(),"x",0),"zero segment size rejected")
+  tap.assert(not pcall(s.send,s,r:addr(),"x",65536),"oversized segment size rejected")
+  
+  local payload = string.rep("a",100) .. string.rep("b",100) .. string.rep("c",50)
+  local bytes,err = s:send(r:addr(),payload,100)
+  
+  if err ~= 0 then
+    tap.comment("UDP_SEGMENT not supported (%d)",err)
+    for _ = 1 , 4 do tap.assert(true,"skipped") end
+  else
+    tap.assert(bytes == #payload,"sent as one buffer")
+    
+    local sizes = {}
+    for i = 1 , 3 do
+      local _,data = r:recv(1)
+      sizes[i] = data and #data or 0
+    end
+    tap.assert(compare_lists(sizes,{ 100 , 100 , 50 }),"split into datagrams")
+    
+    r.udpgro = true
+    s:send(r:addr(),payload,100)
+    local _,data,err2,_,segsize = r:recv(1)
+    tap.assert(data == payload and err2 == 0,"coalesced on receive")
+    tap.assert(segsize == 100,"segment size reported")
+  end
+  
+  r:close()
+  s:close()
+  tap.done()
+end
+
 os.exit(tap.done(),true)
@@ -0,0 +1,69 @@
+-- luacheck: ignore 611
+
+local tap     = require "tap14"
+local strcore = require "org.conman.strcore"
+
+local RUN = string.rep("a",40) -- long enough for the word at a time scans
+
+-- ---------------------------------------------------------------------
+-- Each case is a string, and the index isutf8() should report (false if
+-- the string is valid).
+-- ---------------------------------------------------------------------
+
+local isutf8 =
+{
+  { "plain ASCII"                , RUN                        , false } ,
+  { "empty"                      , ""                         , false } ,
+  { "two, three and four bytes"  , "\195\169\226\130\172\240\159\152\128" , false } ,
+  { "largest code point"         , "\244\143\191\191"         , false } ,
+  { "control characters"         , "\0\t\127"                 , false } ,
+  { "overlong two byte"          , "\192\175"                 , 1     } ,
+  { "overlong three byte"        , "\224\128\175"             , 1     } ,
+  { "overlong four byte"         , "\240\128\128\175"         , 1     } ,
+  { "surrogate"                  , "\237\160\128"             , 1     } ,
+  { "above U+10FFFF"             , "\244\144\128\128"         , 1     } ,
+  { "five byte form"             , "\248\136\128\128\128"     , 1     } ,
+  { "lone continuation byte"     , "ab\128"                   , 3     } ,
+  { "invalid byte"               , "\255"                     , 1     } ,
+  { "bad continuation byte"      , "x\195("                   , 2     } ,
+  { "incomplete at end"          , "ab\226\130"               , 3     } ,
+  { "after a long run"           , RUN .. "\192\175"          , 41    } ,
+  { "after multibyte characters" , "h\195\169\237\160\128"    , 4     } ,
+}
+
+-- ---------------------------------------------------------------------
+
+tap.plan(2)
+
+tap.plan(#isutf8,"isutf8") do
+  for _,case in ipairs(isutf8) do
+    local okay,idx = strcore.isutf8(case[2])
+    if case[3] then
+      tap.assert(not okay and idx == case[3],"%s (got %s)",case[1],tostring(idx))
+    else
+      tap.assert(okay and idx == nil,case[1])
+    end
+  end
+  tap.done()
+end
+
+tap.plan(6,"safeascii/safeutf8") do
+  local safe = RUN .. " ~!@#$%^&*()"
+  local text = "h\195\169 \\ \t" .. RUN .. "\0\192\175"
+  
+  tap.assert(strcore.safeascii(safe) == safe,"safeascii() returns safe text as is")
+  tap.assert(strcore.safeutf8(safe)  == safe,"safeutf8() returns safe text as is")
+  tap.assert(strcore.safeutf8("h\195\169llo") == "h\195\169llo","safeutf8() keeps UTF-8")
+  tap.assert(
+        strcore.safeascii(text) == "h\\195\\169 \\\\ \\t" .. RUN .. "\\000\\192\\175",
+        "safeascii() mixed escapes"
+  )
+  tap.assert(
+        strcore.safeutf8(text) == "h\195\169 \\\\ \\t" .. RUN .. "\\000\\192\\175",
+        "safeutf8() mixed escapes"
+  )
+  tap.assert(strcore.safeutf8("ab\226\130") == "ab\\226\\130","safeutf8() incomplete sequence")
+  tap.done()
+end
+
+os.exit(tap.done(),true)
@@ -0,0 +1,247 @@
+-- ***************************************************************
+--
+-- Benchmark of org.conman.tls over a socket pair.
+--
+-- Usage:       lua tls-bench.lua [seconds [megabytes]]
+--
+-- Generates a throwaway certificate with openssl(1), then measures
+--
+--      * full handshakes per second
+--      * resumed handshakes per second (session tickets, with the
+--        client keeping its session in a file)
+--      * bulk throughput for several read sizes, reading with ctx:read()
+--        and with an org.conman.net.ios object refilled by
+--        ctx:read_into(), the way org.conman.nfl.tls reads.
+--
+-- Both ends run in this process on non-blocking sockets, so when one end
+-- wants input, the other end is run.  Each result is printed on a line of
+-- its own as "name value units" for tracking between runs.
+--
+-- ***************************************************************
+-- luacheck: ignore 611
+
+local tls        = require "org.conman.tls"
+local net        = require "org.conman.net"
+local clock      = require "org.conman.clock"
+local tlssession = require "org.conman.net.tlssession"
+local mkios      = require "org.conman.net.ios"
+local _          = require "org.conman.fsys" -- _tofd() for files
+
+local SECONDS   = tonumber(arg[1]) or 2
+local MEGABYTES = tonumber(arg[2]) or 64
+local WRITESIZE = 16384
+
+-- ***************************************************************
+
+local function mkcert()
+  local dir  = os.tmpname()
+  local cert = dir .. ".crt"
+  local key  = dir .. ".key"
+  
+  os.remove(dir)
+  local okay = os.execute(string.format(
+        "openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1"
+        .. " -nodes -days 1 -subj /CN=localhost -keyout %s -out %s 2>/dev/null",
+        key,cert
+  ))
+  assert(okay == true or okay == 0,"openssl failed")
+  return cert,key
+end
+
+-- ***************************************************************
+
+local function report(name,value,units)
+  print(string.format("%-28s %12.1f %s",name,value,units))
+end
+
+-- ***************************************************************
+
+local CERT,KEY = mkcert()
+local SESSION  = tlssession.new(tlssession.secret())
+
+local sconfig = tls.config()
+assert(sconfig:keypair_file(CERT,KEY),sconfig:error())
+assert(SESSION:configure(sconfig))
+local server = tls.server()
+assert(server:configure(sconfig),server:error())
+
+local function client_config(resume)
+  local config = tls.config()
+  config:insecure_no_verify_cert()
+  config:insecure_no_verify_name()
+  if resume then
+    -- ---------------------------------------------------------------
+    -- Under TLS 1.3 the ticket arrives after the handshake, and not all
+    -- libtls servers issue one, so stick to TLS 1.2 for this.
+    -- ---------------------------------------------------------------
+    config:protocols("tlsv1.2")
+    assert(config:session_fd(io.tmpfile()),config:error())
+  end
+  return config
+end
+
+-- ***************************************************************
+-- Usage:       conn = connect(cconfig)
+-- Desc:        Make a connected pair of contexts, and do the handshake
+-- Return:      conn (table) sockets and contexts for both ends
+-- ***************************************************************
+
+local function connect(cconfig)
+  local s1,s2 = net.socketpair()
+  s1.nonblock = true
+  s2.nonblock = true
+  
+  local conn =
+  {
+    ssock = s1,
+    csock = s2,
+    sctx  = server:accept_socket(s1:_tofd()),
+    cctx  = tls.client(),
+  }
+  
+  assert(conn.cctx:configure(cconfig),conn.cctx:error())
+  assert(conn.cctx:connect_socket(s2:_tofd(),"localhost"),conn.cctx:error())
+  
+  local cdone,sdone
+  repeat
+    if not cdone then
+      local rc = conn.cctx:handshake()
+      assert(rc ~= tls.ERROR,conn.cctx:error())
+      cdone = rc == 0
+    end
+    if not sdone then
+      local rc = conn.sctx:handshake()
+      assert(rc ~= tls.ERROR,conn.sctx:error())
+      sdone = rc == 0
+    end
+  until cdone and sdone
+  
+  return conn
+end
+
+local function disconnect(conn)
+  conn.cctx:close()
+  conn.sctx:close()
+  conn.cctx:free()
+  conn.sctx:free()
+  conn.ssock:close()
+  conn.csock:close()
+end
+
+-- ***************************************************************
+
+local function handshakes(name,cconfig,resumed)
+  disconnect(connect(cconfig)) -- prime the session
+  
+  local count = 0
+  local hits  = 0
+  local zen   = clock.get('monotonic')
+  local now
+  
+  repeat
+    local conn = connect(cconfig)
+    if conn.sctx:conn_session_resumed() then
+      hits = hits + 1
+    end
+    disconnect(conn)
+    count = count + 1
+    now   = clock.get('monotonic')
+  until now - zen >= SECONDS
+  
+  report(name,count / (now - zen),"handshakes/sec")
+  if resumed then
+    report(name .. "-hits",hits / count * 100,"%")
+  else
+    assert(hits == 0,"unexpected resumption")
+  end
+end
+
+-- ***************************************************************
+-- The client end, writing the payload WRITESIZE at a time whenever the
+-- reader runs out of input.
+-- ***************************************************************
+
+local function mkwriter(conn,total)
+  local data    = string.rep("x",WRITESIZE)
+  local written = 0
+  
+  return function()
+    while written < total do
+      local bytes = conn.cctx:write(data:sub(1,math.min(WRITESIZE,total - written)))
+      if bytes == tls.WANT_INPUT or bytes == tls.WANT_OUTPUT then
+        return
+      end
+      assert(bytes > 0,conn.cctx:error())
+      written = written + bytes
+    end
+  end
+end
+
+-- ***************************************************************
+
+local function read_direct(conn,total,size)
+  local pump = mkwriter(conn,total)
+  local got  = 0
+  
+  while got < total do
+    local _,len = conn.sctx:read(size)
+    if len == tls.WANT_INPUT or len == tls.WANT_OUTPUT then
+      pump()
+    else
+      assert(len > 0,conn.sctx:error())
+      got = got + len
+    end
+  end
+end
+
+-- ***************************************************************
+
+local function read_ios(conn,total,size)
+  local pump = mkwriter(conn,total)
+  local ios  = mkios()
+  local got  = 0
+  
+  ios._refill = function(self)
+    while true do
+      local len = conn.sctx:read_into(self._readbuf,4 * WRITESIZE)
+      if len == tls.WANT_INPUT or len == tls.WANT_OUTPUT then
+        pump()
+      else
+        assert(len > 0,conn.sctx:error())
+        return true
+      end
+    end
+  end
+  
+  while got < total do
+    local data = ios:read(math.min(size,total - got))
+    got = got + #data
+  end
+end
+
+-- ***************************************************************
+
+local function throughput(name,reader,size)
+  local conn  = connect(client_config(false))
+  local total = MEGABYTES * 1024 * 1024
+  local zen   = clock.get('monotonic')
+  
+  reader(conn,total,size)
+  
+  local elapsed = clock.get('monotonic') - zen
+  disconnect(conn)
+  report(string.format("%s-%d",name,size),MEGABYTES / elapsed,"MB/sec")
+end
+
+-- ***************************************************************
+
+handshakes("handshake-full",client_config(false),false)
+handshakes("handshake-resumed",client_config(true),true)
+
+for _,size in ipairs { 1024 , 16384 , 65536 } do
+  throughput("read-direct",read_direct,size)
+  throughput("read-ios",read_ios,size)
+end
+
+os.remove(CERT)
+os.remove(KEY)
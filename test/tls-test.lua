@@ -0,0 +1,296 @@
+-- luacheck: ignore 611
+
+local tap   = require "tap14"
+local tls   = require "org.conman.tls"
+local net   = require "org.conman.net"
+local iobuf = require "org.conman.iobuf"
+local clock = require "org.conman.clock"
+
+-- ---------------------------------------------------------------------
+-- Both ends run in this process over a socket pair, with a throwaway
+-- certificate from openssl(1).
+-- ---------------------------------------------------------------------
+
+local function mkcert()
+  local dir  = os.tmpname()
+  local cert = dir .. ".crt"
+  local key  = dir .. ".key"
+  
+  os.remove(dir)
+  local okay = os.execute(string.format(
+        "openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1"
+        .. " -nodes -days 1 -subj /CN=localhost -keyout %s -out %s 2>/dev/null",
+        key,cert
+  ))
+  assert(okay == true or okay == 0,"openssl failed")
+  return cert,key
+end
+
+local function connect()
+  local cert,key = mkcert()
+  local sconfig  = tls.config()
+  local cconfig  = tls.config()
+  local server   = tls.server()
+  local s1,s2    = net.socketpair()
+  
+  assert(sconfig:keypair_file(cert,key),sconfig:error())
+  assert(server:configure(sconfig),server:error())
+  cconfig:insecure_no_verify_cert()
+  cconfig:insecure_no_verify_name()
+  os.remove(cert)
+  os.remove(key)
+  
+  s1.nonblock = true
+  s2.nonblock = true
+  
+  local conn =
+  {
+    ssock = s1,
+    csock = s2,
+    sctx  = server:accept_socket(s1:_tofd()),
+    cctx  = tls.client(),
+  }
+  
+  assert(conn.cctx:configure(cconfig),conn.cctx:error())
+  assert(conn.cctx:connect_socket(s2:_tofd(),"localhost"),conn.cctx:error())
+  conn.sdrv = conn.sctx:driver()
+  conn.cdrv = conn.cctx:driver()
+  return conn
+end
+
+-- ---------------------------------------------------------------------
+
+local conn = connect()
+
+tap.plan(9)
+
+tap.plan(2,"handshake") do
+  local crc = conn.cdrv:handshake()
+  local src = conn.sdrv:handshake()
+  
+  while crc == nil or src == nil do
+    if crc == nil then crc = conn.cdrv:pump() end
+    if src == nil then src = conn.sdrv:pump() end
+  end
+  
+  tap.assert(crc == 0,"client handshake")
+  tap.assert(src == 0,"server handshake")
+  tap.done()
+end
+
+tap.plan(6,"read pending") do
+  local buf      = iobuf()
+  local len,want = conn.sdrv:read_into(buf)
+  tap.assert(len == nil and want == 'r',"read with no data wants input")
+  
+  local okay,err = pcall(conn.sdrv.write,conn.sdrv,"oops")
+  tap.assert(not okay and err:match "operation in progress","second operation refused")
+  
+  len,want = conn.sdrv:pump()
+  tap.assert(len == nil and want == 'r',"still waiting")
+  
+  tap.assert(conn.cdrv:write("hello") == 5,"client write")
+  tap.assert(conn.sdrv:pump() == 5,"pump finishes the read")
+  tap.assert(buf:get() == "hello","data read into buffer")
+  tap.done()
+end
+
+tap.plan(2,"idle") do
+  tap.assert(conn.sdrv:pump() == nil,"pump with no operation")
+  tap.assert(conn.sdrv:pump() == nil,"and again")
+  tap.done()
+end
+
+tap.plan(4,"cancel") do
+  local buf      = iobuf()
+  local len,want = conn.sdrv:read_into(buf,1)
+  tap.assert(len == nil and want == 'r',"read pending")
+  conn.sdrv:cancel()
+  tap.assert(conn.sdrv:pump() == nil,"operation dropped")
+  tap.assert(conn.sdrv:write("world") == 5,"new operation after cancel")
+  tap.assert(#buf == 0,"nothing read")
+  tap.done()
+end
+
+tap.plan(2,"close") do
+  local rc = conn.cdrv:close()
+  while rc == nil do
+    rc = conn.cdrv:pump()
+  end
+  tap.assert(rc == 0,"close")
+  
+  local okay,err = pcall(conn.cdrv.handshake,conn.cdrv)
+  tap.assert(not okay and err:match "context is closed","context freed by close")
+  tap.done()
+end
+
+tap.plan(3,"reset") do
+  local ctx = tls.client()
+  ctx:configure(tls.config())
+  tap.assert(ctx:connect_mem("localhost"),"memory context")
+  tap.assert(pcall(ctx.pending_output,ctx),"has memory I/O")
+  ctx:reset()
+  tap.assert(not pcall(ctx.pending_output,ctx),"reset drops memory I/O")
+  tap.done()
+end
+
+tap.plan(4,"handshake pool") do
+  tap.assert(not pcall(tls.pool,1000000000),"too many threads rejected")
+  
+  local pool   = tls.pool(1)
+  local server = tls.server()
+  local s1,s2  = net.socketpair()
+  s1.nonblock  = true
+  
+  server:configure(tls.config())
+  local ctx1 = server:accept_socket(s1:_tofd())
+  local ctx2 = server:accept_socket(s1:_tofd())
+  
+  -- -------------------------------------------------------------------
+  -- Free the first while it's (likely) still in the pool; the pool frees
+  -- it once the worker is done with it.
+  -- -------------------------------------------------------------------
+  
+  tap.assert(pool:handshake(ctx1) and pool:handshake(ctx2),"handshakes queued")
+  ctx1:free()
+  
+  local results
+  for _ = 1 , 500 do
+    results = pool:done()
+    if next(results) then break end
+    clock.sleep(0.01)
+  end
+  
+  tap.assert(results[ctx2] ~= nil,"second handshake reported")
+  tap.assert(results[ctx1] == nil,"freed context not reported")
+  ctx2:free()
+  s1:close()
+  s2:close()
+  tap.done()
+end
+
+-- ---------------------------------------------------------------------
+-- Memory contexts, with the ciphertext passed between the two ends by
+-- hand.
+-- ---------------------------------------------------------------------
+
+tap.plan(6,"memory I/O") do
+  local cert,key = mkcert()
+  local sconfig  = tls.config()
+  local cconfig  = tls.config()
+  local server   = tls.server()
+  
+  assert(sconfig:keypair_file(cert,key),sconfig:error())
+  assert(server:configure(sconfig),server:error())
+  cconfig:insecure_no_verify_cert()
+  cconfig:insecure_no_verify_name()
+  os.remove(cert)
+  os.remove(key)
+  
+  local sctx = server:accept_mem()
+  local cctx = tls.client()
+  assert(cctx:configure(cconfig),cctx:error())
+  tap.assert(sctx and cctx:connect_mem("localhost"),"memory contexts")
+  
+  local function shuttle()
+    sctx:feed(cctx:pending_output())
+    cctx:feed(sctx:pending_output())
+  end
+  
+  local function readall(ctx,want)
+    local data = ""
+    for _ = 1 , 100 do
+      local got,size = ctx:read()
+      if size > 0 then data = data .. got end
+      if #data >= want then break end
+      shuttle()
+    end
+    return data
+  end
+  
+  local function writeall(ctx,data)
+    for _ = 1 , 100 do
+      local size = ctx:write(data)
+      if size > 0 then data = data:sub(size + 1,-1) end
+      shuttle()
+      if #data == 0 then break end
+    end
+  end
+  
+  local crc,src
+  for _ = 1 , 100 do
+    if crc ~= 0 then crc = cctx:handshake() end
+    shuttle()
+    if src ~= 0 then src = sctx:handshake() end
+    shuttle()
+    if crc == 0 and src == 0 then break end
+  end
+  tap.assert(crc == 0 and src == 0,"handshake")
+  
+  writeall(cctx,"hello, world")
+  tap.assert(readall(sctx,12) == "hello, world","client to server")
+  writeall(sctx,"goodbye")
+  tap.assert(readall(cctx,7) == "goodbye","server to client")
+  
+  local _,size = sctx:read()
+  tap.assert(size == tls.WANT_INPUT,"nothing more to read")
+  sctx:feed()
+  _,size = sctx:read()
+  tap.assert(size ~= tls.WANT_INPUT,"EOF ends the read")
+  
+  cctx:free()
+  sctx:free()
+  tap.done()
+end
+
+-- ---------------------------------------------------------------------
+-- tls.servername() on hand-built ClientHello records.
+-- ---------------------------------------------------------------------
+
+local function u16(n)
+  return string.char(math.floor(n / 256),n % 256)
+end
+
+local function record(body)
+  local hs = "\1\0" .. u16(#body) .. body
+  return "\22\3\1" .. u16(#hs) .. hs
+end
+
+local function sni(name)
+  local list = "\0" .. u16(#name) .. name
+  local data = u16(#list) .. list
+  return "\0\0" .. u16(#data) .. data
+end
+
+local HELLO   = "\3\3" .. string.rep("\0",32)
+local SID     = "\32" .. string.rep("\1",32)
+local SUITES  = u16(4) .. "\19\1\19\2"
+local COMP    = "\1\0"
+local ALPN    = "\0\16\0\5\0\3\2h2"
+
+tap.plan(10,"servername") do
+  local good = record(HELLO .. SID .. SUITES .. COMP .. u16(#ALPN + #sni("example.com")) .. ALPN .. sni("example.com"))
+  
+  tap.assert(tls.servername(good) == "example.com","server name found")
+  tap.assert(tls.servername("\22\3") == nil,"truncated record header")
+  tap.assert(tls.servername(good:sub(1,-2)) == nil,"truncated record")
+  
+  local short = true
+  for i = 1 , #good - 1 do
+    if tls.servername(good:sub(1,i)) ~= nil then short = false end
+  end
+  tap.assert(short,"every truncation needs more data")
+  
+  tap.assert(tls.servername("\23\3\3\0\5hello") == false,"application data record")
+  tap.assert(tls.servername("GET / HTTP/1.1\r\n") == false,"not TLS")
+  tap.assert(tls.servername(record(HELLO .. SID .. SUITES .. COMP .. u16(#ALPN) .. ALPN)) == false,"no SNI extension")
+  tap.assert(tls.servername(record(HELLO .. SID .. SUITES .. COMP)) == false,"no extensions")
+  tap.assert(tls.servername(record(HELLO .. SID)) == false,"ends after the session id")
+  tap.assert(tls.servername(record(HELLO .. SID .. SUITES)) == false,"ends after the cipher suites")
+  tap.done()
+end
+
+conn.sctx:close()
+conn.ssock:close()
+conn.csock:close()
+os.exit(tap.done(),true)
@@ -0,0 +1,38 @@
+-- luacheck: ignore 611
+
+local tap        = require "tap14"
+local tls        = require "org.conman.tls"
+local tlssession = require "org.conman.net.tlssession"
+
+-- ---------------------------------------------------------------------
+-- The key period comes from os.time(), so step the clock by hand.
+-- ---------------------------------------------------------------------
+
+local time = os.time
+local now  = 360000
+
+os.time = function() return now end -- luacheck: ignore 122
+
+tap.plan(1)
+
+tap.plan(7,"rotation across configs") do
+  local store = tlssession.new(string.rep("x",tls.TICKET_KEY_SIZE),3600)
+  local c1    = tls.config()
+  local c2    = tls.config()
+  
+  tap.assert(store:configure(c1),"first config")
+  tap.assert(store:configure(c2),"second config")
+  tap.assert(not store:rotate(c1) and not store:rotate(c2),"nothing to rotate in the same period")
+  
+  now = now + 3600
+  tap.assert(store:rotate(c1),"first config rotates in the next period")
+  tap.assert(store:rotate(c2),"second config rotates too")
+  tap.assert(not store:rotate(c1) and not store:rotate(c2),"each rotates only once")
+  
+  local c3 = tls.config()
+  tap.assert(store:rotate(c3),"unconfigured config gets the current key")
+  tap.done()
+end
+
+os.time = time -- luacheck: ignore 122
+os.exit(tap.done(),true)
@@ -0,0 +1,89 @@
+-- luacheck: ignore 611
+
+local tap      = require "tap14"
+local tls      = require "org.conman.tls"
+local tlsstore = require "org.conman.net.tlsstore"
+
+-- ---------------------------------------------------------------------
+-- A throwaway keypair from openssl(1), used for every host name.  The
+-- lookup function counts how often each name is asked for.
+-- ---------------------------------------------------------------------
+
+local function mkcert()
+  local dir  = os.tmpname()
+  local cert = dir .. ".crt"
+  local key  = dir .. ".key"
+  
+  os.remove(dir)
+  local okay = os.execute(string.format(
+        "openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1"
+        .. " -nodes -days 1 -subj /CN=localhost -keyout %s -out %s 2>/dev/null",
+        key,cert
+  ))
+  assert(okay == true or okay == 0,"openssl failed")
+  return cert,key
+end
+
+local CERT,KEY = mkcert()
+local SIZE     = #tls.load_file(CERT) + #tls.load_file(KEY)
+local lookups  = {}
+
+local function lookup(name)
+  lookups[name] = (lookups[name] or 0) + 1
+  if name:match "^[abc]%.example$" then
+    return CERT,KEY
+  end
+end
+
+-- ---------------------------------------------------------------------
+
+tap.plan(2)
+
+tap.plan(11,"host names") do
+  local store = tlsstore.new(lookup)
+  
+  tap.assert(store:get("A.Example"),"known name, any case")
+  tap.assert(lookups["a.example"] == 1,"looked up in lower case")
+  tap.assert(store:get("a.example") and lookups["a.example"] == 1,"loaded only once")
+  tap.assert(store:get("unknown.example") == nil,"unknown name")
+  
+  local bad =
+  {
+    "../etc/passwd",
+    "a/b.example",
+    ".a.example",
+    "a..example",
+    "-a.example",
+    string.rep("a",64) .. ".example",
+    string.rep("abcdefg.",32) .. "example",
+  }
+  
+  for _,name in ipairs(bad) do
+    tap.assert(store:get(name) == nil and lookups[name:lower()] == nil,"rejected %q",name:sub(1,20))
+  end
+  tap.done()
+end
+
+tap.plan(5,"memory limit") do
+  local store = tlsstore.new(lookup,nil,SIZE * 2.5)
+  
+  store:get("a.example")
+  store:get("b.example")
+  store:get("a.example")         -- b is now the least recently used
+  store:get("c.example")         -- over the limit, so b goes
+  
+  local a,b,c = lookups["a.example"],lookups["b.example"],lookups["c.example"]
+  
+  tap.assert(store:get("a.example") and lookups["a.example"] == a,"a kept")
+  tap.assert(store:get("c.example") and lookups["c.example"] == c,"c kept")
+  tap.assert(store:get("b.example") and lookups["b.example"] == b + 1,"b dropped and reloaded")
+  tap.assert(store.memory <= SIZE * 2.5,"memory within limit")
+  
+  local tiny = tlsstore.new(lookup,nil,1)
+  tap.assert(tiny:get("a.example"),"the latest is kept even over the limit")
+  tap.done()
+end
+
+os.remove(CERT)
+os.remove(KEY)
+os.exit(tap.done(),true)
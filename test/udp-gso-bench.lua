@@ -0,0 +1,101 @@
+-- ***************************************************************
+--
+-- UDP loopback benchmark---plain send/recv versus GSO/GRO.
+--
+-- Usage:       lua udp-gso-bench.lua [seconds [size [segments]]]
+--
+-- Sends datagrams of the given size over the loopback interface, first
+-- one per sock:send(), then batched with sock:send(addr,data,segsize) and
+-- sock.udpgro set on the receiving side, and reports packets per second
+-- received for each.
+--
+-- ***************************************************************
+-- luacheck: ignore 611
+
+local net   = require "org.conman.net"
+local clock = require "org.conman.clock"
+local errno = require "org.conman.errno"
+
+local SECONDS  = tonumber(arg[1]) or 2
+local SIZE     = tonumber(arg[2]) or 1200
+local SEGMENTS = tonumber(arg[3]) or 32
+
+-- ***************************************************************
+
+local function drain(recv)
+  local count = 0
+  while true do
+    local _,data,err,_,segsize = recv:recv()
+    if not data then
+      if err ~= errno.EAGAIN then
+        error(errno[err])
+      end
+      return count
+    end
+    
+    if segsize then
+      count = count + math.ceil(#data / segsize)
+    else
+      count = count + 1
+    end
+  end
+end
+
+-- ***************************************************************
+
+local function run(label,gso)
+  local recv = net.socket('ip','udp')
+  local send = net.socket('ip','udp')
+  
+  recv:bind(net.address('127.0.0.1','udp',0))
+  recv.nonblock   = true
+  recv.recvbuffer = 4 * 1024 * 1024
+  send.sendbuffer = 4 * 1024 * 1024
+  
+  if gso then
+    recv.udpgro = true
+  end
+  
+  local dest    = recv:addr()
+  local payload = string.rep("x",SIZE)
+  local batch   = gso and string.rep(payload,SEGMENTS) or payload
+  local total   = 0
+  local zen     = clock.get('monotonic')
+  local now     = zen
+  
+  while now - zen < SECONDS do
+    for _ = 1 , gso and 1 or SEGMENTS do
+      local _,err
+      if gso then
+        _,err = send:send(dest,batch,SIZE)
+      else
+        _,err = send:send(dest,batch)
+      end
+      if err ~= 0 then
+        error(string.format("%s: send() = %s",label,errno[err]))
+      end
+    end
+    total = total + drain(recv)
+    now   = clock.get('monotonic')
+  end
+  
+  total = total + drain(recv)
+  recv:close()
+  send:close()
+  
+  print(string.format("%-12s %10.0f packets/sec",label,total / (now - zen)))
+end
+
+-- ***************************************************************
+
+print(string.format("size=%d segments=%d seconds=%d",SIZE,SEGMENTS,SECONDS))
+run("send/recv",false)
+
+local probe = net.socket('ip','udp')
+probe.udpsegment = 0
+if probe.udpsegment == 0 then
+  run("gso/gro",true)
+else
+  print("gso/gro      not supported")
+end
+probe:close()